@@ -44,6 +44,7 @@
 #define CAM_ENABLE     8
 
 void startCameraServer();
+void publishNetworkEvent(const char *link);
 
 
 static bool eth_connected = false;
@@ -83,14 +84,17 @@ void WiFiEvent(arduino_event_id_t event)
         Serial.print("GatewayIP:");
         Serial.println(ETH.gatewayIP());
         eth_connected = true;
+        publishNetworkEvent("up");
         break;
     case ARDUINO_EVENT_ETH_DISCONNECTED:
         Serial.println("ETH Disconnected");
         eth_connected = false;
+        publishNetworkEvent("down");
         break;
     case ARDUINO_EVENT_ETH_STOP:
         Serial.println("ETH Stopped");
         eth_connected = false;
+        publishNetworkEvent("stopped");
         break;
     default:
         break;
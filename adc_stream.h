@@ -0,0 +1,387 @@
+#pragma once
+
+#include <Arduino.h>
+#include "esp_http_server.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "async_workers.h"
+#include "log_ring.h"
+#include "metrics.h"
+
+// Continuous analog sampling for /gpio/ai/stream.
+// The ADC's DMA engine converts the selected pins back to back at the
+// sampling rate and averages `avg` conversions per pin into one frame, so
+// the CPU wakes once per frame instead of once per sample. A reader task
+// copies frames into a ring. Each stream client is an async session that
+// sends the frames it has not seen yet as packed binary blocks, without
+// blocking the reader or other clients.
+// The ADC runs while at least one client is connected. A client that
+// leaves out the configuration joins the running stream.
+
+#define ADC_STREAM_MAX_PINS 10
+#define ADC_STREAM_FRAMES 2048          // Power of two
+#define ADC_STREAM_BLOCK_FRAMES 256     // Most frames sent in one block
+#define ADC_STREAM_MIN_RATE 611         // ESP32-S3 DMA sampling limits, conversions/s
+#define ADC_STREAM_MAX_RATE 83333
+#define ADC_STREAM_MAX_AVG 64
+#define ADC_STREAM_MAX_FRAME_HZ 2000    // Frames per second the reader task wakes for
+#define ADC_STREAM_TASK_STACK 3072
+#define ADC_STREAM_TASK_PRIORITY (tskIDLE_PRIORITY + 5)
+#define ADC_STREAM_TASK_CORE 1
+#define ADC_STREAM_STALL_TIMEOUT_US (10 * 1000000LL)
+#define ADC_STREAM_WAKE_US 10000        // Least time between waking the stream clients' workers
+
+typedef struct {
+  uint8_t pins[ADC_STREAM_MAX_PINS];
+  uint8_t count;
+  uint32_t rate;     // Conversions per second over all pins
+  uint32_t avg;      // Conversions averaged into each value
+} adc_stream_config_t;
+
+// Little-endian block header, followed by frames * channels 12-bit raw
+// values as uint16, one frame after another in X-ADC-Pins order
+typedef struct __attribute__((packed)) {
+  char magic[4];         // "ADCB"
+  uint32_t seq;          // First frame of the block, counted from the stream start
+  uint32_t lost;         // Frames skipped right before this block
+  uint32_t period_ns;    // Nominal time between frames
+  uint16_t frames;
+  uint8_t channels;
+  uint8_t bits;
+} adc_block_header_t;
+
+static adc_stream_config_t adc_stream_config;
+static SemaphoreHandle_t adc_stream_lock = NULL;   // Starting, stopping and reading the ADC
+static TaskHandle_t adc_stream_task = NULL;
+static int adc_stream_clients = 0;
+static bool adc_stream_running = false;
+static uint32_t *adc_stream_seqs = NULL;     // Frame sequence + 1 per slot, 0 while written
+static uint16_t *adc_stream_values = NULL;   // count values per slot
+static volatile uint32_t adc_stream_head = 0;   // Next frame to write
+
+static const char *_ADC_STREAM_RESPONSE =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "Access-Control-Expose-Headers: X-ADC-Pins, X-ADC-Rate, X-ADC-Average\r\n"
+    "X-ADC-Pins: %s\r\n"
+    "X-ADC-Rate: %u\r\n"
+    "X-ADC-Average: %u\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+// Called by the ADC driver from its interrupt once per frame
+static void IRAM_ATTR adc_stream_frame_done() {
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(adc_stream_task, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+// Single writer, so head only moves here
+static void adc_stream_push(const adc_continuous_data_t *data) {
+  uint32_t seq = adc_stream_head;
+  uint32_t slot = seq & (ADC_STREAM_FRAMES - 1);
+  __atomic_store_n(&adc_stream_seqs[slot], 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  uint16_t *values = &adc_stream_values[slot * adc_stream_config.count];
+  for (int i = 0; i < adc_stream_config.count; i++) {
+    values[i] = data[i].avg_read_raw;
+  }
+  __atomic_store_n(&adc_stream_seqs[slot], seq + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&adc_stream_head, seq + 1, __ATOMIC_RELEASE);
+  metric_inc(&metric_adc_frames);
+}
+
+static void adc_stream_reader(void *arg) {
+  int64_t last_wake = 0;
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    // Several frames may be waiting in the DMA pool per wakeup
+    xSemaphoreTake(adc_stream_lock, portMAX_DELAY);
+    uint32_t head = adc_stream_head;
+    adc_continuous_data_t *data;
+    while (adc_stream_running && analogContinuousRead(&data, 0)) {
+      adc_stream_push(data);
+    }
+    xSemaphoreGive(adc_stream_lock);
+
+    // Let the clients send what arrived instead of waiting for the worker
+    // tick, but batch frames rather than waking the workers for each one
+    int64_t now = esp_timer_get_time();
+    if (adc_stream_head != head && now - last_wake >= ADC_STREAM_WAKE_US) {
+      last_wake = now;
+      async_workers_wake();
+    }
+  }
+}
+
+static uint32_t adc_stream_period_ns(const adc_stream_config_t *config) {
+  return (uint32_t)(1000000000ULL * config->count * config->avg / config->rate);
+}
+
+// Check a configuration before starting the ADC with it
+static bool adc_stream_config_valid(const adc_stream_config_t *config, char *error, size_t len) {
+  if (config->count == 0) {
+    snprintf(error, len, "No pins given");
+  } else if (config->rate < ADC_STREAM_MIN_RATE || config->rate > ADC_STREAM_MAX_RATE) {
+    snprintf(error, len, "rate must be %d-%d", ADC_STREAM_MIN_RATE, ADC_STREAM_MAX_RATE);
+  } else if (config->avg < 1 || config->avg > ADC_STREAM_MAX_AVG) {
+    snprintf(error, len, "avg must be 1-%d", ADC_STREAM_MAX_AVG);
+  } else if (config->rate / (config->count * config->avg) > ADC_STREAM_MAX_FRAME_HZ) {
+    snprintf(error, len, "More than %d frames/s, raise avg or lower rate", ADC_STREAM_MAX_FRAME_HZ);
+  } else {
+    return true;
+  }
+  return false;
+}
+
+static void adc_stream_free() {
+  free(adc_stream_seqs);
+  free(adc_stream_values);
+  adc_stream_seqs = NULL;
+  adc_stream_values = NULL;
+}
+
+// Lock held
+static bool adc_stream_start(const adc_stream_config_t *config, char *error, size_t len) {
+  if (!adc_stream_task &&
+      xTaskCreatePinnedToCore(adc_stream_reader, "adc", ADC_STREAM_TASK_STACK, NULL, ADC_STREAM_TASK_PRIORITY,
+                              &adc_stream_task, ADC_STREAM_TASK_CORE) != pdPASS) {
+    adc_stream_task = NULL;
+    snprintf(error, len, "Failed to start ADC reader task");
+    return false;
+  }
+
+  adc_stream_seqs = (uint32_t *)heap_caps_calloc(ADC_STREAM_FRAMES, sizeof(uint32_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  adc_stream_values = (uint16_t *)heap_caps_malloc(ADC_STREAM_FRAMES * config->count * sizeof(uint16_t),
+                                                   MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!adc_stream_seqs || !adc_stream_values) {
+    adc_stream_free();
+    snprintf(error, len, "Out of memory");
+    return false;
+  }
+
+  adc_stream_config = *config;
+  adc_stream_head = 0;
+  if (!analogContinuous(config->pins, config->count, config->avg, config->rate, adc_stream_frame_done)) {
+    adc_stream_free();
+    snprintf(error, len, "ADC rejected the configuration");
+    return false;
+  }
+  adc_stream_running = true;
+  if (!analogContinuousStart()) {
+    adc_stream_running = false;
+    analogContinuousDeinit();
+    adc_stream_free();
+    snprintf(error, len, "Failed to start the ADC");
+    return false;
+  }
+  LOGR_I("ADC stream started: %d pins, %u conversions/s, %u averaged", config->count, (unsigned)config->rate,
+         (unsigned)config->avg);
+  return true;
+}
+
+// Lock held
+static void adc_stream_stop() {
+  analogContinuousStop();
+  analogContinuousDeinit();
+  adc_stream_running = false;
+  adc_stream_free();
+  LOGR_I("ADC stream stopped");
+}
+
+// Become a stream client, starting the ADC with config when it is idle.
+// config NULL joins the running stream whatever its configuration.
+static bool adc_stream_join(const adc_stream_config_t *config, char *error, size_t len) {
+  if (!adc_stream_lock) {
+    snprintf(error, len, "ADC stream not initialized");
+    return false;
+  }
+  xSemaphoreTake(adc_stream_lock, portMAX_DELAY);
+  bool joined;
+  if (adc_stream_clients > 0) {
+    joined = !config || (config->count == adc_stream_config.count && config->rate == adc_stream_config.rate &&
+                         config->avg == adc_stream_config.avg &&
+                         !memcmp(config->pins, adc_stream_config.pins, config->count));
+    if (!joined) {
+      snprintf(error, len, "ADC is streaming with other settings");
+    }
+  } else if (!config) {
+    joined = false;
+    snprintf(error, len, "No ADC stream running, give pins to start one");
+  } else {
+    joined = adc_stream_start(config, error, len);
+  }
+  if (joined) {
+    adc_stream_clients++;
+  }
+  xSemaphoreGive(adc_stream_lock);
+  return joined;
+}
+
+static void adc_stream_leave() {
+  xSemaphoreTake(adc_stream_lock, portMAX_DELAY);
+  if (--adc_stream_clients == 0) {
+    adc_stream_stop();
+  }
+  xSemaphoreGive(adc_stream_lock);
+}
+
+// Newest value of pin while it is being streamed, for /gpio/ai/read; the
+// ADC cannot take single readings of pins in continuous mode
+static bool adc_stream_latest(int pin, int *value) {
+  if (!adc_stream_lock) {
+    return false;
+  }
+  bool found = false;
+  xSemaphoreTake(adc_stream_lock, portMAX_DELAY);
+  uint32_t head = adc_stream_head;
+  for (int i = 0; adc_stream_running && i < adc_stream_config.count; i++) {
+    if (adc_stream_config.pins[i] == pin) {
+      found = true;
+      *value = head ? adc_stream_values[((head - 1) & (ADC_STREAM_FRAMES - 1)) * adc_stream_config.count + i] : 0;
+    }
+  }
+  xSemaphoreGive(adc_stream_lock);
+  return found;
+}
+
+typedef struct {
+  uint32_t next_seq;       // First frame not yet queued
+  uint8_t channels;
+  size_t len;
+  size_t off;
+  int64_t last_progress;
+  uint8_t buf[sizeof(adc_block_header_t) + ADC_STREAM_BLOCK_FRAMES * ADC_STREAM_MAX_PINS * sizeof(uint16_t)];
+} adc_client_t;
+
+// Copy the frames the client has not seen into a block. A client that fell
+// more than the ring behind skips ahead and the block reports the gap.
+static bool adc_client_fill(adc_client_t *client) {
+  uint32_t head = __atomic_load_n(&adc_stream_head, __ATOMIC_ACQUIRE);
+  uint32_t oldest = head > ADC_STREAM_FRAMES ? head - ADC_STREAM_FRAMES : 0;
+  uint32_t lost = 0;
+  if (client->next_seq < oldest) {
+    lost = oldest - client->next_seq;
+    client->next_seq = oldest;
+    metric_add(&metric_adc_frames_lost, lost);
+  }
+  uint32_t frames = min(head - client->next_seq, (uint32_t)ADC_STREAM_BLOCK_FRAMES);
+
+  uint16_t *values = (uint16_t *)(client->buf + sizeof(adc_block_header_t));
+  uint32_t copied;
+  for (copied = 0; copied < frames; copied++) {
+    uint32_t seq = client->next_seq + copied;
+    uint32_t slot = seq & (ADC_STREAM_FRAMES - 1);
+    memcpy(values + copied * client->channels, &adc_stream_values[slot * client->channels],
+           client->channels * sizeof(uint16_t));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    // Overwritten while copying, the next block reports it as lost
+    if (__atomic_load_n(&adc_stream_seqs[slot], __ATOMIC_RELAXED) != seq + 1) {
+      break;
+    }
+  }
+  if (copied == 0 && lost == 0) {
+    return false;
+  }
+
+  adc_block_header_t *header = (adc_block_header_t *)client->buf;
+  memcpy(header->magic, "ADCB", 4);
+  header->seq = client->next_seq;
+  header->lost = lost;
+  header->period_ns = adc_stream_period_ns(&adc_stream_config);
+  header->frames = copied;
+  header->channels = client->channels;
+  header->bits = 12;
+  client->len = sizeof(adc_block_header_t) + copied * client->channels * sizeof(uint16_t);
+  client->next_seq += copied;
+  return true;
+}
+
+static esp_err_t adc_session_service(async_session_t *session) {
+  adc_client_t *client = (adc_client_t *)session->ctx;
+  int64_t now = esp_timer_get_time();
+
+  while (true) {
+    if (client->off == client->len) {
+      client->off = client->len = 0;
+      if (!adc_client_fill(client)) {
+        break;
+      }
+    }
+    struct iovec iov = {client->buf + client->off, client->len - client->off};
+    ssize_t sent = async_session_try_send(session, &iov, 1);
+    if (sent < 0) {
+      return ESP_FAIL;
+    }
+    if (sent == 0) {
+      break;
+    }
+    client->off += sent;
+    client->last_progress = now;
+  }
+
+  session->want_write = client->off < client->len;
+  if (session->want_write && now - client->last_progress > ADC_STREAM_STALL_TIMEOUT_US) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t adc_session_open(async_session_t *session) {
+  adc_client_t *client = (adc_client_t *)session->ctx;
+  session->close_on_finish = true;
+
+  char pins[ADC_STREAM_MAX_PINS * 4];
+  size_t len = 0;
+  pins[0] = 0;
+  for (int i = 0; i < adc_stream_config.count; i++) {
+    len += snprintf(pins + len, sizeof(pins) - len, "%s%u", i ? "," : "", adc_stream_config.pins[i]);
+  }
+  char head[512];
+  struct iovec iov = {head, (size_t)snprintf(head, sizeof(head), _ADC_STREAM_RESPONSE, pins,
+                                             (unsigned)adc_stream_config.rate, (unsigned)adc_stream_config.avg)};
+  if (async_session_send(session, &iov, 1) != ESP_OK) {
+    return ESP_FAIL;
+  }
+  client->last_progress = esp_timer_get_time();
+  return adc_session_service(session);
+}
+
+static void adc_session_close(async_session_t *session) {
+  free(session->ctx);
+  adc_stream_leave();
+}
+
+static const async_session_ops_t adc_session_ops = {
+  adc_session_open,
+  adc_session_service,
+  adc_session_close,
+};
+
+// Hand a joined request to the async workers; leaves the stream again when
+// there is no free session
+static esp_err_t adc_stream_attach(httpd_req_t *req) {
+  adc_client_t *client = (adc_client_t *)calloc(1, sizeof(adc_client_t));
+  if (client) {
+    // New clients start at the newest frame
+    client->next_seq = __atomic_load_n(&adc_stream_head, __ATOMIC_ACQUIRE);
+    client->channels = adc_stream_config.count;
+    if (async_session_start(req, ASYNC_CLASS_CONTROL, &adc_session_ops, client) == ESP_OK) {
+      return ESP_OK;
+    }
+    free(client);
+  }
+  adc_stream_leave();
+  return ESP_FAIL;
+}
+
+void adc_stream_init() {
+  if (!adc_stream_lock) {
+    adc_stream_lock = xSemaphoreCreateMutex();
+  }
+}
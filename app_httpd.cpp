@@ -1,4 +1,5 @@
 #include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "esp_camera.h"
 #include "img_converters.h"
 #include "fb_gfx.h"
@@ -10,8 +11,21 @@
 #include "esp32-hal-log.h"
 #endif
 #include "utilities.h"
+#include "log_ring.h"
 #include "network_config.h"
+#include "camera_profiles.h"
 #include "neopixel.h"
+#include "metrics.h"
+#include "frame_fanout.h"
+#include "snapshot_cache.h"
+#include "async_workers.h"
+#include "capture_burst.h"
+#include "status_cache.h"
+#include "event_stream.h"
+#include "gpio_bulk.h"
+#include "gpio_edges.h"
+#include "adc_stream.h"
+#include "ledc_pool.h"
 #include "esp_http_server.h"
 
 // Face Detection will not work on boards without (or with disabled) PSRAM
@@ -52,13 +66,29 @@
 #endif
 
 #define PART_BOUNDARY "123456789000000000000987654321"
-static const char *_STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
-static const char *_STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
-static const char *_STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
+// Streams write their own response head and parts straight to the socket.
+// Boundary and part header are one string so each frame is a single writev.
+static const char *_STREAM_RESPONSE =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: multipart/x-mixed-replace;boundary=" PART_BOUNDARY "\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "X-Framerate: 60\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+// X-Timestamp is the driver's capture time (esp_timer clock, see /clock) and
+// X-Frame-Seq the fan-out sequence, so clients can measure latency and drops
+static const char *_STREAM_PART = "\r\n--" PART_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n"
+                                  "X-Timestamp: %d.%06d\r\nX-Frame-Seq: %u\r\n\r\n";
 
 httpd_handle_t stream_httpd = NULL;
 httpd_handle_t camera_httpd = NULL;
 
+// The stream server runs below the control server and on its own core so
+// long-lived video connections never starve the REST API
+#define STREAM_HTTPD_PRIORITY (tskIDLE_PRIORITY + 4)
+#define STREAM_HTTPD_CORE 1
+
 #if CONFIG_ESP_FACE_DETECT_ENABLED
 static int8_t detection_enabled = 0;
 static int8_t recognition_enabled = 0;
@@ -84,8 +114,6 @@ const int num_analog_output_pins = sizeof(analog_output_pins) / sizeof(analog_ou
 // Track which pins have been initialized
 bool do_pins_initialized[50] = {false};
 bool ao_pins_initialized[50] = {false};
-int ao_pin_channels[50] = {-1};
-int next_pwm_channel = 0;
 
 // Check if a pin is safe to use
 bool is_pin_safe(int pin) {
@@ -117,6 +145,7 @@ bool is_valid_ao_pin(int pin) {
     return false;
 }
 
+#if CONFIG_ESP_FACE_DETECT_ENABLED
 typedef struct
 {
     httpd_req_t *req;
@@ -138,16 +167,23 @@ static size_t jpg_encode_stream(void *arg, size_t index, const void *data, size_
     return len;
 }
 
-static esp_err_t capture_handler(httpd_req_t *req)
+// Face detection works on a fresh sensor frame and bypasses the snapshot cache
+static esp_err_t capture_face_handler(httpd_req_t *req, int64_t fr_start)
 {
     camera_fb_t *fb = NULL;
     esp_err_t res = ESP_OK;
-    int64_t fr_start = esp_timer_get_time();
+    size_t out_len, out_width, out_height;
+    uint8_t *out_buf;
+    bool s;
+    bool detected = false;
+    int face_id = 0;
 
     fb = esp_camera_fb_get();
+    metric_observe(&metric_fb_get_wait, esp_timer_get_time() - fr_start);
     if (!fb)
     {
-        Serial.println("Camera capture failed");
+        metric_inc(&metric_capture_failures);
+        LOGR_E("Camera capture failed");
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
@@ -156,33 +192,13 @@ static esp_err_t capture_handler(httpd_req_t *req)
     httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
-#if CONFIG_ESP_FACE_DETECT_ENABLED
-    size_t out_len, out_width, out_height;
-    uint8_t *out_buf;
-    bool s;
-    bool detected = false;
-    int face_id = 0;
-    if (!detection_enabled || fb->width > 400)
+    if (fb->width > 400)
     {
-#endif
-        size_t fb_len = 0;
-        if (fb->format == PIXFORMAT_JPEG)
-        {
-            fb_len = fb->len;
-            res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
-        }
-        else
-        {
-            jpg_chunking_t jchunk = {req, 0};
-            res = frame2jpg_cb(fb, 80, jpg_encode_stream, &jchunk) ? ESP_OK : ESP_FAIL;
-            httpd_resp_send_chunk(req, NULL, 0);
-            fb_len = jchunk.len;
-        }
+        jpg_chunking_t jchunk = {req, 0};
+        res = frame2jpg_cb(fb, 80, jpg_encode_stream, &jchunk) ? ESP_OK : ESP_FAIL;
+        httpd_resp_send_chunk(req, NULL, 0);
         esp_camera_fb_return(fb);
-        int64_t fr_end = esp_timer_get_time();
-        Serial.printf("JPG: %uB %ums\n", (uint32_t)(fb_len), (uint32_t)((fr_end - fr_start) / 1000));
         return res;
-#if CONFIG_ESP_FACE_DETECT_ENABLED
     }
 
     int64_t fr_ready = esp_timer_get_time();
@@ -201,7 +217,7 @@ static esp_err_t capture_handler(httpd_req_t *req)
     out_buf = (uint8_t *)malloc(out_len);
     if (!out_buf)
     {
-        Serial.println("out_buf malloc failed");
+        LOGR_E("out_buf malloc failed");
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
@@ -210,7 +226,7 @@ static esp_err_t capture_handler(httpd_req_t *req)
     if (!s)
     {
         free(out_buf);
-        Serial.println("to rgb888 failed");
+        LOGR_E("to rgb888 failed");
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
@@ -220,406 +236,1394 @@ static esp_err_t capture_handler(httpd_req_t *req)
     free(out_buf);
     if (!s)
     {
-        Serial.println("JPEG compression failed");
+        LOGR_E("JPEG compression failed");
         return ESP_FAIL;
     }
 
     int64_t fr_end = esp_timer_get_time();
-    Serial.printf("FACE: %uB %ums %s%d\n", (uint32_t)(jchunk.len), (uint32_t)((fr_end - fr_start) / 1000), detected ? "DETECTED " : "", face_id);
+    LOGR_D("FACE: %uB %ums %s%d", (uint32_t)(jchunk.len), (uint32_t)((fr_end - fr_start) / 1000), detected ? "DETECTED " : "", face_id);
     return res;
+}
 #endif
+
+// 400 for a ?scale= or ?roi= that cannot be served
+static esp_err_t jpeg_param_error(httpd_req_t *req, const char *error)
+{
+    char json[96];
+    snprintf(json, sizeof(json), "{\"error\":\"%s\",\"success\":false}", error);
+    httpd_resp_set_status(req, "400 Bad Request");
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
 }
 
-static esp_err_t stream_handler(httpd_req_t *req)
+// /capture is served from the snapshot cache. ?maxage= (ms) bounds how old
+// the returned frame may be, 0 always takes a new one. Pollers that send the
+// ETag back in If-None-Match get 304 Not Modified until the frame changes.
+// ?roi=x,y,w,h cuts a region out of the JPEG, widened to whole MCUs, and
+// ?scale=2, 4 or 8 downscales it, both without decoding to pixels.
+static esp_err_t capture_handler(httpd_req_t *req)
 {
-    camera_fb_t *fb = NULL;
-    struct timeval _timestamp;
     esp_err_t res = ESP_OK;
-    size_t _jpg_buf_len = 0;
-    uint8_t *_jpg_buf = NULL;
-    char *part_buf[128];
+    int64_t fr_start = esp_timer_get_time();
+
 #if CONFIG_ESP_FACE_DETECT_ENABLED
-    dl_matrix3du_t *image_matrix = NULL;
-    bool detected = false;
-    int face_id = 0;
-    int64_t fr_start = 0;
-    int64_t fr_ready = 0;
-    int64_t fr_face = 0;
-    int64_t fr_recognize = 0;
-    int64_t fr_encode = 0;
-    int64_t ready_time = 0;
-    int64_t face_time = 0;
-    int64_t recognize_time = 0;
-    int64_t encode_time = 0;
-    int64_t process_time = 0;
+    if (detection_enabled)
+    {
+        return capture_face_handler(req, fr_start);
+    }
 #endif
 
-    static int64_t last_frame = 0;
-    if (!last_frame)
+    char query[128];
+    char param[32];
+    int64_t max_age = SNAPSHOT_MAXAGE_MS * 1000LL;
+    int scale = 1;
+    jpeg_roi_t roi;
+    bool cropped = false;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
     {
-        last_frame = esp_timer_get_time();
+        if (httpd_query_key_value(query, "maxage", param, sizeof(param)) == ESP_OK)
+        {
+            max_age = atoi(param) * 1000LL;
+        }
+        if (httpd_query_key_value(query, "scale", param, sizeof(param)) == ESP_OK)
+        {
+            scale = jpeg_scale_param(param);
+            if (!scale)
+            {
+                return jpeg_param_error(req, "scale must be 1, 2, 4 or 8");
+            }
+        }
+        if (httpd_query_key_value(query, "roi", param, sizeof(param)) == ESP_OK)
+        {
+            cropped = jpeg_roi_param(param, &roi);
+            if (!cropped)
+            {
+                return jpeg_param_error(req, "roi must be x,y,w,h with a positive size");
+            }
+        }
     }
 
-    res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
-    if (res != ESP_OK)
+    const snapshot_t *snap = snapshot_get(max_age);
+    if (!snap)
     {
-        return res;
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    const uint8_t *jpeg = snap->buf;
+    size_t jpeg_len = snap->len;
+    jpeg_roi_t applied;
+    char roi_hdr[48];
+    if (scale > 1 || cropped)
+    {
+        if (!snapshot_transcode(snap, cropped ? &roi : NULL, scale, &jpeg, &jpeg_len, &applied))
+        {
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
+        if (cropped)
+        {
+            // The region actually sent, after widening to whole MCUs
+            snprintf(roi_hdr, sizeof(roi_hdr), "%d,%d,%d,%d", applied.x, applied.y, applied.w, applied.h);
+            httpd_resp_set_hdr(req, "X-Roi", roi_hdr);
+        }
     }
 
+    char etag[64];
+    char last_modified[32];
+    char timestamp[24];
+    snapshot_etag(snap, cropped ? &roi : NULL, scale, etag, sizeof(etag));
+    snapshot_last_modified(snap, last_modified, sizeof(last_modified));
+    snprintf(timestamp, sizeof(timestamp), "%d.%06d", (int)snap->timestamp.tv_sec, (int)snap->timestamp.tv_usec);
+
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    httpd_resp_set_hdr(req, "X-Framerate", "60");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Last-Modified", last_modified);
+    httpd_resp_set_hdr(req, "X-Timestamp", timestamp);
+
+    // If-None-Match wins over If-Modified-Since, as in RFC 9110
+    char validator[64];
+    bool not_modified = false;
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", validator, sizeof(validator)) == ESP_OK)
+    {
+        not_modified = strstr(validator, etag) != NULL || strcmp(validator, "*") == 0;
+    }
+    else if (httpd_req_get_hdr_value_str(req, "If-Modified-Since", validator, sizeof(validator)) == ESP_OK)
+    {
+        not_modified = strcmp(validator, last_modified) == 0;
+    }
+    if (not_modified)
+    {
+        metric_inc(&metric_capture_not_modified);
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
 
-#if CONFIG_ESP_FACE_DETECT_ENABLED
-    detection_enabled = 0;
-    recognition_enabled = 0;
-#endif
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
+    res = httpd_resp_send(req, (const char *)jpeg, jpeg_len);
+    int64_t fr_end = esp_timer_get_time();
+    LOGR_D("JPG: %uB %ums", (uint32_t)(jpeg_len), (uint32_t)((fr_end - fr_start) / 1000));
+    return res;
+}
 
-    while (true)
+// Per-connection state of a /stream client served by an async worker
+typedef struct
+{
+    uint32_t last_seq;
+    int64_t last_frame;
+    bool attached;
+
+    // Region from ?roi= and divisor from ?scale=; neither sends the sensor's frame
+    jpeg_roi_t roi;
+    bool cropped;
+    int scale;
+
+    // Pacing requested with ?fps= and ?maxkbps=, 0 means unlimited
+    int64_t min_interval;
+    uint32_t max_bytes_per_sec;
+    int64_t next_frame;
+    int64_t budget;
+    int64_t budget_time;
+
+    // Part in flight. body points into frame, or into copy once the client
+    // fell behind and gave the shared buffer back.
+    shared_frame_t *frame;
+    uint8_t *copy;
+    const char *head;
+    size_t head_len;
+    size_t head_off;
+    const uint8_t *body;
+    size_t body_len;
+    size_t body_off;
+    size_t part_len;
+    char part_buf[192];
+    int64_t send_start;
+    int64_t head_done;
+    int64_t last_progress;
+    uint32_t dropped;
+    uint32_t skipped_seq;
+} stream_client_t;
+
+#define STREAM_STALL_TIMEOUT_US (10 * 1000000LL)
+
+static bool stream_part_pending(stream_client_t *client)
+{
+    return client->head_off < client->head_len || client->body_off < client->body_len;
+}
+
+static void stream_part_done(stream_client_t *client)
+{
+    frame_fanout_release(client->frame);
+    client->frame = NULL;
+    free(client->copy);
+    client->copy = NULL;
+    client->head = NULL;
+    client->head_len = client->head_off = 0;
+    client->body = NULL;
+    client->body_len = client->body_off = 0;
+}
+
+// A client still sending an older frame holds a driver buffer the capture
+// task needs. Copy what is left and let the shared frame go.
+static esp_err_t stream_part_detach(stream_client_t *client)
+{
+    if (client->copy)
     {
-#if CONFIG_ESP_FACE_DETECT_ENABLED
-        detected = false;
-        face_id = 0;
-#endif
+        // The body is already this client's own transcoded copy
+        frame_fanout_release(client->frame);
+        client->frame = NULL;
+        return ESP_OK;
+    }
 
-        fb = esp_camera_fb_get();
-        if (!fb)
+    size_t rest = client->body_len - client->body_off;
+    uint8_t *copy = (uint8_t *)heap_caps_malloc(rest, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!copy)
+    {
+        copy = (uint8_t *)malloc(rest);
+    }
+    if (!copy)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(copy, client->body + client->body_off, rest);
+    frame_fanout_release(client->frame);
+    client->frame = NULL;
+    client->copy = copy;
+    client->body = copy;
+    client->body_len = rest;
+    client->body_off = 0;
+    return ESP_OK;
+}
+
+// Push as much of the part in flight as the socket takes without blocking
+static esp_err_t stream_part_flush(async_session_t *session, stream_client_t *client)
+{
+    int64_t now = esp_timer_get_time();
+
+    while (stream_part_pending(client))
+    {
+        struct iovec iov[2];
+        int iovcnt = 0;
+        if (client->head_off < client->head_len)
+        {
+            iov[iovcnt].iov_base = (void *)(client->head + client->head_off);
+            iov[iovcnt].iov_len = client->head_len - client->head_off;
+            iovcnt++;
+        }
+        if (client->body_off < client->body_len)
+        {
+            iov[iovcnt].iov_base = (void *)(client->body + client->body_off);
+            iov[iovcnt].iov_len = client->body_len - client->body_off;
+            iovcnt++;
+        }
+
+        ssize_t sent = async_session_try_send(session, iov, iovcnt);
+        if (sent < 0)
+        {
+            return ESP_FAIL;
+        }
+        if (sent == 0)
         {
-            Serial.println("Camera capture failed");
-            res = ESP_FAIL;
+            break;
+        }
+        now = esp_timer_get_time();
+        client->last_progress = now;
+        rate_control_sent(sent);
+        metric_add(&metric_stream_bytes, sent);
+
+        size_t head_rest = client->head_len - client->head_off;
+        if ((size_t)sent <= head_rest)
+        {
+            client->head_off += sent;
         }
         else
         {
-            _timestamp.tv_sec = fb->timestamp.tv_sec;
-            _timestamp.tv_usec = fb->timestamp.tv_usec;
-#if CONFIG_ESP_FACE_DETECT_ENABLED
-            fr_start = esp_timer_get_time();
-            fr_ready = fr_start;
-            fr_face = fr_start;
-            fr_encode = fr_start;
-            fr_recognize = fr_start;
-            if (fb->width > 400)
+            client->head_off = client->head_len;
+            client->body_off += sent - head_rest;
+        }
+        if (client->body && !client->head_done && client->head_off == client->head_len)
+        {
+            client->head_done = now;
+            metric_observe(&metric_stream_header_send, now - client->send_start);
+        }
+    }
+
+    session->want_write = stream_part_pending(client);
+    if (session->want_write)
+    {
+        // Backlog on a slow link: no progress for too long ends the stream
+        return (now - client->last_progress > STREAM_STALL_TIMEOUT_US) ? ESP_FAIL : ESP_OK;
+    }
+
+    if (client->body)
+    {
+        rate_control_part_sent();
+        metric_inc(&metric_frames_sent);
+        metric_observe(&metric_stream_payload_send, now - client->head_done);
+        metric_observe(&metric_stream_send, now - client->send_start);
+        int64_t frame_time = (now - client->last_frame) / 1000;
+        client->last_frame = now;
+        uint32_t fps_x10 = frame_time ? 10000 / (uint32_t)frame_time : 0;
+        LOGR_D("MJPG: %uB %ums (%u.%ufps) send %ums dropped %u",
+               (uint32_t)(client->part_len),
+               (uint32_t)frame_time, fps_x10 / 10, fps_x10 % 10,
+               (uint32_t)((now - client->send_start) / 1000), client->dropped);
+    }
+    stream_part_done(client);
+    return ESP_OK;
+}
+
+// Whether the client's fps/maxkbps limits allow starting another frame
+static bool stream_pacing_ready(stream_client_t *client, int64_t now)
+{
+    if (now < client->next_frame)
+    {
+        return false;
+    }
+    if (client->max_bytes_per_sec)
+    {
+        client->budget += (now - client->budget_time) * client->max_bytes_per_sec / 1000000;
+        client->budget_time = now;
+        // Allow at most one second of burst
+        if (client->budget > (int64_t)client->max_bytes_per_sec)
+        {
+            client->budget = client->max_bytes_per_sec;
+        }
+        if (client->budget < 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static esp_err_t stream_session_open(async_session_t *session)
+{
+    stream_client_t *client = (stream_client_t *)session->ctx;
+
+    // The response has no length and ends when the connection closes
+    session->close_on_finish = true;
+    int nodelay = 1;
+    setsockopt(session->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    // The worker is woken by the shared capture task on every new frame
+    if (!frame_fanout_attach(session->worker))
+    {
+        LOGR_W("Too many stream clients");
+        return ESP_FAIL;
+    }
+    client->attached = true;
+    __atomic_fetch_add(&metric_stream_clients, 1, __ATOMIC_RELAXED);
+
+    int64_t now = esp_timer_get_time();
+    client->last_frame = now;
+    client->last_progress = now;
+    client->budget_time = now;
+    client->head = _STREAM_RESPONSE;
+    client->head_len = strlen(_STREAM_RESPONSE);
+    return stream_part_flush(session, client);
+}
+
+static esp_err_t stream_session_service(async_session_t *session)
+{
+    stream_client_t *client = (stream_client_t *)session->ctx;
+
+    shared_frame_t *frame = frame_fanout_acquire();
+
+    if (stream_part_pending(client))
+    {
+        // Frames that arrive while the link is still busy are lost to it
+        if (frame && frame->seq != client->last_seq && frame->seq != client->skipped_seq)
+        {
+            client->skipped_seq = frame->seq;
+            rate_control_backlog_drop();
+            metric_inc(&metric_frames_dropped_backlog);
+        }
+
+        // Still on an older frame: give the driver buffer back before
+        // draining further so this client cannot starve the others
+        if (client->frame && frame && frame != client->frame && stream_part_detach(client) != ESP_OK)
+        {
+            frame_fanout_release(frame);
+            return ESP_FAIL;
+        }
+        frame_fanout_release(frame);
+        return stream_part_flush(session, client);
+    }
+
+    int64_t now = esp_timer_get_time();
+    if (!frame || frame->seq == client->last_seq)
+    {
+        frame_fanout_release(frame);
+        if (now - client->last_frame > FANOUT_TIMEOUT_MS * 1000LL)
+        {
+            LOGR_E("Camera capture failed");
+            return ESP_FAIL;
+        }
+        return ESP_OK;
+    }
+
+    if (!stream_pacing_ready(client, now))
+    {
+        if (frame->seq != client->skipped_seq)
+        {
+            client->skipped_seq = frame->seq;
+            metric_inc(&metric_frames_dropped_paced);
+        }
+        frame_fanout_release(frame);
+        return ESP_OK;
+    }
+
+    // Frames published while this client was busy or paced are skipped
+    if (client->last_seq && frame->seq - client->last_seq > 1)
+    {
+        client->dropped += frame->seq - client->last_seq - 1;
+    }
+    client->last_seq = frame->seq;
+
+    // Cropped and scaled clients share one copy per frame and variant
+    const uint8_t *jpeg = frame->buf;
+    size_t jpeg_len = frame->len;
+    if (client->scale > 1 || client->cropped)
+    {
+        bool owned;
+        if (!frame_fanout_variant(frame, client->cropped ? &client->roi : NULL, client->scale, &jpeg, &jpeg_len,
+                                  &owned))
+        {
+            frame_fanout_release(frame);
+            LOGR_E("JPEG transcode failed");
+            return ESP_FAIL;
+        }
+        if (owned)
+        {
+            client->copy = (uint8_t *)jpeg;
+        }
+    }
+
+    // Boundary, part header and JPEG leave in one write, the JPEG straight
+    // from the PSRAM frame buffer
+    size_t hlen = snprintf(client->part_buf, sizeof(client->part_buf), _STREAM_PART, jpeg_len,
+                           (int)frame->timestamp.tv_sec, (int)frame->timestamp.tv_usec, frame->seq);
+    client->frame = frame;
+    client->head = client->part_buf;
+    client->head_len = hlen;
+    client->head_off = 0;
+    client->body = jpeg;
+    client->body_len = jpeg_len;
+    client->body_off = 0;
+    client->part_len = jpeg_len;
+    client->send_start = now;
+    client->head_done = 0;
+    client->last_progress = now;
+    metric_observe(&metric_frame_age, now - frame->published);
+    if (client->min_interval)
+    {
+        client->next_frame = now + client->min_interval;
+    }
+    if (client->max_bytes_per_sec)
+    {
+        client->budget -= hlen + jpeg_len;
+    }
+    return stream_part_flush(session, client);
+}
+
+static void stream_session_close(async_session_t *session)
+{
+    stream_client_t *client = (stream_client_t *)session->ctx;
+    stream_part_done(client);
+    if (client->attached)
+    {
+        frame_fanout_detach(session->worker);
+        __atomic_fetch_sub(&metric_stream_clients, 1, __ATOMIC_RELAXED);
+    }
+    free(session->ctx);
+}
+
+static const async_session_ops_t stream_session_ops = {
+    stream_session_open,
+    stream_session_service,
+    stream_session_close,
+};
+
+// Streams run detached on the async workers so no httpd task stays busy.
+// Optional ?fps= and ?maxkbps= limit this client only. ?roi=x,y,w,h and
+// ?scale=2, 4 or 8 send it a cropped or downscaled copy while the sensor
+// keeps its frame size.
+static esp_err_t stream_handler(httpd_req_t *req)
+{
+    char query[128];
+    char param[32];
+
+    stream_client_t *client = (stream_client_t *)calloc(1, sizeof(stream_client_t));
+    if (!client)
+    {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    client->scale = 1;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+    {
+        if (httpd_query_key_value(query, "fps", param, sizeof(param)) == ESP_OK)
+        {
+            float fps = atof(param);
+            if (fps > 0)
             {
-#endif
-                if (fb->format != PIXFORMAT_JPEG)
-                {
-                    bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-                    esp_camera_fb_return(fb);
-                    fb = NULL;
-                    if (!jpeg_converted)
-                    {
-                        Serial.println("JPEG compression failed");
-                        res = ESP_FAIL;
-                    }
-                }
-                else
-                {
-                    _jpg_buf_len = fb->len;
-                    _jpg_buf = fb->buf;
-                }
-#if CONFIG_ESP_FACE_DETECT_ENABLED
+                client->min_interval = (int64_t)(1000000.0f / fps);
             }
-            else
+        }
+        if (httpd_query_key_value(query, "maxkbps", param, sizeof(param)) == ESP_OK)
+        {
+            int kbps = atoi(param);
+            if (kbps > 0)
             {
-                image_matrix = dl_matrix3du_alloc(1, fb->width, fb->height, 3);
-
-                if (!image_matrix)
-                {
-                    Serial.println("dl_matrix3du_alloc failed");
-                    res = ESP_FAIL;
-                }
-                else
-                {
-                    if (!fmt2rgb888(fb->buf, fb->len, fb->format, image_matrix->item))
-                    {
-                        Serial.println("fmt2rgb888 failed");
-                        res = ESP_FAIL;
-                    }
-                    else
-                    {
-                        fr_ready = esp_timer_get_time();
-                        ready_time = (fr_ready - fr_start) / 1000;
-                        if (detection_enabled)
-                        {
-                            fr_face = esp_timer_get_time();
-                            face_time = fr_face - fr_ready;
-                            fr_recognize = fr_face;
-                        }
-                        if (fb->format != PIXFORMAT_JPEG)
-                        {
-                            if (!fmt2jpg(image_matrix->item, fb->width * fb->height * 3, fb->width, fb->height, PIXFORMAT_RGB888, 90, &_jpg_buf, &_jpg_buf_len))
-                            {
-                                Serial.println("fmt2jpg failed");
-                                res = ESP_FAIL;
-                            }
-                            esp_camera_fb_return(fb);
-                            fb = NULL;
-                        }
-                        else
-                        {
-                            _jpg_buf = fb->buf;
-                            _jpg_buf_len = fb->len;
-                        }
-                        fr_encode = esp_timer_get_time();
-                        encode_time = (fr_encode - fr_recognize) / 1000;
-                        process_time = (fr_encode - fr_start) / 1000;
-                    }
-                    dl_matrix3du_free(image_matrix);
-                }
+                client->max_bytes_per_sec = (uint32_t)kbps * 1000 / 8;
             }
+        }
+        if (httpd_query_key_value(query, "scale", param, sizeof(param)) == ESP_OK)
+        {
+            client->scale = jpeg_scale_param(param);
+            if (!client->scale)
+            {
+                free(client);
+                return jpeg_param_error(req, "scale must be 1, 2, 4 or 8");
+            }
+        }
+        if (httpd_query_key_value(query, "roi", param, sizeof(param)) == ESP_OK)
+        {
+            client->cropped = jpeg_roi_param(param, &client->roi);
+            if (!client->cropped)
+            {
+                free(client);
+                return jpeg_param_error(req, "roi must be x,y,w,h with a positive size");
+            }
+        }
+    }
+
+    if (async_session_start(req, ASYNC_CLASS_STREAM, &stream_session_ops, client) != ESP_OK)
+    {
+        free(client);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+        return httpd_resp_send(req, "Too many stream clients", HTTPD_RESP_USE_STRLEN);
+    }
+    return ESP_OK;
+}
+
+// Server clock in the X-Timestamp time base. Clients sample it a few times
+// and keep the reply with the shortest round trip to estimate their offset.
+static esp_err_t clock_handler(httpd_req_t *req)
+{
+    char json[96];
+    int64_t now = esp_timer_get_time();
+    snprintf(json, sizeof(json), "{\"timestamp\":\"%d.%06d\",\"us\":%lld}",
+             (int)(now / 1000000), (int)(now % 1000000), (long long)now);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    return httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+}
+
+// Handler redirecting /stream on the control port to the stream server
+static esp_err_t stream_redirect_handler(httpd_req_t *req)
+{
+    char host[64] = {0};
+    char query[128] = {0};
+    char location[256];
+
+    if (httpd_req_get_hdr_value_str(req, "Host", host, sizeof(host)) != ESP_OK) {
+        strncpy(host, ETH.localIP().toString().c_str(), sizeof(host) - 1);
+    }
+    // Strip the control port from the Host header. An IPv6 literal is
+    // bracketed and holds colons of its own, so look after the ']'.
+    char *close = host[0] == '[' ? strchr(host, ']') : NULL;
+    char *colon = strchr(close ? close : host, ':');
+    if (colon) {
+        *colon = '\0';
+    }
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        snprintf(location, sizeof(location), "http://%s:%u/stream?%s", host, networkConfig.stream_port, query);
+    } else {
+        snprintf(location, sizeof(location), "http://%s:%u/stream", host, networkConfig.stream_port);
+    }
+
+    httpd_resp_set_status(req, "302 Found");
+    httpd_resp_set_hdr(req, "Location", location);
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+// Camera controls shared by /control and /status, in the order they are
+// applied and reported. Ranges are the union over the OV2640, OV3660 and
+// OV5640 (gains and exposure reach furthest on the latter two); each
+// driver clamps or rejects what its own sensor does not take.
+typedef struct
+{
+    const char *name;
+    int min;
+    int max;
+    int (*set)(sensor_t *s, int val); // 0 on success
+    int (*get)(sensor_t *s);
+} camera_control_t;
+
+#define CAMERA_CONTROL_ACCESSORS(field, setter)                                                                        \
+    static int control_set_##field(sensor_t *s, int val) { return s->setter(s, val); }                                \
+    static int control_get_##field(sensor_t *s) { return s->status.field; }
+
+static int control_set_framesize(sensor_t *s, int val)
+{
+    // Other pixel formats are sized for the frame buffers allocated at init
+    return s->pixformat == PIXFORMAT_JPEG ? s->set_framesize(s, (framesize_t)val) : 0;
+}
+static int control_get_framesize(sensor_t *s) { return s->status.framesize; }
+static int control_set_gainceiling(sensor_t *s, int val) { return s->set_gainceiling(s, (gainceiling_t)val); }
+static int control_get_gainceiling(sensor_t *s) { return s->status.gainceiling; }
+
+CAMERA_CONTROL_ACCESSORS(quality, set_quality)
+CAMERA_CONTROL_ACCESSORS(brightness, set_brightness)
+CAMERA_CONTROL_ACCESSORS(contrast, set_contrast)
+CAMERA_CONTROL_ACCESSORS(saturation, set_saturation)
+CAMERA_CONTROL_ACCESSORS(sharpness, set_sharpness)
+CAMERA_CONTROL_ACCESSORS(special_effect, set_special_effect)
+CAMERA_CONTROL_ACCESSORS(wb_mode, set_wb_mode)
+CAMERA_CONTROL_ACCESSORS(awb, set_whitebal)
+CAMERA_CONTROL_ACCESSORS(awb_gain, set_awb_gain)
+CAMERA_CONTROL_ACCESSORS(aec, set_exposure_ctrl)
+CAMERA_CONTROL_ACCESSORS(aec2, set_aec2)
+CAMERA_CONTROL_ACCESSORS(ae_level, set_ae_level)
+CAMERA_CONTROL_ACCESSORS(aec_value, set_aec_value)
+CAMERA_CONTROL_ACCESSORS(agc, set_gain_ctrl)
+CAMERA_CONTROL_ACCESSORS(agc_gain, set_agc_gain)
+CAMERA_CONTROL_ACCESSORS(bpc, set_bpc)
+CAMERA_CONTROL_ACCESSORS(wpc, set_wpc)
+CAMERA_CONTROL_ACCESSORS(raw_gma, set_raw_gma)
+CAMERA_CONTROL_ACCESSORS(lenc, set_lenc)
+CAMERA_CONTROL_ACCESSORS(vflip, set_vflip)
+CAMERA_CONTROL_ACCESSORS(hmirror, set_hmirror)
+CAMERA_CONTROL_ACCESSORS(dcw, set_dcw)
+CAMERA_CONTROL_ACCESSORS(colorbar, set_colorbar)
+
+#if CONFIG_ESP_FACE_DETECT_ENABLED
+static int control_set_face_detect(sensor_t *s, int val)
+{
+    detection_enabled = val;
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+    if (!detection_enabled)
+    {
+        recognition_enabled = 0;
+    }
+#endif
+    return 0;
+}
+static int control_get_face_detect(sensor_t *s) { return detection_enabled; }
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+static int control_set_face_enroll(sensor_t *s, int val)
+{
+    is_enrolling = val;
+    return 0;
+}
+static int control_get_face_enroll(sensor_t *s) { return is_enrolling; }
+static int control_set_face_recognize(sensor_t *s, int val)
+{
+    recognition_enabled = val;
+    if (recognition_enabled)
+    {
+        detection_enabled = val;
+    }
+    return 0;
+}
+static int control_get_face_recognize(sensor_t *s) { return recognition_enabled; }
+#endif
+#endif
+
+static int control_set_ir_led(sensor_t *s, int val)
+{
+    digitalWrite(IR_FILTER_NUM, val ? HIGH : LOW);
+    return 0;
+}
+static int control_get_ir_led(sensor_t *s) { return digitalRead(IR_FILTER_NUM); }
+
+#define CAMERA_CONTROL(field, min, max) {#field, min, max, control_set_##field, control_get_##field}
+
+static const camera_control_t camera_controls[] = {
+    CAMERA_CONTROL(framesize, 0, FRAMESIZE_INVALID - 1),
+    CAMERA_CONTROL(quality, 0, 63),
+    CAMERA_CONTROL(brightness, -3, 3),
+    CAMERA_CONTROL(contrast, -3, 3),
+    CAMERA_CONTROL(saturation, -4, 4),
+    CAMERA_CONTROL(sharpness, -3, 3),
+    CAMERA_CONTROL(special_effect, 0, 6),
+    CAMERA_CONTROL(wb_mode, 0, 4),
+    CAMERA_CONTROL(awb, 0, 1),
+    CAMERA_CONTROL(awb_gain, 0, 1),
+    CAMERA_CONTROL(aec, 0, 1),
+    CAMERA_CONTROL(aec2, 0, 1),
+    CAMERA_CONTROL(ae_level, -5, 5),
+    CAMERA_CONTROL(aec_value, 0, 1536),
+    CAMERA_CONTROL(agc, 0, 1),
+    CAMERA_CONTROL(agc_gain, 0, 64),
+    CAMERA_CONTROL(gainceiling, 0, 511),
+    CAMERA_CONTROL(bpc, 0, 1),
+    CAMERA_CONTROL(wpc, 0, 1),
+    CAMERA_CONTROL(raw_gma, 0, 1),
+    CAMERA_CONTROL(lenc, 0, 1),
+    CAMERA_CONTROL(vflip, 0, 1),
+    CAMERA_CONTROL(hmirror, 0, 1),
+    CAMERA_CONTROL(dcw, 0, 1),
+    CAMERA_CONTROL(colorbar, 0, 1),
+#if CONFIG_ESP_FACE_DETECT_ENABLED
+    CAMERA_CONTROL(face_detect, 0, 1),
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+    CAMERA_CONTROL(face_enroll, 0, 1),
+    CAMERA_CONTROL(face_recognize, 0, 1),
+#endif
 #endif
+    CAMERA_CONTROL(ir_led, 0, 1),
+};
+
+#define NUM_CAMERA_CONTROLS (int)(sizeof(camera_controls) / sizeof(camera_controls[0]))
+#define CONTROL_MAX_REQUEST 512
+
+// Controls to change in one /control request
+typedef struct
+{
+    int value[NUM_CAMERA_CONTROLS];
+    bool given[NUM_CAMERA_CONTROLS];
+    int count;
+} control_batch_t;
+
+static int control_find(const char *name)
+{
+    for (int i = 0; i < NUM_CAMERA_CONTROLS; i++)
+    {
+        if (!strcmp(camera_controls[i].name, name))
+        {
+            return i;
         }
-        if (res == ESP_OK)
+    }
+    return -1;
+}
+
+// Validate one name/value pair into the batch. On failure error holds a
+// JSON error object.
+static bool control_batch_add(control_batch_t *batch, const char *name, const char *value, bool skip_unknown,
+                              char *error, size_t error_len)
+{
+    int i = control_find(name);
+    if (i < 0 && skip_unknown)
+    {
+        return true;
+    }
+    if (i < 0)
+    {
+        // Names are echoed back, so only keep characters a control can have
+        char shown[24];
+        size_t n = 0;
+        while (name[n] && n < sizeof(shown) - 1 && (isalnum((unsigned char)name[n]) || name[n] == '_'))
         {
-            res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
+            shown[n] = name[n];
+            n++;
         }
-        if (res == ESP_OK)
+        shown[n] = 0;
+        snprintf(error, error_len, "{\"error\":\"Unknown control\",\"control\":\"%s\",\"success\":false}", shown);
+        return false;
+    }
+
+    const camera_control_t *ctl = &camera_controls[i];
+    char *end;
+    long val = strtol(value, &end, 10);
+    if (!*value || *end || val < ctl->min || val > ctl->max)
+    {
+        snprintf(error, error_len,
+                 "{\"error\":\"Invalid value\",\"control\":\"%s\",\"min\":%d,\"max\":%d,\"success\":false}",
+                 ctl->name, ctl->min, ctl->max);
+        return false;
+    }
+    if (!batch->given[i])
+    {
+        batch->given[i] = true;
+        batch->count++;
+    }
+    batch->value[i] = val;
+    return true;
+}
+
+// Parse a query string or form body: either the legacy var=&val= pair or
+// any number of name=value pairs. Names starting with '_' are cache
+// busters (_=, _t=) and ignored. Stored profiles skip unknown names, which
+// belong to controls a firmware update removed.
+static bool control_batch_parse(control_batch_t *batch, char *query, bool skip_unknown, char *error,
+                                size_t error_len)
+{
+    char variable[32];
+    char value[16];
+    if (httpd_query_key_value(query, "var", variable, sizeof(variable)) == ESP_OK &&
+        httpd_query_key_value(query, "val", value, sizeof(value)) == ESP_OK)
+    {
+        return control_batch_add(batch, variable, value, skip_unknown, error, error_len);
+    }
+
+    char *save = NULL;
+    for (char *item = strtok_r(query, "&", &save); item; item = strtok_r(NULL, "&", &save))
+    {
+        char *eq = strchr(item, '=');
+        if (eq)
         {
-            size_t hlen = snprintf((char *)part_buf, 128, _STREAM_PART, _jpg_buf_len);
-            res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
+            *eq = 0;
         }
-        if (res == ESP_OK)
+        if (item[0] == '_')
         {
-            res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
+            continue;
         }
-        if (fb)
+        if (!control_batch_add(batch, item, eq ? eq + 1 : "", skip_unknown, error, error_len))
         {
-            esp_camera_fb_return(fb);
-            fb = NULL;
-            _jpg_buf = NULL;
+            return false;
         }
-        else if (_jpg_buf)
+    }
+    if (!batch->count)
+    {
+        snprintf(error, error_len, "{\"error\":\"No controls given\",\"success\":false}");
+        return false;
+    }
+    return true;
+}
+
+// Apply a validated batch in registry order. If a setter fails, the
+// controls already changed are put back and its index is returned.
+static int control_batch_apply(sensor_t *s, const control_batch_t *batch)
+{
+    int previous[NUM_CAMERA_CONTROLS];
+    int failed = -1;
+    for (int i = 0; i < NUM_CAMERA_CONTROLS; i++)
+    {
+        if (!batch->given[i])
         {
-            free(_jpg_buf);
-            _jpg_buf = NULL;
+            continue;
         }
-        if (res != ESP_OK)
+        previous[i] = camera_controls[i].get(s);
+        if (camera_controls[i].set(s, batch->value[i]))
         {
+            failed = i;
             break;
         }
-        int64_t fr_end = esp_timer_get_time();
+    }
+    if (failed >= 0)
+    {
+        for (int i = failed - 1; i >= 0; i--)
+        {
+            if (batch->given[i])
+            {
+                camera_controls[i].set(s, previous[i]);
+            }
+        }
+    }
+    // Frames the sensor started during the change are never published
+    frame_fanout_settle();
+    status_cache_notify();
 
-#if CONFIG_ESP_FACE_DETECT_ENABLED
-        int64_t frame_time = fr_end - last_frame;
-        last_frame = fr_end;
-        frame_time /= 1000;
-        uint32_t avg_frame_time = ra_filter_run(&ra_filter, frame_time);
-        Serial.printf("MJPG: %uB %ums (%.1ffps), AVG: %ums (%.1ffps), %u+%u+%u+%u=%u %s%d\n",
-                      (uint32_t)(_jpg_buf_len),
-                      (uint32_t)frame_time, 1000.0 / (uint32_t)frame_time,
-                      avg_frame_time, 1000.0 / avg_frame_time,
-                      (uint32_t)ready_time, (uint32_t)face_time, (uint32_t)recognize_time, (uint32_t)encode_time, (uint32_t)process_time,
-                      (detected) ? "DETECTED " : "", face_id);
-#else
-        int64_t frame_time = fr_end - last_frame;
-        last_frame = fr_end;
-        frame_time /= 1000;
-        Serial.printf("MJPG: %uB %ums (%.1ffps)\n",
-                      (uint32_t)(_jpg_buf_len),
-                      (uint32_t)frame_time, 1000.0 / (uint32_t)frame_time);
-#endif
+    if (failed < 0)
+    {
+        // /events gets only the values that actually changed
+        char delta[EVENT_DATA_MAX];
+        size_t used = 0;
+        for (int i = 0; i < NUM_CAMERA_CONTROLS && used < sizeof(delta); i++)
+        {
+            int value = batch->given[i] ? camera_controls[i].get(s) : 0;
+            if (batch->given[i] && value != previous[i])
+            {
+                used += snprintf(delta + used, sizeof(delta) - used, "%s\"%s\":%d", used ? "," : "{",
+                                 camera_controls[i].name, value);
+            }
+        }
+        if (used && used < sizeof(delta))
+        {
+            events_publish("status", "%s}", delta);
+        }
+    }
+    return failed;
+}
+
+// /control?var=quality&val=10 or /control?framesize=8&quality=10&awb=1,
+// the latter also as a form-encoded POST body. Everything is validated
+// before anything is applied.
+static esp_err_t cmd_handler(httpd_req_t *req)
+{
+    char request[CONTROL_MAX_REQUEST];
+    char json[128];
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    if (req->method == HTTP_POST)
+    {
+        if (req->content_len >= sizeof(request))
+        {
+            httpd_resp_set_status(req, "400 Bad Request");
+            return httpd_resp_send(req, "{\"error\":\"Body too long\",\"success\":false}", HTTPD_RESP_USE_STRLEN);
+        }
+        size_t got = 0;
+        while (got < req->content_len)
+        {
+            int n = httpd_req_recv(req, request + got, req->content_len - got);
+            if (n == HTTPD_SOCK_ERR_TIMEOUT)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                return ESP_FAIL;
+            }
+            got += n;
+        }
+        request[got] = 0;
+    }
+    else if (httpd_req_get_url_query_str(req, request, sizeof(request)) != ESP_OK)
+    {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+
+    control_batch_t batch = {};
+    if (!control_batch_parse(&batch, request, false, json, sizeof(json)))
+    {
+        httpd_resp_set_status(req, "400 Bad Request");
+        return httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+    }
+
+    sensor_t *s = esp_camera_sensor_get();
+    int64_t start = esp_timer_get_time();
+    int failed = control_batch_apply(s, &batch);
+    if (failed >= 0)
+    {
+        LOGR_E("Setting %s failed, %d controls rolled back", camera_controls[failed].name, batch.count);
+        snprintf(json, sizeof(json), "{\"error\":\"Setting failed, batch rolled back\",\"control\":\"%s\",\"success\":false}",
+                 camera_controls[failed].name);
+        httpd_resp_set_status(req, "500 Internal Server Error");
+        return httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+    }
+    LOGR_D("Applied %d controls in %lld us", batch.count, esp_timer_get_time() - start);
+
+    snprintf(json, sizeof(json), "{\"applied\":%d,\"success\":true}", batch.count);
+    return httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+}
+
+// FNV-1a over every control value, the /status ETag
+static uint32_t status_fingerprint()
+{
+    sensor_t *s = esp_camera_sensor_get();
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < NUM_CAMERA_CONTROLS; i++)
+    {
+        uint32_t value = camera_controls[i].get(s);
+        for (int b = 0; b < 4; b++)
+        {
+            hash = (hash ^ ((value >> (b * 8)) & 0xFF)) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+static size_t status_render(char *buf, size_t len)
+{
+    sensor_t *s = esp_camera_sensor_get();
+    size_t used = snprintf(buf, len, "{");
+    for (int i = 0; i < NUM_CAMERA_CONTROLS && used < len; i++)
+    {
+        used += snprintf(buf + used, len - used, "%s\"%s\":%d", i ? "," : "", camera_controls[i].name,
+                         camera_controls[i].get(s));
+    }
+    if (used < len)
+    {
+        used += snprintf(buf + used, len - used, "}");
+    }
+    return used < len ? used : len - 1;
+}
+
+// Current value of every control as a /control query
+static bool control_format_current(sensor_t *s, char *buf, size_t len)
+{
+    size_t used = 0;
+    for (int i = 0; i < NUM_CAMERA_CONTROLS; i++)
+    {
+        int n = snprintf(buf + used, len - used, "%s%s=%d", i ? "&" : "", camera_controls[i].name,
+                         camera_controls[i].get(s));
+        if (n < 0 || (size_t)n >= len - used)
+        {
+            return false;
+        }
+        used += n;
+    }
+    return true;
+}
+
+// Apply a stored profile in one batch, like /control. Only controls that
+// differ from the current values are set: a profile holds every control,
+// and those the sensor does not implement (sharpness on the OV2640) fail
+// when set but never differ, since they could not have been changed before
+// saving. On failure error holds a JSON error object.
+static bool camera_profile_apply(int slot, int *applied, char *error, size_t error_len)
+{
+    char settings[PROFILE_SETTINGS_LEN];
+    memcpy(settings, camera_profiles.slots[slot].settings, sizeof(settings));
+
+    control_batch_t batch = {};
+    if (!control_batch_parse(&batch, settings, true, error, error_len))
+    {
+        return false;
+    }
+    sensor_t *s = esp_camera_sensor_get();
+    for (int i = 0; i < NUM_CAMERA_CONTROLS; i++)
+    {
+        if (batch.given[i] && camera_controls[i].get(s) == batch.value[i])
+        {
+            batch.given[i] = false;
+            batch.count--;
+        }
+    }
+    int failed = control_batch_apply(s, &batch);
+    if (failed >= 0)
+    {
+        snprintf(error, error_len, "{\"error\":\"Setting failed, batch rolled back\",\"control\":\"%s\",\"success\":false}",
+                 camera_controls[failed].name);
+        return false;
+    }
+    *applied = batch.count;
+    return true;
+}
+
+static void camera_profiles_init()
+{
+    camera_profiles_load();
+    int slot = camera_profiles.default_slot;
+    if (slot < 0)
+    {
+        return;
+    }
+
+    char error[128];
+    int applied = 0;
+    if (camera_profile_apply(slot, &applied, error, sizeof(error)))
+    {
+        LOGR_I("Applied camera profile %s, %d controls", camera_profiles.slots[slot].name, applied);
+    }
+    else
+    {
+        LOGR_E("Camera profile %s not applied: %s", camera_profiles.slots[slot].name, error);
+    }
+}
+
+static esp_err_t profile_send_error(httpd_req_t *req, const char *status, const char *error)
+{
+    char json[96];
+    snprintf(json, sizeof(json), "{\"error\":\"%s\",\"success\":false}", error);
+    httpd_resp_set_status(req, status);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+}
+
+// Profile named by ?name=, or -1 after answering the request. With create
+// set, a valid name that is not stored yet returns PROFILE_MAX.
+static int profile_from_query(httpd_req_t *req, char *query, size_t query_len, char *name, bool create)
+{
+    if (httpd_req_get_url_query_str(req, query, query_len) != ESP_OK ||
+        httpd_query_key_value(query, "name", name, PROFILE_NAME_LEN) != ESP_OK || !camera_profile_name_valid(name))
+    {
+        profile_send_error(req, "400 Bad Request", "Profile name must be 1-15 letters, digits, _ or -");
+        return -1;
+    }
+    int slot = camera_profile_find(name);
+    if (slot < 0 && !create)
+    {
+        profile_send_error(req, "404 Not Found", "No such profile");
+        return -1;
+    }
+    return slot < 0 ? PROFILE_MAX : slot;
+}
+
+// ?default=1 makes the profile the boot profile, ?default=0 stops it being one
+static void profile_set_default(const char *query, int slot)
+{
+    char param[4];
+    if (httpd_query_key_value(query, "default", param, sizeof(param)) != ESP_OK)
+    {
+        return;
+    }
+    if (atoi(param))
+    {
+        camera_profiles.default_slot = slot;
+    }
+    else if (camera_profiles.default_slot == slot)
+    {
+        camera_profiles.default_slot = -1;
+    }
+}
+
+static esp_err_t profile_list_handler(httpd_req_t *req)
+{
+    size_t len = 64 + PROFILE_MAX * (PROFILE_NAME_LEN + PROFILE_SETTINGS_LEN + 32);
+    char *json = (char *)malloc(len);
+    if (!json)
+    {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    int slot = camera_profiles.default_slot;
+    char *p = json;
+    p += sprintf(p, "{\"default\":%s%s%s,\"profiles\":[", slot < 0 ? "" : "\"",
+                 slot < 0 ? "null" : camera_profiles.slots[slot].name, slot < 0 ? "" : "\"");
+    bool first = true;
+    for (int i = 0; i < PROFILE_MAX; i++)
+    {
+        if (camera_profiles.slots[i].name[0])
+        {
+            p += sprintf(p, "%s{\"name\":\"%s\",\"settings\":\"%s\"}", first ? "" : ",", camera_profiles.slots[i].name,
+                         camera_profiles.slots[i].settings);
+            first = false;
+        }
+    }
+    sprintf(p, "],\"max\":%d,\"success\":true}", PROFILE_MAX);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    esp_err_t res = httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+    free(json);
+    return res;
+}
+
+// Save the current settings: /profile/save?name=night[&default=1]
+static esp_err_t profile_save_handler(httpd_req_t *req)
+{
+    char query[64];
+    char name[PROFILE_NAME_LEN];
+    if (profile_from_query(req, query, sizeof(query), name, true) < 0)
+    {
+        return ESP_FAIL;
+    }
+
+    char settings[PROFILE_SETTINGS_LEN];
+    if (!control_format_current(esp_camera_sensor_get(), settings, sizeof(settings)))
+    {
+        return profile_send_error(req, "500 Internal Server Error", "Settings do not fit in a profile");
+    }
+    int slot = camera_profile_store(name, settings);
+    if (slot < 0)
+    {
+        return profile_send_error(req, "400 Bad Request", "All profile slots are in use");
+    }
+    profile_set_default(query, slot);
+    if (!camera_profiles_commit())
+    {
+        return profile_send_error(req, "500 Internal Server Error", "Saving profiles failed");
+    }
+    LOGR_I("Saved camera profile %s", name);
+
+    char json[96];
+    snprintf(json, sizeof(json), "{\"name\":\"%s\",\"default\":%s,\"success\":true}", name,
+             camera_profiles.default_slot == slot ? "true" : "false");
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+}
+
+// Switch profiles in one call: /profile/apply?name=night[&default=1]
+static esp_err_t profile_apply_handler(httpd_req_t *req)
+{
+    char query[64];
+    char name[PROFILE_NAME_LEN];
+    int slot = profile_from_query(req, query, sizeof(query), name, false);
+    if (slot < 0)
+    {
+        return ESP_FAIL;
+    }
+
+    char json[128];
+    int applied = 0;
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    if (!camera_profile_apply(slot, &applied, json, sizeof(json)))
+    {
+        LOGR_E("Camera profile %s not applied", name);
+        httpd_resp_set_status(req, "500 Internal Server Error");
+        return httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+    }
+    int old_default = camera_profiles.default_slot;
+    profile_set_default(query, slot);
+    if (camera_profiles.default_slot != old_default && !camera_profiles_commit())
+    {
+        return profile_send_error(req, "500 Internal Server Error", "Saving profiles failed");
+    }
+    LOGR_I("Applied camera profile %s, %d controls", name, applied);
+
+    snprintf(json, sizeof(json), "{\"name\":\"%s\",\"applied\":%d,\"success\":true}", name, applied);
+    return httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+}
+
+static esp_err_t profile_delete_handler(httpd_req_t *req)
+{
+    char query[64];
+    char name[PROFILE_NAME_LEN];
+    int slot = profile_from_query(req, query, sizeof(query), name, false);
+    if (slot < 0)
+    {
+        return ESP_FAIL;
+    }
+    camera_profile_delete(slot);
+    if (!camera_profiles_commit())
+    {
+        return profile_send_error(req, "500 Internal Server Error", "Saving profiles failed");
     }
+    LOGR_I("Deleted camera profile %s", name);
 
-    last_frame = 0;
-    return res;
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, "{\"success\":true}", HTTPD_RESP_USE_STRLEN);
 }
 
-static esp_err_t cmd_handler(httpd_req_t *req)
+// Integer query parameter; decimal or 0x-prefixed hex
+static int parse_get_var(const char *query, const char *key, int def)
 {
-    char *buf;
-    size_t buf_len;
-    char variable[32] = {
-        0,
-    };
-    char value[32] = {
-        0,
-    };
+    char value[16];
+    if (httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK)
+    {
+        return def;
+    }
+    return strtol(value, NULL, 0);
+}
 
-    buf_len = httpd_req_get_url_query_len(req) + 1;
-    if (buf_len > 1)
+// Register numbers are the driver's: on the OV2640 bit 8 selects the
+// sensor bank (0x1xx) over the DSP bank (0x0xx)
+static esp_err_t reg_handler(httpd_req_t *req)
+{
+    char query[96];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK)
     {
-        buf = (char *)malloc(buf_len);
-        if (!buf)
-        {
-            httpd_resp_send_500(req);
-            return ESP_FAIL;
-        }
-        if (httpd_req_get_url_query_str(req, buf, buf_len) == ESP_OK)
-        {
-            if (httpd_query_key_value(buf, "var", variable, sizeof(variable)) == ESP_OK &&
-                httpd_query_key_value(buf, "val", value, sizeof(value)) == ESP_OK)
-            {
-            }
-            else
-            {
-                free(buf);
-                httpd_resp_send_404(req);
-                return ESP_FAIL;
-            }
-        }
-        else
-        {
-            free(buf);
-            httpd_resp_send_404(req);
-            return ESP_FAIL;
-        }
-        free(buf);
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
     }
-    else
+    int reg = parse_get_var(query, "reg", -1);
+    int mask = parse_get_var(query, "mask", -1);
+    int val = parse_get_var(query, "val", -1);
+    if (reg < 0 || mask < 0 || val < 0)
     {
         httpd_resp_send_404(req);
         return ESP_FAIL;
     }
+    LOGR_I("Set Register: reg: 0x%02x, mask: 0x%02x, value: 0x%02x", reg, mask, val);
 
-    int val = atoi(value);
     sensor_t *s = esp_camera_sensor_get();
-    int res = 0;
-
-    if (!strcmp(variable, "framesize"))
-    {
-        if (s->pixformat == PIXFORMAT_JPEG)
-            res = s->set_framesize(s, (framesize_t)val);
-    }
-    else if (!strcmp(variable, "quality"))
-        res = s->set_quality(s, val);
-    else if (!strcmp(variable, "contrast"))
-        res = s->set_contrast(s, val);
-    else if (!strcmp(variable, "brightness"))
-        res = s->set_brightness(s, val);
-    else if (!strcmp(variable, "saturation"))
-        res = s->set_saturation(s, val);
-    else if (!strcmp(variable, "gainceiling"))
-        res = s->set_gainceiling(s, (gainceiling_t)val);
-    else if (!strcmp(variable, "colorbar"))
-        res = s->set_colorbar(s, val);
-    else if (!strcmp(variable, "awb"))
-        res = s->set_whitebal(s, val);
-    else if (!strcmp(variable, "agc"))
-        res = s->set_gain_ctrl(s, val);
-    else if (!strcmp(variable, "aec"))
-        res = s->set_exposure_ctrl(s, val);
-    else if (!strcmp(variable, "hmirror"))
-        res = s->set_hmirror(s, val);
-    else if (!strcmp(variable, "vflip"))
-        res = s->set_vflip(s, val);
-    else if (!strcmp(variable, "awb_gain"))
-        res = s->set_awb_gain(s, val);
-    else if (!strcmp(variable, "agc_gain"))
-        res = s->set_agc_gain(s, val);
-    else if (!strcmp(variable, "aec_value"))
-        res = s->set_aec_value(s, val);
-    else if (!strcmp(variable, "aec2"))
-        res = s->set_aec2(s, val);
-    else if (!strcmp(variable, "dcw"))
-        res = s->set_dcw(s, val);
-    else if (!strcmp(variable, "bpc"))
-        res = s->set_bpc(s, val);
-    else if (!strcmp(variable, "wpc"))
-        res = s->set_wpc(s, val);
-    else if (!strcmp(variable, "raw_gma"))
-        res = s->set_raw_gma(s, val);
-    else if (!strcmp(variable, "lenc"))
-        res = s->set_lenc(s, val);
-    else if (!strcmp(variable, "special_effect"))
-        res = s->set_special_effect(s, val);
-    else if (!strcmp(variable, "wb_mode"))
-        res = s->set_wb_mode(s, val);
-    else if (!strcmp(variable, "ae_level"))
-        res = s->set_ae_level(s, val);
-#if CONFIG_ESP_FACE_DETECT_ENABLED
-    else if (!strcmp(variable, "face_detect"))
+    if (s->set_reg(s, reg, mask, val))
     {
-        detection_enabled = val;
-#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-        if (!detection_enabled)
-        {
-            recognition_enabled = 0;
-        }
-#endif
+        return httpd_resp_send_500(req);
     }
-#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-    else if (!strcmp(variable, "face_enroll"))
-        is_enrolling = val;
-    else if (!strcmp(variable, "face_recognize"))
+    status_cache_notify();
+
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+static esp_err_t greg_handler(httpd_req_t *req)
+{
+    char query[96];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK)
     {
-        recognition_enabled = val;
-        if (recognition_enabled)
-        {
-            detection_enabled = val;
-        }
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
     }
-#endif
-#endif
-    else if (!strcmp(variable, "ir_led"))
+    int reg = parse_get_var(query, "reg", -1);
+    int mask = parse_get_var(query, "mask", -1);
+    if (reg < 0 || mask < 0)
+    {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+
+    sensor_t *s = esp_camera_sensor_get();
+    int res = s->get_reg(s, reg, mask);
+    if (res < 0)
+    {
+        return httpd_resp_send_500(req);
+    }
+    LOGR_D("Get Register: reg: 0x%02x, mask: 0x%02x, value: 0x%02x", reg, mask, res);
+
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%d", res);
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, buffer, HTTPD_RESP_USE_STRLEN);
+}
+
+// Batched register writes: /regs?set=reg:mask:val,reg:mask:val,...
+// The writes are applied in order and stop at the first one that fails.
+static esp_err_t regs_handler(httpd_req_t *req)
+{
+    char json[96];
+    size_t query_len = httpd_req_get_url_query_len(req) + 1;
+    char *query = (char *)malloc(query_len);
+    char *list = (char *)malloc(query_len);
+    if (!query || !list)
+    {
+        free(query);
+        free(list);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    if (query_len <= 1 || httpd_req_get_url_query_str(req, query, query_len) != ESP_OK ||
+        httpd_query_key_value(query, "set", list, query_len) != ESP_OK)
+    {
+        free(query);
+        free(list);
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+    free(query);
+
+    sensor_t *s = esp_camera_sensor_get();
+    int applied = 0;
+    const char *error = NULL;
+    char *save = NULL;
+    for (char *item = strtok_r(list, ",", &save); item; item = strtok_r(NULL, ",", &save))
     {
-        if (val)
+        char *end;
+        int reg = strtol(item, &end, 0);
+        int mask = *end == ':' ? strtol(end + 1, &end, 0) : -1;
+        int val = *end == ':' ? strtol(end + 1, &end, 0) : -1;
+        if (mask < 0 || val < 0 || *end)
         {
-            digitalWrite(IR_FILTER_NUM, HIGH);
+            error = "Malformed write, expected reg:mask:val";
+            break;
         }
-        else
+        if (s->set_reg(s, reg, mask, val))
         {
-            digitalWrite(IR_FILTER_NUM, LOW);
+            error = "Register write failed";
+            break;
         }
+        applied++;
     }
-    else
+    free(list);
+    LOGR_I("Set %d registers%s", applied, error ? ", then failed" : "");
+    if (applied)
     {
-        res = -1;
+        status_cache_notify();
     }
 
-    if (res)
+    if (error)
     {
-        return httpd_resp_send_500(req);
+        snprintf(json, sizeof(json), "{\"error\":\"%s\",\"applied\":%d,\"success\":false}", error, applied);
+        httpd_resp_set_status(req, "400 Bad Request");
     }
-
+    else
+    {
+        snprintf(json, sizeof(json), "{\"applied\":%d,\"success\":true}", applied);
+    }
+    httpd_resp_set_type(req, "application/json");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    return httpd_resp_send(req, NULL, 0);
+    return httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
 }
 
-static esp_err_t status_handler(httpd_req_t *req)
+// Raw sensor window: start/end of the array region, offsets, total (HTS/VTS)
+// and output size, with optional scaling and 2x binning. The output size is
+// the new frame size, so a small window raises the frame rate.
+static esp_err_t win_handler(httpd_req_t *req)
 {
-    static char json_response[1024];
+    char query[256];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK)
+    {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+
+    int startX = parse_get_var(query, "sx", 0);
+    int startY = parse_get_var(query, "sy", 0);
+    int endX = parse_get_var(query, "ex", 0);
+    int endY = parse_get_var(query, "ey", 0);
+    // The web UI sends ofx/ofy, Espressif's example offx/offy
+    int offsetX = parse_get_var(query, "ofx", parse_get_var(query, "offx", 0));
+    int offsetY = parse_get_var(query, "ofy", parse_get_var(query, "offy", 0));
+    int totalX = parse_get_var(query, "tx", 0);
+    int totalY = parse_get_var(query, "ty", 0);
+    int outputX = parse_get_var(query, "ox", 0);
+    int outputY = parse_get_var(query, "oy", 0);
+    bool scale = parse_get_var(query, "scale", 0) == 1;
+    bool binning = parse_get_var(query, "binning", 0) == 1;
+    LOGR_I("Set Window: Start: %d %d, End: %d %d, Offset: %d %d, Total: %d %d, Output: %d %d, Scale: %u, Binning: %u",
+           startX, startY, endX, endY, offsetX, offsetY, totalX, totalY, outputX, outputY, scale, binning);
 
     sensor_t *s = esp_camera_sensor_get();
-    char *p = json_response;
-    *p++ = '{';
-
-    p += sprintf(p, "\"framesize\":%u,", s->status.framesize);
-    p += sprintf(p, "\"quality\":%u,", s->status.quality);
-    p += sprintf(p, "\"brightness\":%d,", s->status.brightness);
-    p += sprintf(p, "\"contrast\":%d,", s->status.contrast);
-    p += sprintf(p, "\"saturation\":%d,", s->status.saturation);
-    p += sprintf(p, "\"sharpness\":%d,", s->status.sharpness);
-    p += sprintf(p, "\"special_effect\":%u,", s->status.special_effect);
-    p += sprintf(p, "\"wb_mode\":%u,", s->status.wb_mode);
-    p += sprintf(p, "\"awb\":%u,", s->status.awb);
-    p += sprintf(p, "\"awb_gain\":%u,", s->status.awb_gain);
-    p += sprintf(p, "\"aec\":%u,", s->status.aec);
-    p += sprintf(p, "\"aec2\":%u,", s->status.aec2);
-    p += sprintf(p, "\"ae_level\":%d,", s->status.ae_level);
-    p += sprintf(p, "\"aec_value\":%u,", s->status.aec_value);
-    p += sprintf(p, "\"agc\":%u,", s->status.agc);
-    p += sprintf(p, "\"agc_gain\":%u,", s->status.agc_gain);
-    p += sprintf(p, "\"gainceiling\":%u,", s->status.gainceiling);
-    p += sprintf(p, "\"bpc\":%u,", s->status.bpc);
-    p += sprintf(p, "\"wpc\":%u,", s->status.wpc);
-    p += sprintf(p, "\"raw_gma\":%u,", s->status.raw_gma);
-    p += sprintf(p, "\"lenc\":%u,", s->status.lenc);
-    p += sprintf(p, "\"vflip\":%u,", s->status.vflip);
-    p += sprintf(p, "\"hmirror\":%u,", s->status.hmirror);
-    p += sprintf(p, "\"dcw\":%u,", s->status.dcw);
-    p += sprintf(p, "\"colorbar\":%u,", s->status.colorbar);
-#if CONFIG_ESP_FACE_DETECT_ENABLED
-    p += sprintf(p, "\"face_detect\":%u,", detection_enabled);
-#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-    p += sprintf(p, "\"face_enroll\":%u,", is_enrolling);
-    p += sprintf(p, "\"face_recognize\":%u,", recognition_enabled);
-#endif
-#endif
-    p += sprintf(p, "\"ir_led\":%u", digitalRead(IR_FILTER_NUM));
-    *p++ = '}';
-    *p++ = 0;
-    httpd_resp_set_type(req, "application/json");
+    if (s->set_res_raw(s, startX, startY, endX, endY, offsetX, offsetY, totalX, totalY, outputX, outputY, scale,
+                       binning))
+    {
+        return httpd_resp_send_500(req);
+    }
+    status_cache_notify();
+
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    return httpd_resp_send(req, json_response, strlen(json_response));
+    return httpd_resp_send(req, NULL, 0);
 }
 
 static esp_err_t index_handler(httpd_req_t *req)
@@ -644,7 +1648,7 @@ static esp_err_t index_handler(httpd_req_t *req)
     }
     else
     {
-        Serial.println("Camera sensor not found");
+        LOGR_E("Camera sensor not found");
         return httpd_resp_send_500(req);
     }
 }
@@ -693,21 +1697,24 @@ static esp_err_t gpio_do_handler(httpd_req_t *req)
     
     // Initialize pin if not already initialized
     if (!do_pins_initialized[pin]) {
-        pinMode(pin, OUTPUT);
-        do_pins_initialized[pin] = true;
-        
+        gpio_edge_unwatch(pin);
         // If this pin was previously used for PWM, release the channel
+        // first, detaching afterwards would undo pinMode
         if (ao_pins_initialized[pin]) {
-            ledcDetach(pin);
+            ledc_pool_release(pin);
             ao_pins_initialized[pin] = false;
         }
+        pinMode(pin, OUTPUT);
+        do_pins_initialized[pin] = true;
     }
     
     // Set pin state
     if (strcmp(state_str, "high") == 0 || strcmp(state_str, "1") == 0) {
         digitalWrite(pin, HIGH);
+        events_publish("gpio", "{\"do\":{\"%d\":1}}", pin);
     } else if (strcmp(state_str, "low") == 0 || strcmp(state_str, "0") == 0) {
         digitalWrite(pin, LOW);
+        events_publish("gpio", "{\"do\":{\"%d\":0}}", pin);
     } else {
         httpd_resp_set_type(req, "application/json");
         httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
@@ -756,8 +1763,11 @@ static esp_err_t gpio_ai_read_handler(httpd_req_t *req)
         return httpd_resp_send(req, response, strlen(response));
     }
     
-    // Read analog value
-    int value = analogRead(pin);
+    // Read analog value; pins being streamed answer from the stream
+    int value;
+    if (!adc_stream_latest(pin, &value)) {
+        value = analogRead(pin);
+    }
     
     // Send response
     httpd_resp_set_type(req, "application/json");
@@ -767,6 +1777,87 @@ static esp_err_t gpio_ai_read_handler(httpd_req_t *req)
     return httpd_resp_send(req, response, strlen(response));
 }
 
+// Handler for continuous sampling: /gpio/ai/stream?pins=1,2[&rate=20000][&avg=10]
+// Streams packed binary blocks (see adc_stream.h) until the client closes.
+// Without pins the request joins the stream that is already running.
+static esp_err_t gpio_ai_stream_handler(httpd_req_t *req)
+{
+    char query[128];
+    char pins_str[64];
+    char param[16];
+    char error[64];
+    adc_stream_config_t config = {};
+    config.rate = 20000;
+    config.avg = 10;
+    
+    bool has_query = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK;
+    bool configured = has_query && httpd_query_key_value(query, "pins", pins_str, sizeof(pins_str)) == ESP_OK;
+    if (configured) {
+        char *save = NULL;
+        for (char *token = strtok_r(pins_str, ",", &save); token; token = strtok_r(NULL, ",", &save)) {
+            int pin = atoi(token);
+            if (!is_valid_ai_pin(pin)) {
+                snprintf(error, sizeof(error), "Pin %d is not valid for analog input", pin);
+                return profile_send_error(req, "400 Bad Request", error);
+            }
+            if (config.count == ADC_STREAM_MAX_PINS || memchr(config.pins, pin, config.count)) {
+                return profile_send_error(req, "400 Bad Request", "Too many or repeated pins");
+            }
+            config.pins[config.count++] = pin;
+        }
+        if (httpd_query_key_value(query, "rate", param, sizeof(param)) == ESP_OK) {
+            config.rate = strtoul(param, NULL, 10);
+        }
+        if (httpd_query_key_value(query, "avg", param, sizeof(param)) == ESP_OK) {
+            config.avg = strtoul(param, NULL, 10);
+        }
+        if (!adc_stream_config_valid(&config, error, sizeof(error))) {
+            return profile_send_error(req, "400 Bad Request", error);
+        }
+    }
+    
+    if (!adc_stream_join(configured ? &config : NULL, error, sizeof(error))) {
+        return profile_send_error(req, "409 Conflict", error);
+    }
+    if (adc_stream_attach(req) != ESP_OK) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+        return httpd_resp_send(req, "Too many stream clients", HTTPD_RESP_USE_STRLEN);
+    }
+    return ESP_OK;
+}
+
+// PWM settings from ?freq=&bits=, defaulting to the pin's current ones or
+// 5 kHz/8-bit
+static bool gpio_pwm_settings(const char *query, int pin, uint32_t *freq, uint8_t *bits)
+{
+    char param[16];
+    *freq = ao_pins_initialized[pin] ? ledc_pool_freq(pin) : 5000;
+    *bits = ao_pins_initialized[pin] ? ledc_pool_bits(pin) : 8;
+    if (httpd_query_key_value(query, "freq", param, sizeof(param)) == ESP_OK) {
+        *freq = strtoul(param, NULL, 10);
+    }
+    if (httpd_query_key_value(query, "bits", param, sizeof(param)) == ESP_OK) {
+        *bits = constrain(atoi(param), 0, 255);
+    }
+    return ledc_pool_settings_valid(*freq, *bits);
+}
+
+// Make pin a PWM output at freq and bits, taking it away from digital
+// output and edge capture. False when no LEDC channel is free; the pin
+// then stays as it was.
+static bool gpio_prepare_pwm(int pin, uint32_t freq, uint8_t bits)
+{
+    if (ledc_pool_attach(pin, freq, bits) < 0) {
+        ao_pins_initialized[pin] = ledc_pool_channel(pin) >= 0;
+        return false;
+    }
+    do_pins_initialized[pin] = false;
+    gpio_edge_unwatch(pin);
+    ao_pins_initialized[pin] = true;
+    return true;
+}
+
 // Handler for analog output setting
 static esp_err_t gpio_ao_set_handler(httpd_req_t *req)
 {
@@ -809,41 +1900,146 @@ static esp_err_t gpio_ao_set_handler(httpd_req_t *req)
         return httpd_resp_send(req, response, strlen(response));
     }
     
-    int value = atoi(value_str);
-    if (value < 0) value = 0;
-    if (value > 255) value = 255;
+    uint32_t freq;
+    uint8_t bits;
+    if (!gpio_pwm_settings(query, pin, &freq, &bits)) {
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+        char response[128];
+        sprintf(response, "{\"error\":\"Invalid freq or bits\",\"success\":false}");
+        return httpd_resp_send(req, response, strlen(response));
+    }
     
-    // Initialize pin for PWM if not already initialized
-    if (!ao_pins_initialized[pin]) {
-        // If this pin was previously used for digital output, we need to reconfigure
-        if (do_pins_initialized[pin]) {
-            do_pins_initialized[pin] = false;
-        }
-        
-        // Assign a PWM channel to this pin
-        int channel = next_pwm_channel++;
-        if (next_pwm_channel >= 16) next_pwm_channel = 0; // ESP32 has 16 PWM channels
-        
-        // Updated to use the correct parameters for ledcAttach
-        uint32_t freq = 5000; // 5kHz
-        uint8_t resolution = 8; // 8-bit resolution
-        ledcAttach(pin, freq, resolution);
-        ao_pin_channels[pin] = channel;
-        ao_pins_initialized[pin] = true;
+    // Initialize pin for PWM, or retune it
+    if (!gpio_prepare_pwm(pin, freq, bits)) {
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+        char response[128];
+        sprintf(response, "{\"error\":\"No PWM channel free for %u Hz at %u bits\",\"success\":false}",
+                (unsigned)freq, bits);
+        return httpd_resp_send(req, response, strlen(response));
     }
     
+    int value = constrain(atoi(value_str), 0, (1 << bits) - 1);
+    
     // Set PWM value
-    ledcWrite(ao_pin_channels[pin], value);
+    ledcWrite(pin, value);
+    events_publish("gpio", "{\"ao\":{\"%d\":%d}}", pin, value);
     
     // Send response
     httpd_resp_set_type(req, "application/json");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    char response[64];
-    sprintf(response, "{\"pin\":%d,\"value\":%d,\"success\":true}", pin, value);
+    char response[128];
+    sprintf(response, "{\"pin\":%d,\"value\":%d,\"freq\":%u,\"bits\":%u,\"channel\":%d,\"success\":true}", pin, value,
+            (unsigned)freq, bits, ledc_pool_channel(pin));
+    return httpd_resp_send(req, response, strlen(response));
+}
+
+// Handler for PWM ramps: /gpio/ao/fade?pin=16&to=255&ms=1000[&freq=&bits=]
+// The LEDC steps the duty in hardware, starting from the current one (0 for
+// a pin that was not PWM yet), and the request returns right away.
+static esp_err_t gpio_ao_fade_handler(httpd_req_t *req)
+{
+    char query[256];
+    char pin_str[32];
+    char to_str[32];
+    char ms_str[32];
+    char response[160];
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "pin", pin_str, sizeof(pin_str)) != ESP_OK ||
+        httpd_query_key_value(query, "to", to_str, sizeof(to_str)) != ESP_OK ||
+        httpd_query_key_value(query, "ms", ms_str, sizeof(ms_str)) != ESP_OK) {
+        sprintf(response, "{\"error\":\"Missing pin, to or ms parameter\",\"success\":false}");
+        return httpd_resp_send(req, response, strlen(response));
+    }
+    
+    int pin = atoi(pin_str);
+    if (!is_valid_ao_pin(pin)) {
+        sprintf(response, "{\"error\":\"Pin %d is not valid for analog output\",\"success\":false}", pin);
+        return httpd_resp_send(req, response, strlen(response));
+    }
+    
+    int ms = atoi(ms_str);
+    if (ms < 1 || ms > 60000) {
+        sprintf(response, "{\"error\":\"ms must be 1-60000\",\"success\":false}");
+        return httpd_resp_send(req, response, strlen(response));
+    }
+    
+    uint32_t freq;
+    uint8_t bits;
+    if (!gpio_pwm_settings(query, pin, &freq, &bits)) {
+        sprintf(response, "{\"error\":\"Invalid freq or bits\",\"success\":false}");
+        return httpd_resp_send(req, response, strlen(response));
+    }
+    
+    // Retuning restarts the duty at 0
+    bool retuned = !ao_pins_initialized[pin] || ledc_pool_freq(pin) != freq || ledc_pool_bits(pin) != bits;
+    uint32_t from = retuned ? 0 : ledcRead(pin);
+    if (!gpio_prepare_pwm(pin, freq, bits)) {
+        sprintf(response, "{\"error\":\"No PWM channel free for %u Hz at %u bits\",\"success\":false}",
+                (unsigned)freq, bits);
+        return httpd_resp_send(req, response, strlen(response));
+    }
+    
+    int to = constrain(atoi(to_str), 0, (1 << bits) - 1);
+    if (!ledcFade(pin, from, to, ms)) {
+        sprintf(response, "{\"error\":\"Fade failed\",\"success\":false}");
+        return httpd_resp_send(req, response, strlen(response));
+    }
+    events_publish("gpio", "{\"ao\":{\"%d\":%d}}", pin, to);
+    
+    sprintf(response, "{\"pin\":%d,\"from\":%u,\"to\":%d,\"ms\":%d,\"success\":true}", pin, (unsigned)from, to, ms);
     return httpd_resp_send(req, response, strlen(response));
 }
 
-// Handler for setting multiple digital outputs at once
+// Make pin a plain digital output, taking it away from PWM if needed
+static void gpio_prepare_output(int pin)
+{
+    if (!do_pins_initialized[pin]) {
+        gpio_edge_unwatch(pin);
+        // Release a PWM channel first, detaching afterwards would undo pinMode
+        if (ao_pins_initialized[pin]) {
+            ledc_pool_release(pin);
+            ao_pins_initialized[pin] = false;
+        }
+        pinMode(pin, OUTPUT);
+        do_pins_initialized[pin] = true;
+    }
+}
+
+// Latch the levels first, so pins that only now become outputs start at
+// the requested level, then switch every pin at once
+static void gpio_write_outputs(uint64_t mask, uint64_t value)
+{
+    gpio_bulk_write(mask, value);
+    for (int pin = 0; pin < 64; pin++) {
+        if (mask & (1ULL << pin)) {
+            gpio_prepare_output(pin);
+        }
+    }
+    gpio_bulk_write(mask, value);
+
+    // One /events delta for the whole write
+    char delta[EVENT_DATA_MAX] = "{\"do\":{";
+    size_t len = strlen(delta);
+    for (int pin = 0; pin < 64 && len < sizeof(delta); pin++) {
+        if (mask & (1ULL << pin)) {
+            len += snprintf(delta + len, sizeof(delta) - len, "%s\"%d\":%d", delta[len - 1] == '{' ? "" : ",", pin,
+                            (int)((value >> pin) & 1));
+        }
+    }
+    if (len < sizeof(delta)) {
+        events_publish("gpio", "%s}}", delta);
+    }
+}
+
+// Handler for setting multiple digital outputs at once, either as
+// ?pins=4,5&states=high,low or as ?mask=&value= bitmasks (bit n is GPIO n,
+// decimal or 0x hex). Either way all pins switch together.
 static esp_err_t gpio_do_all_handler(httpd_req_t *req)
 {
     char query[256];
@@ -856,6 +2052,38 @@ static esp_err_t gpio_do_all_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
     
+    // Bitmask form
+    if (httpd_query_key_value(query, "mask", pins_str, sizeof(pins_str)) == ESP_OK) {
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+        char response[160];
+        char *end;
+        uint64_t mask = strtoull(pins_str, &end, 0);
+        bool valid = *pins_str && !*end;
+        uint64_t value = 0;
+        if (httpd_query_key_value(query, "value", states_str, sizeof(states_str)) == ESP_OK) {
+            value = strtoull(states_str, &end, 0);
+            valid = valid && *states_str && !*end;
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            sprintf(response, "{\"error\":\"mask and value must be numbers\",\"success\":false}");
+            return httpd_resp_send(req, response, strlen(response));
+        }
+        uint64_t unsafe = mask & ~gpio_pin_mask(safe_do_pins, num_safe_do_pins);
+        if (unsafe) {
+            sprintf(response, "{\"error\":\"Pins not safe to use\",\"unsafe\":\"0x%llx\",\"success\":false}",
+                    (unsigned long long)unsafe);
+            return httpd_resp_send(req, response, strlen(response));
+        }
+        
+        gpio_write_outputs(mask, value);
+        sprintf(response, "{\"mask\":\"0x%llx\",\"value\":\"0x%llx\",\"success\":true}", (unsigned long long)mask,
+                (unsigned long long)(value & mask));
+        return httpd_resp_send(req, response, strlen(response));
+    }
+    
     // Extract pins
     if (httpd_query_key_value(query, "pins", pins_str, sizeof(pins_str)) != ESP_OK) {
         httpd_resp_set_type(req, "application/json");
@@ -874,66 +2102,170 @@ static esp_err_t gpio_do_all_handler(httpd_req_t *req)
         return httpd_resp_send(req, response, strlen(response));
     }
     
-    // Parse pins and states
-    char *pin_token = strtok(pins_str, ",");
-    char *state_token = strtok(states_str, ",");
+    // Parse pins and states into one mask; the two lists need their own
+    // tokenizer state
+    char *pin_save = NULL;
+    char *state_save = NULL;
+    char *pin_token = strtok_r(pins_str, ",", &pin_save);
+    char *state_token = strtok_r(states_str, ",", &state_save);
     
     char response[512] = "{\"results\":[";
     bool first = true;
+    uint64_t mask = 0;
+    uint64_t value = 0;
     
     while (pin_token != NULL && state_token != NULL) {
         int pin = atoi(pin_token);
+        char result[128];
         
         // Check if pin is safe to use
         if (!is_pin_safe(pin)) {
-            if (!first) strcat(response, ",");
-            char result[128];
             sprintf(result, "{\"pin\":%d,\"error\":\"Pin not safe to use\",\"success\":false}", pin);
-            strcat(response, result);
+        } else if (strcmp(state_token, "high") == 0 || strcmp(state_token, "1") == 0) {
+            mask |= 1ULL << pin;
+            value |= 1ULL << pin;
+            sprintf(result, "{\"pin\":%d,\"state\":\"high\",\"success\":true}", pin);
+        } else if (strcmp(state_token, "low") == 0 || strcmp(state_token, "0") == 0) {
+            mask |= 1ULL << pin;
+            value &= ~(1ULL << pin);
+            sprintf(result, "{\"pin\":%d,\"state\":\"low\",\"success\":true}", pin);
         } else {
-            // Initialize pin if not already initialized
-            if (!do_pins_initialized[pin]) {
-                pinMode(pin, OUTPUT);
-                do_pins_initialized[pin] = true;
-                
-                // If this pin was previously used for PWM, release the channel
-                if (ao_pins_initialized[pin]) {
-                    ledcDetach(pin);
-                    ao_pins_initialized[pin] = false;
-                }
-            }
-            
-            // Set pin state
-            if (strcmp(state_token, "high") == 0 || strcmp(state_token, "1") == 0) {
-                digitalWrite(pin, HIGH);
-                if (!first) strcat(response, ",");
-                char result[64];
-                sprintf(result, "{\"pin\":%d,\"state\":\"high\",\"success\":true}", pin);
-                strcat(response, result);
-            } else if (strcmp(state_token, "low") == 0 || strcmp(state_token, "0") == 0) {
-                digitalWrite(pin, LOW);
-                if (!first) strcat(response, ",");
-                char result[64];
-                sprintf(result, "{\"pin\":%d,\"state\":\"low\",\"success\":true}", pin);
-                strcat(response, result);
-            } else {
-                if (!first) strcat(response, ",");
-                char result[128];
-                sprintf(result, "{\"pin\":%d,\"error\":\"Invalid state\",\"success\":false}", pin);
-                strcat(response, result);
-            }
+            sprintf(result, "{\"pin\":%d,\"error\":\"Invalid state\",\"success\":false}", pin);
+        }
+        if (!first) strcat(response, ",");
+        if (strlen(response) + strlen(result) + 3 < sizeof(response)) {
+            strcat(response, result);
         }
         
         first = false;
-        pin_token = strtok(NULL, ",");
-        state_token = strtok(NULL, ",");
+        pin_token = strtok_r(NULL, ",", &pin_save);
+        state_token = strtok_r(NULL, ",", &state_save);
+    }
+    
+    strcat(response, "]}");
+    if (mask) {
+        gpio_write_outputs(mask, value);
+    }
+    
+    // Send response
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, response, strlen(response));
+}
+
+// Handler for reading every safe pin at once. All levels come from a single
+// read of the input registers, so they are sampled at the same instant.
+static esp_err_t gpio_di_handler(httpd_req_t *req)
+{
+    int64_t now = esp_timer_get_time();
+    uint64_t levels = gpio_input_levels() & gpio_pin_mask(safe_do_pins, num_safe_do_pins);
+    
+    char response[512];
+    char *p = response;
+    p += sprintf(p, "{\"levels\":\"0x%llx\",\"pins\":{", (unsigned long long)levels);
+    for (int i = 0; i < num_safe_do_pins; i++) {
+        p += sprintf(p, "%s\"%d\":%d", i ? "," : "", safe_do_pins[i], (int)((levels >> safe_do_pins[i]) & 1));
+    }
+    sprintf(p, "},\"us\":%lld,\"success\":true}", (long long)now);
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, response, strlen(response));
+}
+
+// Handler for edge capture: /gpio/di/watch?pins=4,5&edge=rising|falling|change|none[&pull=up|down]
+// Watched pins become inputs and their edges are drained from /gpio/di/events.
+// Pins in use as outputs are refused; making a watched pin an output later
+// stops watching it.
+static esp_err_t gpio_di_watch_handler(httpd_req_t *req)
+{
+    char query[256];
+    char pins_str[128];
+    char edge_str[16];
+    char pull_str[16];
+    char response[512];
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "pins", pins_str, sizeof(pins_str)) != ESP_OK ||
+        httpd_query_key_value(query, "edge", edge_str, sizeof(edge_str)) != ESP_OK) {
+        sprintf(response, "{\"error\":\"Missing pins or edge parameter\",\"success\":false}");
+        return httpd_resp_send(req, response, strlen(response));
+    }
+    
+    int mode;
+    if (strcmp(edge_str, "rising") == 0) {
+        mode = RISING;
+    } else if (strcmp(edge_str, "falling") == 0) {
+        mode = FALLING;
+    } else if (strcmp(edge_str, "change") == 0) {
+        mode = CHANGE;
+    } else if (strcmp(edge_str, "none") == 0) {
+        mode = 0;
+    } else {
+        sprintf(response, "{\"error\":\"edge must be rising, falling, change or none\",\"success\":false}");
+        return httpd_resp_send(req, response, strlen(response));
+    }
+    
+    int input_mode = INPUT;
+    if (httpd_query_key_value(query, "pull", pull_str, sizeof(pull_str)) == ESP_OK) {
+        if (strcmp(pull_str, "up") == 0) {
+            input_mode = INPUT_PULLUP;
+        } else if (strcmp(pull_str, "down") == 0) {
+            input_mode = INPUT_PULLDOWN;
+        } else if (strcmp(pull_str, "none") != 0) {
+            sprintf(response, "{\"error\":\"pull must be up, down or none\",\"success\":false}");
+            return httpd_resp_send(req, response, strlen(response));
+        }
+    }
+    
+    // Validate the whole list before touching any pin
+    uint64_t mask = 0;
+    char *save = NULL;
+    for (char *token = strtok_r(pins_str, ",", &save); token; token = strtok_r(NULL, ",", &save)) {
+        int pin = atoi(token);
+        if (!is_pin_safe(pin)) {
+            sprintf(response, "{\"error\":\"Pin %d is not safe to use\",\"success\":false}", pin);
+            return httpd_resp_send(req, response, strlen(response));
+        }
+        if (mode && (do_pins_initialized[pin] || ao_pins_initialized[pin])) {
+            sprintf(response, "{\"error\":\"Pin %d is in use as an output\",\"success\":false}", pin);
+            return httpd_resp_send(req, response, strlen(response));
+        }
+        mask |= 1ULL << pin;
+    }
+    if (!mask) {
+        sprintf(response, "{\"error\":\"No pins given\",\"success\":false}");
+        return httpd_resp_send(req, response, strlen(response));
     }
     
-    strcat(response, "]}");
+    for (int pin = 0; pin < 64; pin++) {
+        if (!(mask & (1ULL << pin))) {
+            continue;
+        }
+        gpio_edge_unwatch(pin);
+        if (mode) {
+            pinMode(pin, input_mode);
+            gpio_edge_watch(pin, mode);
+        }
+    }
     
-    // Send response
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    // Report every watched pin, not just this request's
+    char *p = response;
+    p += sprintf(p, "{\"watching\":{");
+    bool first = true;
+    for (int i = 0; i < num_safe_do_pins; i++) {
+        int pin = safe_do_pins[i];
+        int watched = gpio_edge_modes[pin];
+        if (watched) {
+            p += sprintf(p, "%s\"%d\":\"%s\"", first ? "" : ",", pin,
+                         watched == RISING ? "rising" : watched == FALLING ? "falling" : "change");
+            first = false;
+        }
+    }
+    sprintf(p, "},\"next\":%u,\"success\":true}", (unsigned)__atomic_load_n(&gpio_edge_head, __ATOMIC_ACQUIRE));
     return httpd_resp_send(req, response, strlen(response));
 }
 
@@ -992,17 +2324,37 @@ static esp_err_t bmp_handler(httpd_req_t *req)
     return httpd_resp_send(req, msg, strlen(msg));
 }
 
+// Link state changes from the sketch's WiFiEvent, pushed to /events
+void publishNetworkEvent(const char *link)
+{
+    events_publish("network", "{\"link\":\"%s\",\"ip\":\"%s\"}", link, ETH.localIP().toString().c_str());
+}
+
 // Implementation of startCameraServer function
 void startCameraServer()
 {
+    // Start draining the log ring to Serial
+    log_ring_init();
+
     // Initialize network configuration
     initNetworkConfig();
+
+    // Apply the boot profile before the first frame is served
+    camera_profiles_init();
+    status_cache_init(status_fingerprint, status_render);
     
     // Initialize NeoPixel
     initNeoPixel();
+
+    // Start the shared capture task that feeds every /stream client
+    frame_fanout_init();
+
+    // Start the workers that serve detached long-lived requests
+    async_workers_init();
+    adc_stream_init();
     
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    config.max_uri_handlers = 25;
+    config.max_uri_handlers = 40;
 
     // Define URI handlers
     httpd_uri_t index_uri_def = {
@@ -1018,10 +2370,62 @@ void startCameraServer()
 #endif
     };
 
+    httpd_uri_t reg_uri_def = {
+        .uri = "/reg",
+        .method = HTTP_GET,
+        .handler = reg_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
+    httpd_uri_t greg_uri_def = {
+        .uri = "/greg",
+        .method = HTTP_GET,
+        .handler = greg_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
+    httpd_uri_t regs_uri_def = {
+        .uri = "/regs",
+        .method = HTTP_GET,
+        .handler = regs_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
+    httpd_uri_t win_uri_def = {
+        .uri = "/resolution",
+        .method = HTTP_GET,
+        .handler = win_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
     httpd_uri_t status_uri_def = {
         .uri = "/status",
         .method = HTTP_GET,
-        .handler = status_handler,
+        .handler = status_cache_handler,
         .user_ctx = NULL
 #ifdef CONFIG_HTTPD_WS_SUPPORT
         ,
@@ -1044,6 +2448,84 @@ void startCameraServer()
 #endif
     };
 
+    httpd_uri_t cmd_post_uri_def = {
+        .uri = "/control",
+        .method = HTTP_POST,
+        .handler = cmd_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
+    httpd_uri_t profile_list_uri_def = {
+        .uri = "/profile/list",
+        .method = HTTP_GET,
+        .handler = profile_list_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
+    httpd_uri_t profile_save_uri_def = {
+        .uri = "/profile/save",
+        .method = HTTP_GET,
+        .handler = profile_save_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
+    httpd_uri_t profile_apply_uri_def = {
+        .uri = "/profile/apply",
+        .method = HTTP_GET,
+        .handler = profile_apply_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
+    httpd_uri_t profile_delete_uri_def = {
+        .uri = "/profile/delete",
+        .method = HTTP_GET,
+        .handler = profile_delete_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
+    httpd_uri_t events_uri_def = {
+        .uri = "/events",
+        .method = HTTP_GET,
+        .handler = events_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
     httpd_uri_t capture_uri_def = {
         .uri = "/capture",
         .method = HTTP_GET,
@@ -1057,6 +2539,19 @@ void startCameraServer()
 #endif
     };
 
+    httpd_uri_t capture_burst_uri_def = {
+        .uri = "/capture/burst",
+        .method = HTTP_GET,
+        .handler = capture_burst_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
     httpd_uri_t stream_uri_def = {
         .uri = "/stream",
         .method = HTTP_GET,
@@ -1070,6 +2565,97 @@ void startCameraServer()
 #endif
     };
 
+    httpd_uri_t clock_uri_def = {
+        .uri = "/clock",
+        .method = HTTP_GET,
+        .handler = clock_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
+    httpd_uri_t stream_redirect_uri_def = {
+        .uri = "/stream",
+        .method = HTTP_GET,
+        .handler = stream_redirect_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
+    httpd_uri_t rate_control_get_uri_def = {
+        .uri = "/ratecontrol/get",
+        .method = HTTP_GET,
+        .handler = rate_control_get_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
+    httpd_uri_t rate_control_set_uri_def = {
+        .uri = "/ratecontrol/set",
+        .method = HTTP_GET,
+        .handler = rate_control_set_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
+    httpd_uri_t metrics_uri_def = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
+    httpd_uri_t latency_debug_uri_def = {
+        .uri = "/debug/latency",
+        .method = HTTP_GET,
+        .handler = latency_debug_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
+    httpd_uri_t log_uri_def = {
+        .uri = "/log",
+        .method = HTTP_GET,
+        .handler = log_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
     httpd_uri_t bmp_uri_def = {
         .uri = "/bmp",
         .method = HTTP_GET,
@@ -1110,6 +2696,19 @@ void startCameraServer()
 #endif
     };
 
+    httpd_uri_t gpio_ai_stream_uri_def = {
+        .uri = "/gpio/ai/stream",
+        .method = HTTP_GET,
+        .handler = gpio_ai_stream_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
     httpd_uri_t gpio_ao_set_uri_def = {
         .uri = "/gpio/ao/set",
         .method = HTTP_GET,
@@ -1123,6 +2722,19 @@ void startCameraServer()
 #endif
     };
 
+    httpd_uri_t gpio_ao_fade_uri_def = {
+        .uri = "/gpio/ao/fade",
+        .method = HTTP_GET,
+        .handler = gpio_ao_fade_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
     httpd_uri_t gpio_do_all_uri_def = {
         .uri = "/gpio/do/all",
         .method = HTTP_GET,
@@ -1136,6 +2748,45 @@ void startCameraServer()
 #endif
     };
 
+    httpd_uri_t gpio_di_uri_def = {
+        .uri = "/gpio/di",
+        .method = HTTP_GET,
+        .handler = gpio_di_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
+    httpd_uri_t gpio_di_watch_uri_def = {
+        .uri = "/gpio/di/watch",
+        .method = HTTP_GET,
+        .handler = gpio_di_watch_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
+    httpd_uri_t gpio_di_events_uri_def = {
+        .uri = "/gpio/di/events",
+        .method = HTTP_GET,
+        .handler = gpio_edge_events_handler,
+        .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        ,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+#endif
+    };
+
     httpd_uri_t gpio_overview_uri_def = {
         .uri = "/gpio/overview",
         .method = HTTP_GET,
@@ -1216,34 +2867,74 @@ void startCameraServer()
 #endif
     };
 
-    Serial.printf("Starting web server on port: '%d'\n", config.server_port);
+    // Every handler below is registered through metrics_register_uri_handler
+    // so /metrics can count requests per endpoint
+    LOGR_I("Starting web server on port: '%d'", config.server_port);
     if (httpd_start(&camera_httpd, &config) == ESP_OK)
     {
-        httpd_register_uri_handler(camera_httpd, &index_uri_def);
-        httpd_register_uri_handler(camera_httpd, &cmd_uri_def);
-        httpd_register_uri_handler(camera_httpd, &status_uri_def);
-        httpd_register_uri_handler(camera_httpd, &capture_uri_def);
-        httpd_register_uri_handler(camera_httpd, &bmp_uri_def);
+        metrics_register_uri_handler(camera_httpd, &index_uri_def);
+        metrics_register_uri_handler(camera_httpd, &cmd_uri_def);
+        metrics_register_uri_handler(camera_httpd, &cmd_post_uri_def);
+        metrics_register_uri_handler(camera_httpd, &status_uri_def);
+        metrics_register_uri_handler(camera_httpd, &events_uri_def);
+        metrics_register_uri_handler(camera_httpd, &reg_uri_def);
+        metrics_register_uri_handler(camera_httpd, &greg_uri_def);
+        metrics_register_uri_handler(camera_httpd, &regs_uri_def);
+        metrics_register_uri_handler(camera_httpd, &win_uri_def);
+        metrics_register_uri_handler(camera_httpd, &profile_list_uri_def);
+        metrics_register_uri_handler(camera_httpd, &profile_save_uri_def);
+        metrics_register_uri_handler(camera_httpd, &profile_apply_uri_def);
+        metrics_register_uri_handler(camera_httpd, &profile_delete_uri_def);
+        metrics_register_uri_handler(camera_httpd, &capture_uri_def);
+        metrics_register_uri_handler(camera_httpd, &capture_burst_uri_def);
+        metrics_register_uri_handler(camera_httpd, &bmp_uri_def);
+        metrics_register_uri_handler(camera_httpd, &rate_control_get_uri_def);
+        metrics_register_uri_handler(camera_httpd, &rate_control_set_uri_def);
+        metrics_register_uri_handler(camera_httpd, &metrics_uri_def);
+        metrics_register_uri_handler(camera_httpd, &latency_debug_uri_def);
+        metrics_register_uri_handler(camera_httpd, &log_uri_def);
         
         // Register GPIO control endpoints
-        httpd_register_uri_handler(camera_httpd, &gpio_do_uri_def);
-        httpd_register_uri_handler(camera_httpd, &gpio_ai_read_uri_def);
-        httpd_register_uri_handler(camera_httpd, &gpio_ao_set_uri_def);
-        httpd_register_uri_handler(camera_httpd, &gpio_do_all_uri_def);
-        httpd_register_uri_handler(camera_httpd, &gpio_overview_uri_def);
+        metrics_register_uri_handler(camera_httpd, &gpio_do_uri_def);
+        metrics_register_uri_handler(camera_httpd, &gpio_ai_read_uri_def);
+        metrics_register_uri_handler(camera_httpd, &gpio_ai_stream_uri_def);
+        metrics_register_uri_handler(camera_httpd, &gpio_ao_set_uri_def);
+        metrics_register_uri_handler(camera_httpd, &gpio_ao_fade_uri_def);
+        metrics_register_uri_handler(camera_httpd, &gpio_do_all_uri_def);
+        metrics_register_uri_handler(camera_httpd, &gpio_di_uri_def);
+        metrics_register_uri_handler(camera_httpd, &gpio_di_watch_uri_def);
+        metrics_register_uri_handler(camera_httpd, &gpio_di_events_uri_def);
+        metrics_register_uri_handler(camera_httpd, &gpio_overview_uri_def);
         
         // Register network configuration endpoints
-        httpd_register_uri_handler(camera_httpd, &network_config_get_uri_def);
-        httpd_register_uri_handler(camera_httpd, &network_config_set_uri_def);
-        httpd_register_uri_handler(camera_httpd, &restart_uri_def);
+        metrics_register_uri_handler(camera_httpd, &network_config_get_uri_def);
+        metrics_register_uri_handler(camera_httpd, &network_config_set_uri_def);
+        metrics_register_uri_handler(camera_httpd, &restart_uri_def);
         
         // Register NeoPixel control endpoints
-        httpd_register_uri_handler(camera_httpd, &neopixel_set_uri_def);
-        httpd_register_uri_handler(camera_httpd, &neopixel_off_uri_def);
+        metrics_register_uri_handler(camera_httpd, &neopixel_set_uri_def);
+        metrics_register_uri_handler(camera_httpd, &neopixel_off_uri_def);
         
-        // Register stream endpoint with the main server
-        httpd_register_uri_handler(camera_httpd, &stream_uri_def);
+        // Old /stream links on the control port are sent to the stream server
+        metrics_register_uri_handler(camera_httpd, &stream_redirect_uri_def);
+    }
+
+    // Streaming gets its own server instance, port, task priority and core
+    httpd_config_t stream_config = HTTPD_DEFAULT_CONFIG();
+    stream_config.server_port = networkConfig.stream_port;
+    stream_config.ctrl_port = config.ctrl_port + 1;
+    stream_config.task_priority = STREAM_HTTPD_PRIORITY;
+    stream_config.core_id = STREAM_HTTPD_CORE;
+    // One socket per viewer the workers take, plus one for /clock
+    stream_config.max_open_sockets = ASYNC_STREAM_SESSIONS + 1;
+
+    LOGR_I("Starting stream server on port: '%d'", stream_config.server_port);
+    if (httpd_start(&stream_httpd, &stream_config) == ESP_OK)
+    {
+        metrics_register_uri_handler(stream_httpd, &stream_uri_def);
+        // Served next to /stream so its round trip matches the video path
+        metrics_register_uri_handler(stream_httpd, &clock_uri_def);
     }
 
-    Serial.println("Camera Server Started");
+    LOGR_I("Camera Server Started");
 }
@@ -0,0 +1,306 @@
+#pragma once
+
+#include "esp_http_server.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "lwip/sockets.h"
+#include "log_ring.h"
+#include <sys/uio.h>
+
+// Async request workers for long-lived handlers.
+// A handler detaches its request with httpd_req_async_handler_begin() and
+// hands it to a small pool of worker tasks. Each worker multiplexes several
+// client sockets, so the httpd task is free again as soon as the handler
+// returns and no FreeRTOS task is created per client.
+// Sessions come in classes with their own budgets. Stream viewers hold a
+// socket of the stream server, whose 7 sockets leave room for 6 of them
+// plus /clock. Everything else holds a socket of the control server and
+// shares a smaller budget, so plain requests still get through there and
+// long-polls never take a viewer's place. Within that budget /events
+// clients, which stay connected indefinitely, and /status?wait= long-polls
+// have caps of their own.
+// The pool has a slot for every session the budgets allow.
+// A client that goes away is noticed on the next service pass, so its
+// socket and slot are free again within a worker tick.
+
+#define ASYNC_WORKERS 2
+#define ASYNC_STREAM_SESSIONS 6
+#define ASYNC_CONTROL_SESSIONS 4
+#define ASYNC_EVENT_SESSIONS 2
+#define ASYNC_WAIT_SESSIONS 2
+#define ASYNC_SESSIONS_PER_WORKER ((ASYNC_STREAM_SESSIONS + ASYNC_CONTROL_SESSIONS + ASYNC_WORKERS - 1) / ASYNC_WORKERS)
+#define ASYNC_WORKER_STACK 4096
+#define ASYNC_WORKER_PRIORITY (tskIDLE_PRIORITY + 4)
+#define ASYNC_WORKER_CORE 1
+#define ASYNC_WORKER_TICK pdMS_TO_TICKS(100)
+#define ASYNC_WRITABLE_WAIT_MS 10
+
+typedef struct async_session async_session_t;
+
+typedef enum {
+  ASYNC_CLASS_STREAM,      // /stream viewers on the stream server
+  ASYNC_CLASS_CONTROL,     // Long-lived responses of the control server
+  ASYNC_CLASS_EVENTS,      // /events clients, also on the control server
+  ASYNC_CLASS_WAIT,        // Parked /status?wait= requests, likewise
+  ASYNC_CLASSES
+} async_class_t;
+
+static const int async_class_limit[ASYNC_CLASSES] = {
+  ASYNC_STREAM_SESSIONS,
+  ASYNC_CONTROL_SESSIONS,
+  ASYNC_EVENT_SESSIONS,
+  ASYNC_WAIT_SESSIONS,
+};
+
+// Session callbacks, all run on the owning worker task.
+// open/service return ESP_OK to keep the session, anything else ends it;
+// ASYNC_SESSION_DONE ends a session whose response is complete.
+#define ASYNC_SESSION_DONE ((esp_err_t)1)
+
+typedef struct {
+  esp_err_t (*open)(async_session_t *session);
+  esp_err_t (*service)(async_session_t *session);
+  void (*close)(async_session_t *session);
+} async_session_ops_t;
+
+struct async_session {
+  httpd_req_t *req;          // Detached copy of the request
+  int fd;                    // Client socket for raw writes
+  bool close_on_finish;      // Response has no length, close the connection
+  bool want_write;           // Output is backed up, wake when writable
+  TaskHandle_t worker;       // Task to notify when the session has work
+  const async_session_ops_t *ops;
+  void *ctx;
+  async_class_t cls;
+  bool active;
+};
+
+typedef struct {
+  TaskHandle_t task;
+  QueueHandle_t incoming;
+  async_session_t sessions[ASYNC_SESSIONS_PER_WORKER];
+  int load;                  // Active plus queued sessions
+} async_worker_t;
+
+static async_worker_t async_workers[ASYNC_WORKERS];
+static int async_class_active[ASYNC_CLASSES];
+static portMUX_TYPE async_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Write all of iov straight to the client socket in one scatter-gather
+// call, without chunked encoding. iov is consumed in place.
+esp_err_t async_session_send(async_session_t *session, struct iovec *iov, int iovcnt) {
+  while (iovcnt > 0) {
+    ssize_t sent = lwip_writev(session->fd, iov, iovcnt);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return ESP_FAIL;
+    }
+    while (iovcnt > 0 && (size_t)sent >= iov->iov_len) {
+      sent -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + sent;
+      iov->iov_len -= sent;
+    }
+  }
+  return ESP_OK;
+}
+
+// Non-blocking variant of async_session_send. Returns the number of bytes
+// the socket accepted (0 when its send buffer is full) or -1 on error.
+ssize_t async_session_try_send(async_session_t *session, const struct iovec *iov, int iovcnt) {
+  struct msghdr msg = {};
+  msg.msg_iov = (struct iovec *)iov;
+  msg.msg_iovlen = iovcnt;
+  ssize_t sent = lwip_sendmsg(session->fd, &msg, MSG_DONTWAIT);
+  if (sent < 0) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+  }
+  return sent;
+}
+
+// True once the client closed its end or the connection broke. Stream
+// clients send nothing after the request, so any readable state other
+// than pending data means the peer is gone.
+static bool async_session_peer_closed(async_session_t *session) {
+  char c;
+  ssize_t n = lwip_recv(session->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (n < 0) {
+    return errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+  }
+  return n == 0;
+}
+
+// Sleep until a notification arrives or, while some session has output
+// backed up, until one of those sockets can take more data
+static void async_worker_wait(async_worker_t *worker) {
+  fd_set writable;
+  int max_fd = -1;
+
+  FD_ZERO(&writable);
+  for (int i = 0; i < ASYNC_SESSIONS_PER_WORKER; i++) {
+    async_session_t *session = &worker->sessions[i];
+    if (session->active && session->want_write) {
+      FD_SET(session->fd, &writable);
+      if (session->fd > max_fd) {
+        max_fd = session->fd;
+      }
+    }
+  }
+
+  if (max_fd < 0) {
+    ulTaskNotifyTake(pdTRUE, ASYNC_WORKER_TICK);
+    return;
+  }
+
+  struct timeval timeout = {0, ASYNC_WRITABLE_WAIT_MS * 1000};
+  lwip_select(max_fd + 1, NULL, &writable, NULL, &timeout);
+  // Every session is serviced next anyway, drop pending notifications
+  ulTaskNotifyTake(pdTRUE, 0);
+}
+
+// End a session and hand the socket back to the server
+static void async_session_finish(async_worker_t *worker, async_session_t *session) {
+  httpd_handle_t handle = session->req->handle;
+  int fd = session->fd;
+
+  if (session->ops->close) {
+    session->ops->close(session);
+  }
+  httpd_req_async_handler_complete(session->req);
+  if (session->close_on_finish) {
+    httpd_sess_trigger_close(handle, fd);
+  }
+  session->req = NULL;
+  session->ctx = NULL;
+  session->want_write = false;
+  session->active = false;
+
+  portENTER_CRITICAL(&async_mux);
+  worker->load--;
+  async_class_active[session->cls]--;
+  portEXIT_CRITICAL(&async_mux);
+}
+
+static void async_worker_task(void *arg) {
+  async_worker_t *worker = (async_worker_t *)arg;
+  async_session_t pending;
+
+  while (true) {
+    // Woken by new frames, queued sessions, writable sockets or the tick
+    async_worker_wait(worker);
+
+    while (xQueueReceive(worker->incoming, &pending, 0) == pdTRUE) {
+      for (int i = 0; i < ASYNC_SESSIONS_PER_WORKER; i++) {
+        async_session_t *session = &worker->sessions[i];
+        if (!session->active) {
+          *session = pending;
+          session->fd = httpd_req_to_sockfd(session->req);
+          session->worker = worker->task;
+          session->active = true;
+          if (session->ops->open && session->ops->open(session) != ESP_OK) {
+            async_session_finish(worker, session);
+          }
+          break;
+        }
+      }
+    }
+
+    for (int i = 0; i < ASYNC_SESSIONS_PER_WORKER; i++) {
+      async_session_t *session = &worker->sessions[i];
+      if (session->active && (async_session_peer_closed(session) || session->ops->service(session) != ESP_OK)) {
+        async_session_finish(worker, session);
+      }
+    }
+  }
+}
+
+// Detach req and queue it on the least loaded worker. Fails when the
+// budget of cls is used up; the request is then untouched and the caller
+// still owns the response.
+esp_err_t async_session_start(httpd_req_t *req, async_class_t cls, const async_session_ops_t *ops, void *ctx) {
+  async_worker_t *worker = NULL;
+
+  portENTER_CRITICAL(&async_mux);
+  // Everything but streams also counts against the control server budget
+  int control_active = 0;
+  for (int i = 0; i < ASYNC_CLASSES; i++) {
+    if (i != ASYNC_CLASS_STREAM) {
+      control_active += async_class_active[i];
+    }
+  }
+  if (async_class_active[cls] < async_class_limit[cls] &&
+      (cls == ASYNC_CLASS_STREAM || control_active < ASYNC_CONTROL_SESSIONS)) {
+    for (int i = 0; i < ASYNC_WORKERS; i++) {
+      async_worker_t *candidate = &async_workers[i];
+      if (candidate->task && candidate->load < ASYNC_SESSIONS_PER_WORKER &&
+          (!worker || candidate->load < worker->load)) {
+        worker = candidate;
+      }
+    }
+  }
+  if (worker) {
+    worker->load++;
+    async_class_active[cls]++;
+  }
+  portEXIT_CRITICAL(&async_mux);
+
+  if (!worker) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  async_session_t session = {};
+  session.ops = ops;
+  session.ctx = ctx;
+  session.cls = cls;
+  if (httpd_req_async_handler_begin(req, &session.req) != ESP_OK) {
+    portENTER_CRITICAL(&async_mux);
+    worker->load--;
+    async_class_active[cls]--;
+    portEXIT_CRITICAL(&async_mux);
+    return ESP_FAIL;
+  }
+
+  // The queue holds one entry per free slot, so this cannot block
+  xQueueSend(worker->incoming, &session, 0);
+  xTaskNotifyGive(worker->task);
+  return ESP_OK;
+}
+
+// Wake every worker, e.g. after a change sessions are waiting for
+void async_workers_wake() {
+  for (int i = 0; i < ASYNC_WORKERS; i++) {
+    if (async_workers[i].task) {
+      xTaskNotifyGive(async_workers[i].task);
+    }
+  }
+}
+
+// Start the worker pool
+bool async_workers_init() {
+  for (int i = 0; i < ASYNC_WORKERS; i++) {
+    async_worker_t *worker = &async_workers[i];
+    if (worker->task) {
+      continue;
+    }
+    worker->incoming = xQueueCreate(ASYNC_SESSIONS_PER_WORKER, sizeof(async_session_t));
+    if (!worker->incoming) {
+      LOGR_E("Failed to create async worker queue");
+      return false;
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "async%d", i);
+    if (xTaskCreatePinnedToCore(async_worker_task, name, ASYNC_WORKER_STACK, worker,
+                                ASYNC_WORKER_PRIORITY, &worker->task, ASYNC_WORKER_CORE) != pdPASS) {
+      LOGR_E("Failed to start async worker");
+      worker->task = NULL;
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+// Named sensor profiles (day, night, inspection, ...) kept in EEPROM after
+// the network configuration; include this after network_config.h.
+// A profile is stored as the /control query that recreates it, so
+// profiles survive controls being added or removed by firmware updates.
+// At most one profile is applied at boot.
+
+#define PROFILE_MAX 4
+#define PROFILE_NAME_LEN 16
+#define PROFILE_SETTINGS_LEN 352
+#define EEPROM_PROFILES_ADDR 512
+#define EEPROM_PROFILES_VALID_FLAG 0xA7
+
+typedef struct {
+  char name[PROFILE_NAME_LEN];           // Empty for a free slot
+  char settings[PROFILE_SETTINGS_LEN];   // name=value&name=value...
+} camera_profile_t;
+
+typedef struct {
+  uint8_t valid;
+  int8_t default_slot;                   // Applied at boot, -1 for none
+  camera_profile_t slots[PROFILE_MAX];
+} camera_profile_store_t;
+
+static_assert(EEPROM_PROFILES_ADDR + sizeof(camera_profile_store_t) <= EEPROM_SIZE,
+              "Camera profiles do not fit in the EEPROM area");
+
+static camera_profile_store_t camera_profiles;
+
+// Read the profiles; EEPROM.begin() must have run
+static void camera_profiles_load() {
+  EEPROM.get(EEPROM_PROFILES_ADDR, camera_profiles);
+  if (camera_profiles.valid != EEPROM_PROFILES_VALID_FLAG) {
+    memset(&camera_profiles, 0, sizeof(camera_profiles));
+    camera_profiles.valid = EEPROM_PROFILES_VALID_FLAG;
+    camera_profiles.default_slot = -1;
+    return;
+  }
+  for (int i = 0; i < PROFILE_MAX; i++) {
+    camera_profiles.slots[i].name[PROFILE_NAME_LEN - 1] = 0;
+    camera_profiles.slots[i].settings[PROFILE_SETTINGS_LEN - 1] = 0;
+  }
+  // Anything but an occupied slot, including a corrupt negative value, means none
+  int slot = camera_profiles.default_slot;
+  if (slot < 0 || slot >= PROFILE_MAX || !camera_profiles.slots[slot].name[0]) {
+    camera_profiles.default_slot = -1;
+  }
+}
+
+static bool camera_profiles_commit() {
+  EEPROM.put(EEPROM_PROFILES_ADDR, camera_profiles);
+  return EEPROM.commit();
+}
+
+// Profile names go into URLs and JSON unescaped
+static bool camera_profile_name_valid(const char *name) {
+  size_t len = strlen(name);
+  if (len == 0 || len >= PROFILE_NAME_LEN) {
+    return false;
+  }
+  for (size_t i = 0; i < len; i++) {
+    if (!isalnum((unsigned char)name[i]) && name[i] != '_' && name[i] != '-') {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int camera_profile_find(const char *name) {
+  for (int i = 0; i < PROFILE_MAX; i++) {
+    if (camera_profiles.slots[i].name[0] && !strcmp(camera_profiles.slots[i].name, name)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Create or overwrite a profile. Returns its slot, -1 when all are taken.
+static int camera_profile_store(const char *name, const char *settings) {
+  int slot = camera_profile_find(name);
+  for (int i = 0; slot < 0 && i < PROFILE_MAX; i++) {
+    if (!camera_profiles.slots[i].name[0]) {
+      slot = i;
+    }
+  }
+  if (slot < 0 || strlen(settings) >= PROFILE_SETTINGS_LEN) {
+    return -1;
+  }
+  snprintf(camera_profiles.slots[slot].name, PROFILE_NAME_LEN, "%s", name);
+  snprintf(camera_profiles.slots[slot].settings, PROFILE_SETTINGS_LEN, "%s", settings);
+  return slot;
+}
+
+static void camera_profile_delete(int slot) {
+  memset(&camera_profiles.slots[slot], 0, sizeof(camera_profile_t));
+  if (camera_profiles.default_slot == slot) {
+    camera_profiles.default_slot = -1;
+  }
+}
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <sys/uio.h>
+#include <Arduino.h>
+#include "esp_heap_caps.h"
+#include "esp_http_server.h"
+#include "esp_timer.h"
+#include "async_workers.h"
+#include "frame_fanout.h"
+#include "log_ring.h"
+#include "metrics.h"
+
+// Burst capture: /capture/burst?n=&interval_ms= returns n consecutive
+// frames as one multipart/mixed response. The request runs on an async
+// worker attached to the frame fan-out, so frames are taken at the sensor
+// rate. Each one is copied to PSRAM as soon as it is published and sent as
+// fast as the link allows, so a slow link delays the response instead of
+// skipping frames.
+
+#define BURST_MAX_FRAMES 50
+#define BURST_DEFAULT_FRAMES 10
+#define BURST_MAX_INTERVAL_MS 10000
+#define BURST_MAX_BUFFERED (2 * 1024 * 1024)
+#define BURST_STALL_TIMEOUT_US (10 * 1000000LL)
+
+#define BURST_BOUNDARY "burst-frame-boundary-7b3e1f"
+
+static const char *_BURST_RESPONSE =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: multipart/mixed;boundary=" BURST_BOUNDARY "\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "Cache-Control: no-cache\r\n"
+    "X-Burst-Frames: %d\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+static const char *_BURST_PART = "\r\n--" BURST_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n"
+                                 "X-Timestamp: %d.%06d\r\nX-Frame-Seq: %u\r\n\r\n";
+static const char *_BURST_END = "\r\n--" BURST_BOUNDARY "--\r\n";
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  struct timeval timestamp;
+  uint32_t seq;
+} burst_frame_t;
+
+typedef struct {
+  int want;                  // Frames requested
+  int taken;                 // Frames copied so far
+  int sent;                  // Frames completely written
+  int64_t interval;          // Minimum spacing between frames in us
+  int64_t next_take;
+  uint32_t last_seq;
+  int64_t last_frame;
+  size_t buffered;
+  bool attached;
+  bool finished;             // Closing boundary queued
+  burst_frame_t frames[BURST_MAX_FRAMES];
+
+  // Part in flight: head, then the body of frames[sent] unless finished
+  char head[192];
+  size_t head_len;
+  size_t head_off;
+  size_t body_off;
+  bool in_flight;
+  int64_t last_progress;
+} burst_client_t;
+
+// Copy the newest frame if it is one the burst still needs
+static esp_err_t burst_take(burst_client_t *client, int64_t now) {
+  if (client->taken >= client->want) {
+    return ESP_OK;
+  }
+
+  shared_frame_t *frame = frame_fanout_acquire();
+  if (!frame || frame->seq == client->last_seq) {
+    frame_fanout_release(frame);
+    if (now - client->last_frame > FANOUT_TIMEOUT_MS * 1000LL) {
+      LOGR_E("Camera capture failed");
+      return ESP_FAIL;
+    }
+    return ESP_OK;
+  }
+
+  if (frame->published >= client->next_take) {
+    if (client->buffered + frame->len > BURST_MAX_BUFFERED) {
+      // The link is too slow for this burst; the seq gap shows the loss
+      metric_inc(&metric_frames_dropped_backlog);
+    } else {
+      uint8_t *copy = (uint8_t *)heap_caps_malloc(frame->len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+      if (!copy) {
+        frame_fanout_release(frame);
+        LOGR_E("Burst frame alloc failed");
+        return ESP_ERR_NO_MEM;
+      }
+      memcpy(copy, frame->buf, frame->len);
+      burst_frame_t *slot = &client->frames[client->taken++];
+      slot->buf = copy;
+      slot->len = frame->len;
+      slot->timestamp = frame->timestamp;
+      slot->seq = frame->seq;
+      client->buffered += frame->len;
+      if (client->interval) {
+        client->next_take = frame->published + client->interval;
+      }
+    }
+  }
+  client->last_seq = frame->seq;
+  client->last_frame = now;
+  frame_fanout_release(frame);
+  return ESP_OK;
+}
+
+// Queue the next part header, or the closing boundary after the last frame
+static void burst_next_part(burst_client_t *client) {
+  if (client->sent < client->taken) {
+    burst_frame_t *frame = &client->frames[client->sent];
+    client->head_len = snprintf(client->head, sizeof(client->head), _BURST_PART, (unsigned)frame->len,
+                                (int)frame->timestamp.tv_sec, (int)frame->timestamp.tv_usec, frame->seq);
+    client->head_off = 0;
+    client->body_off = 0;
+    client->in_flight = true;
+  } else if (client->sent == client->want && !client->finished) {
+    client->head_len = strlen(_BURST_END);
+    memcpy(client->head, _BURST_END, client->head_len);
+    client->head_off = 0;
+    client->finished = true;
+    client->in_flight = true;
+  }
+}
+
+// Write as much as the socket takes without blocking
+static esp_err_t burst_flush(async_session_t *session, burst_client_t *client, int64_t now) {
+  while (true) {
+    if (!client->in_flight) {
+      burst_next_part(client);
+      if (!client->in_flight) {
+        break;
+      }
+    }
+
+    burst_frame_t *frame = client->finished ? NULL : &client->frames[client->sent];
+    struct iovec iov[2];
+    int iovcnt = 0;
+    if (client->head_off < client->head_len) {
+      iov[iovcnt].iov_base = client->head + client->head_off;
+      iov[iovcnt].iov_len = client->head_len - client->head_off;
+      iovcnt++;
+    }
+    if (frame && client->body_off < frame->len) {
+      iov[iovcnt].iov_base = frame->buf + client->body_off;
+      iov[iovcnt].iov_len = frame->len - client->body_off;
+      iovcnt++;
+    }
+
+    ssize_t sent = iovcnt ? async_session_try_send(session, iov, iovcnt) : 0;
+    if (sent < 0) {
+      return ESP_FAIL;
+    }
+    if (iovcnt && sent == 0) {
+      break;
+    }
+    client->last_progress = now;
+    metric_add(&metric_stream_bytes, sent);
+
+    size_t head_rest = client->head_len - client->head_off;
+    if ((size_t)sent <= head_rest) {
+      client->head_off += sent;
+    } else {
+      client->head_off = client->head_len;
+      client->body_off += sent - head_rest;
+    }
+
+    if (client->head_off == client->head_len && (!frame || client->body_off == frame->len)) {
+      client->in_flight = false;
+      if (!frame) {
+        return ASYNC_SESSION_DONE;
+      }
+      free(frame->buf);
+      frame->buf = NULL;
+      client->buffered -= frame->len;
+      client->sent++;
+      metric_inc(&metric_frames_sent);
+    }
+  }
+
+  session->want_write = client->in_flight;
+  if (session->want_write && now - client->last_progress > BURST_STALL_TIMEOUT_US) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t burst_session_open(async_session_t *session) {
+  burst_client_t *client = (burst_client_t *)session->ctx;
+
+  session->close_on_finish = true;
+  int nodelay = 1;
+  setsockopt(session->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+  if (!frame_fanout_attach(session->worker)) {
+    LOGR_W("Too many stream clients");
+    return ESP_FAIL;
+  }
+  client->attached = true;
+
+  int64_t now = esp_timer_get_time();
+  client->last_frame = now;
+  client->last_progress = now;
+  // Only frames published from now on belong to the burst
+  shared_frame_t *frame = frame_fanout_acquire();
+  if (frame) {
+    client->last_seq = frame->seq;
+  }
+  frame_fanout_release(frame);
+
+  char head[256];
+  size_t len = snprintf(head, sizeof(head), _BURST_RESPONSE, client->want);
+  struct iovec iov = {head, len};
+  return async_session_send(session, &iov, 1);
+}
+
+static esp_err_t burst_session_service(async_session_t *session) {
+  burst_client_t *client = (burst_client_t *)session->ctx;
+  int64_t now = esp_timer_get_time();
+
+  esp_err_t res = burst_take(client, now);
+  if (res != ESP_OK) {
+    return res;
+  }
+  if (client->attached && client->taken == client->want) {
+    // Every frame is buffered, let the capture task idle if nobody else watches
+    frame_fanout_detach(session->worker);
+    client->attached = false;
+  }
+  return burst_flush(session, client, now);
+}
+
+static void burst_session_close(async_session_t *session) {
+  burst_client_t *client = (burst_client_t *)session->ctx;
+  if (client->attached) {
+    frame_fanout_detach(session->worker);
+  }
+  for (int i = 0; i < client->taken; i++) {
+    free(client->frames[i].buf);
+  }
+  free(client);
+}
+
+static const async_session_ops_t burst_session_ops = {
+  burst_session_open,
+  burst_session_service,
+  burst_session_close,
+};
+
+// Handler for /capture/burst?n=&interval_ms=
+static esp_err_t capture_burst_handler(httpd_req_t *req) {
+  char query[64];
+  char param[16];
+  int frames = BURST_DEFAULT_FRAMES;
+  int interval_ms = 0;
+
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    if (httpd_query_key_value(query, "n", param, sizeof(param)) == ESP_OK) {
+      frames = constrain(atoi(param), 1, BURST_MAX_FRAMES);
+    }
+    if (httpd_query_key_value(query, "interval_ms", param, sizeof(param)) == ESP_OK) {
+      interval_ms = constrain(atoi(param), 0, BURST_MAX_INTERVAL_MS);
+    }
+  }
+
+  burst_client_t *client = (burst_client_t *)calloc(1, sizeof(burst_client_t));
+  if (!client) {
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+  client->want = frames;
+  client->interval = interval_ms * 1000LL;
+
+  if (async_session_start(req, ASYNC_CLASS_CONTROL, &burst_session_ops, client) != ESP_OK) {
+    free(client);
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, "Too many stream clients", HTTPD_RESP_USE_STRLEN);
+  }
+  return ESP_OK;
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <stdarg.h>
+#include <Arduino.h>
+#include "esp_http_server.h"
+#include "esp_timer.h"
+#include "async_workers.h"
+#include "log_ring.h"
+#include "metrics.h"
+
+// Server-Sent Events on /events.
+// Changes are published as compact JSON deltas into a ring of recent events
+// and the async workers are woken. Each /events client is an async session
+// that writes whatever it has not seen yet without blocking, so a slow
+// client never holds up the publisher or the others. A client that falls a
+// whole ring behind, or reconnects with a Last-Event-ID that is gone, gets
+// a "resync" event and should refetch full state.
+
+#define EVENT_RING 16
+#define EVENT_TYPE_MAX 12
+#define EVENT_DATA_MAX 384
+#define EVENT_KEEPALIVE_US (15 * 1000000LL)
+#define EVENT_STALL_TIMEOUT_US (10 * 1000000LL)
+
+typedef struct {
+  uint32_t id;
+  char type[EVENT_TYPE_MAX];
+  char data[EVENT_DATA_MAX];
+} event_t;
+
+static event_t event_ring[EVENT_RING];
+static uint32_t event_last_id = 0;   // Newest event, 0 before the first
+static portMUX_TYPE event_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *_EVENT_RESPONSE =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "retry: 2000\n\n";
+
+// Publish one event; data is a JSON object. Safe from any task.
+void events_publish(const char *type, const char *fmt, ...) {
+  char data[EVENT_DATA_MAX];
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(data, sizeof(data), fmt, args);
+  va_end(args);
+  if (len < 0 || len >= (int)sizeof(data)) {
+    LOGR_W("Dropped oversized %s event", type);
+    return;
+  }
+
+  portENTER_CRITICAL(&event_mux);
+  uint32_t id = ++event_last_id;
+  event_t *event = &event_ring[id % EVENT_RING];
+  event->id = id;
+  strncpy(event->type, type, EVENT_TYPE_MAX - 1);
+  event->type[EVENT_TYPE_MAX - 1] = 0;
+  memcpy(event->data, data, len + 1);
+  portEXIT_CRITICAL(&event_mux);
+
+  metric_inc(&metric_events_published);
+  async_workers_wake();
+}
+
+typedef struct {
+  uint32_t next_id;            // First event not yet queued
+  char buf[EVENT_DATA_MAX + 64];
+  size_t len;
+  size_t off;
+  int64_t last_write;
+  int64_t last_progress;
+  bool counted;                // Included in metric_event_clients
+} event_client_t;
+
+// Format the next unseen event, a resync notice or a keepalive into buf
+static bool event_client_fill(event_client_t *client, int64_t now) {
+  event_t event;
+  bool resync = false;
+  portENTER_CRITICAL(&event_mux);
+  uint32_t last = event_last_id;
+  bool pending = client->next_id <= last;
+  if (pending) {
+    uint32_t oldest = last >= EVENT_RING ? last - EVENT_RING + 1 : 1;
+    resync = client->next_id < oldest;
+    if (!resync) {
+      event = event_ring[client->next_id % EVENT_RING];
+    }
+  }
+  portEXIT_CRITICAL(&event_mux);
+
+  if (resync) {
+    client->len = snprintf(client->buf, sizeof(client->buf), "id: %u\nevent: resync\ndata: {}\n\n", (unsigned)last);
+    client->next_id = last + 1;
+    metric_inc(&metric_events_resync);
+    return true;
+  }
+  if (pending) {
+    client->len = snprintf(client->buf, sizeof(client->buf), "id: %u\nevent: %s\ndata: %s\n\n", (unsigned)event.id,
+                           event.type, event.data);
+    client->next_id++;
+    return true;
+  }
+
+  // Keeps proxies and NAT tables from dropping an idle stream
+  if (now - client->last_write > EVENT_KEEPALIVE_US) {
+    client->len = snprintf(client->buf, sizeof(client->buf), ": keepalive\n\n");
+    return true;
+  }
+  return false;
+}
+
+static esp_err_t event_session_service(async_session_t *session) {
+  event_client_t *client = (event_client_t *)session->ctx;
+  int64_t now = esp_timer_get_time();
+
+  while (true) {
+    if (client->off == client->len) {
+      client->off = client->len = 0;
+      if (!event_client_fill(client, now)) {
+        break;
+      }
+    }
+    struct iovec iov = {client->buf + client->off, client->len - client->off};
+    ssize_t sent = async_session_try_send(session, &iov, 1);
+    if (sent < 0) {
+      return ESP_FAIL;
+    }
+    if (sent == 0) {
+      break;
+    }
+    client->off += sent;
+    client->last_write = now;
+    client->last_progress = now;
+  }
+
+  session->want_write = client->off < client->len;
+  if (session->want_write && now - client->last_progress > EVENT_STALL_TIMEOUT_US) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t event_session_open(async_session_t *session) {
+  event_client_t *client = (event_client_t *)session->ctx;
+  session->close_on_finish = true;
+  int nodelay = 1;
+  setsockopt(session->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+  client->last_write = client->last_progress = esp_timer_get_time();
+  struct iovec iov = {(void *)_EVENT_RESPONSE, strlen(_EVENT_RESPONSE)};
+  if (async_session_send(session, &iov, 1) != ESP_OK) {
+    return ESP_FAIL;
+  }
+  __atomic_add_fetch(&metric_event_clients, 1, __ATOMIC_RELAXED);
+  client->counted = true;
+  return event_session_service(session);
+}
+
+static void event_session_close(async_session_t *session) {
+  event_client_t *client = (event_client_t *)session->ctx;
+  if (client->counted) {
+    __atomic_sub_fetch(&metric_event_clients, 1, __ATOMIC_RELAXED);
+  }
+  free(client);
+}
+
+static const async_session_ops_t event_session_ops = {
+  event_session_open,
+  event_session_service,
+  event_session_close,
+};
+
+// Handler for /events. A reconnecting EventSource sends Last-Event-ID and
+// resumes after it.
+static esp_err_t events_handler(httpd_req_t *req) {
+  event_client_t *client = (event_client_t *)calloc(1, sizeof(event_client_t));
+  if (!client) {
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+
+  portENTER_CRITICAL(&event_mux);
+  client->next_id = event_last_id + 1;
+  portEXIT_CRITICAL(&event_mux);
+  char last_id[16];
+  if (httpd_req_get_hdr_value_str(req, "Last-Event-ID", last_id, sizeof(last_id)) == ESP_OK) {
+    uint32_t resume = strtoul(last_id, NULL, 10) + 1;
+    if (resume < client->next_id) {
+      client->next_id = resume;
+    }
+  }
+
+  if (async_session_start(req, ASYNC_CLASS_EVENTS, &event_session_ops, client) != ESP_OK) {
+    free(client);
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, "Too many event clients", HTTPD_RESP_USE_STRLEN);
+  }
+  return ESP_OK;
+}
@@ -0,0 +1,382 @@
+#pragma once
+
+#include "esp_camera.h"
+#include "esp_timer.h"
+#include "img_converters.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "jpeg_transcode.h"
+#include "log_ring.h"
+#include "metrics.h"
+#include "rate_control.h"
+
+// Single-capture frame fan-out.
+// One capture task grabs each frame from the sensor exactly once and publishes
+// it in a reference counted slot. Every attached stream client sends the same
+// buffer, so the sensor frame rate no longer depends on the number of viewers.
+
+#define FANOUT_SLOTS 3
+#define FANOUT_MAX_SUBSCRIBERS 8
+#define FANOUT_TASK_STACK 4096
+#define FANOUT_TASK_PRIORITY 5
+#define FANOUT_TASK_CORE 1
+#define FANOUT_TIMEOUT_MS 5000
+#define FANOUT_WAIT_TIMEOUT pdMS_TO_TICKS(FANOUT_TIMEOUT_MS)
+#define FANOUT_VARIANTS 4
+
+// A cropped and/or downscaled copy of a published frame
+typedef struct {
+  int scale;
+  bool cropped;
+  jpeg_roi_t roi;             // As requested, before MCU alignment
+  uint8_t *buf;
+  size_t len;
+} frame_variant_t;
+
+// A published frame. buf/len always point at JPEG data; fb is NULL when the
+// sensor delivered another pixel format and the frame was converted.
+typedef struct {
+  camera_fb_t *fb;
+  uint8_t *buf;
+  size_t len;
+  struct timeval timestamp;
+  int64_t published;        // esp_timer time the frame became current
+  uint32_t seq;
+  frame_variant_t variants[FANOUT_VARIANTS];   // Made on first use
+  int num_variants;
+  int refs;
+  bool busy;
+} shared_frame_t;
+
+// Task woken whenever a new frame is published
+typedef struct {
+  TaskHandle_t task;
+  int count;
+} fanout_subscriber_t;
+
+static shared_frame_t fanout_slots[FANOUT_SLOTS];
+static shared_frame_t *fanout_current = NULL;
+static uint32_t fanout_seq = 0;
+static fanout_subscriber_t fanout_subscribers[FANOUT_MAX_SUBSCRIBERS];
+static int fanout_viewers = 0;
+static TaskHandle_t fanout_task = NULL;
+static portMUX_TYPE fanout_mux = portMUX_INITIALIZER_UNLOCKED;
+static int64_t fanout_settled = 0;   // Frames started before this predate a settings change
+
+// Drop one reference; the last one hands the buffer back to the driver
+void frame_fanout_release(shared_frame_t *frame) {
+  if (!frame) {
+    return;
+  }
+
+  portENTER_CRITICAL(&fanout_mux);
+  bool last = (--frame->refs == 0);
+  portEXIT_CRITICAL(&fanout_mux);
+  if (!last) {
+    return;
+  }
+
+  if (frame->fb) {
+    esp_camera_fb_return(frame->fb);
+  } else if (frame->buf) {
+    free(frame->buf);
+  }
+  frame->fb = NULL;
+  frame->buf = NULL;
+  frame->len = 0;
+  for (int i = 0; i < frame->num_variants; i++) {
+    free(frame->variants[i].buf);
+  }
+  frame->num_variants = 0;
+
+  portENTER_CRITICAL(&fanout_mux);
+  frame->busy = false;
+  portEXIT_CRITICAL(&fanout_mux);
+}
+
+// Take a reference to the most recently published frame, or NULL
+shared_frame_t *frame_fanout_acquire() {
+  portENTER_CRITICAL(&fanout_mux);
+  shared_frame_t *frame = fanout_current;
+  if (frame) {
+    frame->refs++;
+  }
+  portEXIT_CRITICAL(&fanout_mux);
+  return frame;
+}
+
+static frame_variant_t *fanout_find_variant(shared_frame_t *frame, const jpeg_roi_t *roi, int scale) {
+  for (int i = 0; i < frame->num_variants; i++) {
+    frame_variant_t *variant = &frame->variants[i];
+    if (variant->scale == scale && variant->cropped == (roi != NULL) &&
+        (!roi || memcmp(&variant->roi, roi, sizeof(*roi)) == 0)) {
+      return variant;
+    }
+  }
+  return NULL;
+}
+
+// The frame cropped to roi (NULL for all of it) and downscaled by scale,
+// for a caller holding a reference. The first client asking for a variant
+// transcodes it and clients with the same parameters share that copy, so
+// the cost is once per frame and variant. When every variant slot is taken
+// the copy is the caller's own: *owned is set and the caller frees it.
+bool frame_fanout_variant(shared_frame_t *frame, const jpeg_roi_t *roi, int scale, const uint8_t **buf, size_t *len,
+                          bool *owned) {
+  *owned = false;
+
+  portENTER_CRITICAL(&fanout_mux);
+  frame_variant_t *variant = fanout_find_variant(frame, roi, scale);
+  if (variant) {
+    *buf = variant->buf;
+    *len = variant->len;
+  }
+  portEXIT_CRITICAL(&fanout_mux);
+  if (variant) {
+    return true;
+  }
+
+  uint8_t *out = NULL;
+  size_t out_len = 0;
+  int64_t start = esp_timer_get_time();
+  if (!jpeg_transcode(frame->buf, frame->len, roi, scale, &out, &out_len, NULL)) {
+    return false;
+  }
+  metric_observe(&metric_jpeg_transcode, esp_timer_get_time() - start);
+
+  // Another worker may have raced us to it; keep the first copy
+  uint8_t *spare = NULL;
+  portENTER_CRITICAL(&fanout_mux);
+  variant = fanout_find_variant(frame, roi, scale);
+  if (variant) {
+    spare = out;
+    out = variant->buf;
+    out_len = variant->len;
+  } else if (frame->num_variants < FANOUT_VARIANTS) {
+    variant = &frame->variants[frame->num_variants++];
+    variant->scale = scale;
+    variant->cropped = roi != NULL;
+    if (roi) {
+      variant->roi = *roi;
+    }
+    variant->buf = out;
+    variant->len = out_len;
+  } else {
+    *owned = true;
+  }
+  portEXIT_CRITICAL(&fanout_mux);
+  free(spare);
+
+  *buf = out;
+  *len = out_len;
+  return true;
+}
+
+// Block the calling (attached) task until a frame newer than last_seq is
+// published. Returns a referenced frame or NULL on timeout.
+shared_frame_t *frame_fanout_wait(uint32_t last_seq, TickType_t timeout) {
+  TickType_t start = xTaskGetTickCount();
+  while (true) {
+    shared_frame_t *frame = frame_fanout_acquire();
+    if (frame && frame->seq != last_seq) {
+      return frame;
+    }
+    frame_fanout_release(frame);
+
+    TickType_t elapsed = xTaskGetTickCount() - start;
+    if (elapsed >= timeout || !ulTaskNotifyTake(pdTRUE, timeout - elapsed)) {
+      return NULL;
+    }
+  }
+}
+
+// Register a viewer. task is notified on every new frame while attached.
+bool frame_fanout_attach(TaskHandle_t task) {
+  bool attached = false;
+
+  portENTER_CRITICAL(&fanout_mux);
+  for (int i = 0; i < FANOUT_MAX_SUBSCRIBERS && !attached; i++) {
+    if (fanout_subscribers[i].task == task) {
+      fanout_subscribers[i].count++;
+      attached = true;
+    }
+  }
+  for (int i = 0; i < FANOUT_MAX_SUBSCRIBERS && !attached; i++) {
+    if (fanout_subscribers[i].count == 0) {
+      fanout_subscribers[i].task = task;
+      fanout_subscribers[i].count = 1;
+      attached = true;
+    }
+  }
+  if (attached) {
+    fanout_viewers++;
+  }
+  portEXIT_CRITICAL(&fanout_mux);
+
+  if (attached && fanout_task) {
+    xTaskNotifyGive(fanout_task);
+  }
+  return attached;
+}
+
+void frame_fanout_detach(TaskHandle_t task) {
+  portENTER_CRITICAL(&fanout_mux);
+  for (int i = 0; i < FANOUT_MAX_SUBSCRIBERS; i++) {
+    if (fanout_subscribers[i].count > 0 && fanout_subscribers[i].task == task) {
+      if (--fanout_subscribers[i].count == 0) {
+        fanout_subscribers[i].task = NULL;
+      }
+      fanout_viewers--;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&fanout_mux);
+}
+
+// Claim an unused slot for the next frame
+static shared_frame_t *fanout_claim_slot() {
+  shared_frame_t *slot = NULL;
+
+  portENTER_CRITICAL(&fanout_mux);
+  for (int i = 0; i < FANOUT_SLOTS; i++) {
+    if (!fanout_slots[i].busy) {
+      slot = &fanout_slots[i];
+      slot->busy = true;
+      slot->refs = 0;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&fanout_mux);
+  return slot;
+}
+
+// Make the frame in slot the current one and wake every subscriber
+static void fanout_publish(shared_frame_t *slot) {
+  TaskHandle_t wake[FANOUT_MAX_SUBSCRIBERS];
+  int num_wake = 0;
+
+  portENTER_CRITICAL(&fanout_mux);
+  shared_frame_t *old = fanout_current;
+  slot->seq = ++fanout_seq;
+  if (slot->seq == 0) {
+    // 0 is reserved for "no frame seen yet"
+    slot->seq = ++fanout_seq;
+  }
+  slot->refs = 1; // held while current
+  slot->published = esp_timer_get_time();
+  fanout_current = slot;
+  for (int i = 0; i < FANOUT_MAX_SUBSCRIBERS; i++) {
+    if (fanout_subscribers[i].count > 0) {
+      wake[num_wake++] = fanout_subscribers[i].task;
+    }
+  }
+  portEXIT_CRITICAL(&fanout_mux);
+
+  frame_fanout_release(old);
+  for (int i = 0; i < num_wake; i++) {
+    xTaskNotifyGive(wake[i]);
+  }
+}
+
+// Drop the current frame so the driver gets its buffer back while idle
+static void fanout_clear() {
+  portENTER_CRITICAL(&fanout_mux);
+  shared_frame_t *old = fanout_current;
+  fanout_current = NULL;
+  portEXIT_CRITICAL(&fanout_mux);
+  frame_fanout_release(old);
+}
+
+// Discard frames the sensor started before now, so a batch of settings
+// never shows up half applied
+void frame_fanout_settle() {
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&fanout_mux);
+  fanout_settled = now;
+  portEXIT_CRITICAL(&fanout_mux);
+}
+
+// True for a frame that started before the last settings change
+static bool frame_fanout_stale(const struct timeval *timestamp) {
+  portENTER_CRITICAL(&fanout_mux);
+  int64_t settled = fanout_settled;
+  portEXIT_CRITICAL(&fanout_mux);
+  return timestamp->tv_sec * 1000000LL + timestamp->tv_usec < settled;
+}
+
+static void frame_fanout_task(void *arg) {
+  while (true) {
+    portENTER_CRITICAL(&fanout_mux);
+    int viewers = fanout_viewers;
+    portEXIT_CRITICAL(&fanout_mux);
+
+    if (viewers == 0) {
+      fanout_clear();
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+
+    int64_t wait_start = esp_timer_get_time();
+    camera_fb_t *fb = esp_camera_fb_get();
+    metric_observe(&metric_fb_get_wait, esp_timer_get_time() - wait_start);
+    if (!fb) {
+      metric_inc(&metric_capture_failures);
+      LOGR_E("Camera capture failed");
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+    if (frame_fanout_stale(&fb->timestamp)) {
+      metric_inc(&metric_frames_dropped_settling);
+      esp_camera_fb_return(fb);
+      continue;
+    }
+
+    shared_frame_t *slot = fanout_claim_slot();
+    if (!slot) {
+      // Every slot is still held by a client, skip this frame
+      esp_camera_fb_return(fb);
+      vTaskDelay(1);
+      continue;
+    }
+
+    slot->timestamp = fb->timestamp;
+    if (fb->format == PIXFORMAT_JPEG) {
+      slot->fb = fb;
+      slot->buf = fb->buf;
+      slot->len = fb->len;
+    } else {
+      int64_t encode_start = esp_timer_get_time();
+      bool jpeg_converted = frame2jpg(fb, 80, &slot->buf, &slot->len);
+      metric_observe(&metric_jpeg_encode, esp_timer_get_time() - encode_start);
+      esp_camera_fb_return(fb);
+      if (!jpeg_converted) {
+        LOGR_E("JPEG compression failed");
+        slot->buf = NULL;
+        slot->len = 0;
+        portENTER_CRITICAL(&fanout_mux);
+        slot->busy = false;
+        portEXIT_CRITICAL(&fanout_mux);
+        continue;
+      }
+    }
+
+    metric_inc(&metric_frames_captured);
+    rate_control_frame(slot->len);
+    fanout_publish(slot);
+    rate_control_update();
+  }
+}
+
+// Start the capture task
+bool frame_fanout_init() {
+  if (fanout_task) {
+    return true;
+  }
+  if (xTaskCreatePinnedToCore(frame_fanout_task, "fanout", FANOUT_TASK_STACK, NULL,
+                              FANOUT_TASK_PRIORITY, &fanout_task, FANOUT_TASK_CORE) != pdPASS) {
+    LOGR_E("Failed to start frame fan-out task");
+    fanout_task = NULL;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <Arduino.h>
+#include "soc/gpio_struct.h"
+
+// Simultaneous writes to several GPIO outputs.
+// GPIO 0-31 and 32-48 each have a write-1-to-set and a write-1-to-clear
+// register, so every pin of a bank changes with one store instead of one
+// digitalWrite() after another. Clears go first: in a changeover every
+// output drops before any rises (break-before-make), one bus write apart.
+
+// Drive the pins in mask to the matching bits of value
+static void gpio_bulk_write(uint64_t mask, uint64_t value) {
+  uint64_t clear = mask & ~value;
+  uint64_t set = mask & value;
+  if ((uint32_t)clear) {
+    GPIO.out_w1tc = (uint32_t)clear;
+  }
+  if (clear >> 32) {
+    GPIO.out1_w1tc.val = (uint32_t)(clear >> 32);
+  }
+  if ((uint32_t)set) {
+    GPIO.out_w1ts = (uint32_t)set;
+  }
+  if (set >> 32) {
+    GPIO.out1_w1ts.val = (uint32_t)(set >> 32);
+  }
+}
+
+// Bit n set for every pin in the list
+static uint64_t gpio_pin_mask(const int *pins, int count) {
+  uint64_t mask = 0;
+  for (int i = 0; i < count; i++) {
+    mask |= 1ULL << pins[i];
+  }
+  return mask;
+}
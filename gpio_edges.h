@@ -0,0 +1,155 @@
+#pragma once
+
+#include <Arduino.h>
+#include "esp_timer.h"
+#include "esp_http_server.h"
+#include "soc/gpio_struct.h"
+
+// Digital input snapshot and edge capture.
+// gpio_input_levels() reads every input with one load per register bank.
+// Watched pins record each edge from their interrupt handler into a
+// lock-free ring, stamped with esp_timer time, and /gpio/di/events?since=
+// drains it in batches. Handlers claim slots like log_ring.h producers do,
+// so edges on both cores never wait for each other or for a reader.
+
+#define GPIO_EDGE_SLOTS 256      // Power of two
+#define GPIO_EDGE_BATCH 128      // Default and largest batch per response
+
+#define GPIO_EDGE_RISING 1
+#define GPIO_EDGE_FALLING 0
+
+typedef struct {
+  volatile uint32_t seq;     // Sequence number + 1 once complete, 0 while written
+  uint8_t pin;
+  uint8_t edge;
+  int64_t time_us;
+} gpio_edge_t;
+
+static gpio_edge_t gpio_edge_ring[GPIO_EDGE_SLOTS];
+static volatile uint32_t gpio_edge_head = 0;   // Next sequence number to hand out
+static volatile uint8_t gpio_edge_modes[64];   // Interrupt mode of watched pins, 0 when not watched
+
+// Levels of GPIO 0-48, bit n for GPIO n
+static inline uint64_t gpio_input_levels() {
+  uint32_t low = GPIO.in;
+  uint32_t high = GPIO.in1.val;
+  return ((uint64_t)high << 32) | low;
+}
+
+static void IRAM_ATTR gpio_edge_isr(void *arg) {
+  int64_t now = esp_timer_get_time();
+  uint8_t pin = (uint8_t)(uintptr_t)arg;
+  uint8_t mode = gpio_edge_modes[pin];
+  uint8_t edge;
+  if (mode == RISING) {
+    edge = GPIO_EDGE_RISING;
+  } else if (mode == FALLING) {
+    edge = GPIO_EDGE_FALLING;
+  } else {
+    // CHANGE: the level right after the edge tells which way it went
+    uint32_t bank = pin < 32 ? (uint32_t)GPIO.in : (uint32_t)GPIO.in1.val;
+    edge = (bank >> (pin & 31)) & 1 ? GPIO_EDGE_RISING : GPIO_EDGE_FALLING;
+  }
+
+  uint32_t seq = __atomic_fetch_add(&gpio_edge_head, 1, __ATOMIC_RELAXED);
+  gpio_edge_t *entry = &gpio_edge_ring[seq & (GPIO_EDGE_SLOTS - 1)];
+  __atomic_store_n(&entry->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  entry->pin = pin;
+  entry->edge = edge;
+  entry->time_us = now;
+  __atomic_store_n(&entry->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+// Start recording edges of pin; mode is RISING, FALLING or CHANGE
+static void gpio_edge_watch(int pin, int mode) {
+  gpio_edge_modes[pin] = mode;
+  attachInterruptArg(pin, gpio_edge_isr, (void *)(uintptr_t)pin, mode);
+}
+
+static void gpio_edge_unwatch(int pin) {
+  if (gpio_edge_modes[pin]) {
+    detachInterrupt(pin);
+    gpio_edge_modes[pin] = 0;
+  }
+}
+
+// Copy edge seq out of the ring. False if it was overwritten or is still
+// being written.
+static bool gpio_edge_read(uint32_t seq, gpio_edge_t *out) {
+  gpio_edge_t *entry = &gpio_edge_ring[seq & (GPIO_EDGE_SLOTS - 1)];
+  if (__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) != seq + 1) {
+    return false;
+  }
+  memcpy(out, entry, sizeof(*out));
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == seq + 1;
+}
+
+static uint32_t gpio_edge_oldest(uint32_t head) {
+  return head > GPIO_EDGE_SLOTS ? head - GPIO_EDGE_SLOTS : 0;
+}
+
+// Handler for draining edges: /gpio/di/events?since=<seq>&max=<n>
+static esp_err_t gpio_edge_events_handler(httpd_req_t *req) {
+  char query[64];
+  char param[16];
+  uint32_t head = __atomic_load_n(&gpio_edge_head, __ATOMIC_ACQUIRE);
+  uint32_t since = gpio_edge_oldest(head);
+  int max = GPIO_EDGE_BATCH;
+
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    if (httpd_query_key_value(query, "since", param, sizeof(param)) == ESP_OK) {
+      since = strtoul(param, NULL, 10);
+    }
+    if (httpd_query_key_value(query, "max", param, sizeof(param)) == ESP_OK) {
+      max = constrain(atoi(param), 1, GPIO_EDGE_BATCH);
+    }
+  }
+
+  uint32_t lost = 0;
+  if (since < gpio_edge_oldest(head)) {
+    lost = gpio_edge_oldest(head) - since;
+    since = gpio_edge_oldest(head);
+  }
+  if (since > head) {
+    since = head;
+  }
+
+  // {"seq":4294967295,"pin":48,"edge":"falling","us":9223372036854775807},
+  const size_t entry_max = 80;
+  char *buf = (char *)malloc(64 + max * entry_max);
+  if (!buf) {
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+
+  char *p = buf;
+  p += sprintf(p, "{\"lost\":%u,\"edges\":[", lost);
+  bool first = true;
+  gpio_edge_t edge;
+  uint32_t seq;
+  int count = 0;
+  for (seq = since; seq != head && count < max; seq++) {
+    if (!gpio_edge_read(seq, &edge)) {
+      // Overwritten while we read; still being written ends the batch
+      if (__atomic_load_n(&gpio_edge_ring[seq & (GPIO_EDGE_SLOTS - 1)].seq, __ATOMIC_RELAXED) <= seq) {
+        break;
+      }
+      lost++;
+      continue;
+    }
+    p += sprintf(p, "%s{\"seq\":%u,\"pin\":%u,\"edge\":\"%s\",\"us\":%lld}", first ? "" : ",", seq, edge.pin,
+                 edge.edge == GPIO_EDGE_RISING ? "rising" : "falling", (long long)edge.time_us);
+    first = false;
+    count++;
+  }
+  // Pass next back as since= to continue where this batch ended
+  sprintf(p, "],\"next\":%u,\"success\":true}", seq);
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  esp_err_t res = httpd_resp_send(req, buf, HTTPD_RESP_USE_STRLEN);
+  free(buf);
+  return res;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+// Host stand-in for Adafruit_NeoPixel: the pixel colours are kept in memory
+
+typedef uint16_t neoPixelType;
+
+#define NEO_RGB ((0 << 6) | (0 << 4) | (1 << 2) | (2))
+#define NEO_GRB ((1 << 6) | (1 << 4) | (0 << 2) | (2))
+#define NEO_KHZ800 0x0000
+#define NEO_KHZ400 0x0100
+
+class Adafruit_NeoPixel {
+public:
+  Adafruit_NeoPixel(uint16_t n, int16_t pin = 6, neoPixelType type = NEO_GRB + NEO_KHZ800)
+      : pin_(pin), pixels_(n, 0) {}
+
+  bool begin() { return true; }
+  void show() {}
+  void clear() { std::fill(pixels_.begin(), pixels_.end(), 0); }
+  void setBrightness(uint8_t brightness) { brightness_ = brightness; }
+  uint8_t getBrightness() const { return brightness_; }
+  void setPixelColor(uint16_t n, uint32_t c) {
+    if (n < pixels_.size()) {
+      pixels_[n] = c;
+    }
+  }
+  void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b) { setPixelColor(n, Color(r, g, b)); }
+  uint32_t getPixelColor(uint16_t n) const { return n < pixels_.size() ? pixels_[n] : 0; }
+  uint16_t numPixels() const { return pixels_.size(); }
+  int16_t getPin() const { return pin_; }
+
+  static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b; }
+
+private:
+  int16_t pin_;
+  uint8_t brightness_ = 255;
+  std::vector<uint32_t> pixels_;
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp32-hal-ledc.h"
+#include "esp32-hal-adc.h"
+#include "WString.h"
+#include "IPAddress.h"
+#include "HardwareSerial.h"
+#include "Esp.h"
+
+// Host stand-in for the Arduino-ESP32 core. GPIO state lives in memory:
+// outputs remember their level, analogRead() returns a fixed value per pin.
+
+// Interrupt handlers run from flash on the host
+#define IRAM_ATTR
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define PULLUP 0x04
+#define INPUT_PULLUP 0x05
+#define PULLDOWN 0x08
+#define INPUT_PULLDOWN 0x09
+#define OPEN_DRAIN 0x10
+#define OUTPUT_OPEN_DRAIN 0x13
+#define ANALOG 0xC0
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define ONLOW 0x04
+#define ONHIGH 0x05
+
+#define HOST_GPIO_COUNT 49
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+using std::max;
+using std::min;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+uint16_t analogRead(uint8_t pin);
+uint32_t analogReadMilliVolts(uint8_t pin);
+void analogReadResolution(uint8_t bits);
+
+typedef void (*voidFuncPtr)(void);
+typedef void (*voidFuncPtrArg)(void *);
+void attachInterrupt(uint8_t pin, voidFuncPtr handler, int mode);
+void attachInterruptArg(uint8_t pin, voidFuncPtrArg handler, void *arg, int mode);
+void detachInterrupt(uint8_t pin);
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+bool psramFound();
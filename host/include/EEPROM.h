@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Host stand-in for the flash backed EEPROM emulation. Contents live in
+// memory only and start out erased (0xFF) on every run.
+
+class EEPROMClass {
+public:
+  bool begin(size_t size);
+  void end();
+  uint8_t read(int address);
+  void write(int address, uint8_t value);
+  bool commit();
+  size_t length() { return size_; }
+
+  template <typename T>
+  T &get(int address, T &t) {
+    if (address >= 0 && address + sizeof(T) <= size_) {
+      memcpy((void *)&t, data_ + address, sizeof(T));
+    }
+    return t;
+  }
+
+  template <typename T>
+  const T &put(int address, const T &t) {
+    if (address >= 0 && address + sizeof(T) <= size_) {
+      memcpy(data_ + address, (const void *)&t, sizeof(T));
+    }
+    return t;
+  }
+
+private:
+  uint8_t *data_ = NULL;
+  size_t size_ = 0;
+};
+
+extern EEPROMClass EEPROM;
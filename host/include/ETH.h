@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Host stand-in for the Ethernet interface. The link is always up at
+// 100 Mbps full duplex; config() records the addresses it is given.
+
+class ETHClass {
+public:
+  bool config(IPAddress local_ip = INADDR_NONE, IPAddress gateway = INADDR_NONE, IPAddress subnet = INADDR_NONE,
+              IPAddress dns1 = INADDR_NONE, IPAddress dns2 = INADDR_NONE);
+  bool setHostname(const char *hostname);
+  const char *getHostname();
+  IPAddress localIP();
+  IPAddress gatewayIP();
+  IPAddress subnetMask();
+  IPAddress dnsIP(uint8_t index = 0);
+  String macAddress();
+  uint8_t linkSpeed() { return 100; }
+  bool fullDuplex() { return true; }
+  bool linkUp() { return true; }
+  bool connected() { return true; }
+  bool hasIP() { return true; }
+};
+
+extern ETHClass ETH;
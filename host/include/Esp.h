@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in for the ESP chip object
+
+class EspClass {
+public:
+  // Ends the host process; there is no bootloader to come back through
+  [[noreturn]] void restart();
+  uint32_t getHeapSize();
+  uint32_t getFreeHeap();
+  uint32_t getMinFreeHeap();
+  uint32_t getPsramSize();
+  uint32_t getFreePsram();
+  const char *getChipModel() { return "ESP32-S3 (host)"; }
+  uint8_t getChipCores() { return 2; }
+  uint32_t getCpuFreqMHz() { return 240; }
+};
+
+extern EspClass ESP;
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "WString.h"
+
+// Host stand-in for the UART console: everything goes to stdout
+
+class HardwareSerial {
+public:
+  void begin(unsigned long baud) {}
+  void end() {}
+  void setDebugOutput(bool enable) {}
+  void flush();
+  operator bool() const { return true; }
+
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buf, size_t len);
+  size_t print(const char *s);
+  size_t print(const String &s) { return print(s.c_str()); }
+  size_t print(char c);
+  size_t print(int value);
+  size_t print(unsigned int value);
+  size_t print(long value);
+  size_t print(unsigned long value);
+  size_t print(double value, int digits = 2);
+  size_t println();
+  template <typename T>
+  size_t println(const T &value) {
+    size_t n = print(value);
+    return n + println();
+  }
+  size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+extern HardwareSerial Serial;
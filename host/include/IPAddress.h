@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <netinet/in.h>
+#include "WString.h"
+
+// Host stand-in for the Arduino IPv4 address class
+
+class IPAddress {
+public:
+  IPAddress() : bytes_{0, 0, 0, 0} {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes_{a, b, c, d} {}
+  // Network byte order, like the lwIP/Arduino constructor
+  IPAddress(uint32_t address) {
+    bytes_[0] = address & 0xFF;
+    bytes_[1] = (address >> 8) & 0xFF;
+    bytes_[2] = (address >> 16) & 0xFF;
+    bytes_[3] = (address >> 24) & 0xFF;
+  }
+
+  bool fromString(const char *address) {
+    unsigned int a, b, c, d;
+    char end;
+    if (!address || sscanf(address, "%u.%u.%u.%u%c", &a, &b, &c, &d, &end) != 4 ||
+        a > 255 || b > 255 || c > 255 || d > 255) {
+      return false;
+    }
+    bytes_[0] = a;
+    bytes_[1] = b;
+    bytes_[2] = c;
+    bytes_[3] = d;
+    return true;
+  }
+  bool fromString(const String &address) { return fromString(address.c_str()); }
+
+  String toString() const {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", bytes_[0], bytes_[1], bytes_[2], bytes_[3]);
+    return String(buf);
+  }
+
+  uint8_t operator[](int index) const { return bytes_[index]; }
+  uint8_t &operator[](int index) { return bytes_[index]; }
+  bool operator==(const IPAddress &other) const {
+    return bytes_[0] == other.bytes_[0] && bytes_[1] == other.bytes_[1] &&
+           bytes_[2] == other.bytes_[2] && bytes_[3] == other.bytes_[3];
+  }
+  bool operator!=(const IPAddress &other) const { return !(*this == other); }
+
+private:
+  uint8_t bytes_[4];
+};
+
+// As in the Arduino core, INADDR_NONE is an IPAddress of 0.0.0.0
+#undef INADDR_NONE
+extern const IPAddress INADDR_NONE;
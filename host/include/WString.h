@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string>
+
+// Host stand-in for the Arduino String class, covering what the firmware uses
+
+class String {
+public:
+  String() {}
+  String(const char *s) : str_(s ? s : "") {}
+  String(const std::string &s) : str_(s) {}
+  String(char c) : str_(1, c) {}
+  String(int value) : str_(std::to_string(value)) {}
+  String(unsigned int value) : str_(std::to_string(value)) {}
+  String(long value) : str_(std::to_string(value)) {}
+  String(unsigned long value) : str_(std::to_string(value)) {}
+
+  const char *c_str() const { return str_.c_str(); }
+  unsigned int length() const { return str_.length(); }
+  bool isEmpty() const { return str_.empty(); }
+  long toInt() const { return atol(str_.c_str()); }
+  float toFloat() const { return atof(str_.c_str()); }
+  char operator[](unsigned int index) const { return index < str_.length() ? str_[index] : 0; }
+
+  int indexOf(char c, unsigned int from = 0) const {
+    size_t pos = str_.find(c, from);
+    return pos == std::string::npos ? -1 : (int)pos;
+  }
+  int indexOf(const String &s, unsigned int from = 0) const {
+    size_t pos = str_.find(s.str_, from);
+    return pos == std::string::npos ? -1 : (int)pos;
+  }
+  String substring(unsigned int from) const { return from < str_.length() ? String(str_.substr(from)) : String(); }
+  String substring(unsigned int from, unsigned int to) const {
+    return from < to && from < str_.length() ? String(str_.substr(from, to - from)) : String();
+  }
+
+  String &operator+=(const String &s) { str_ += s.str_; return *this; }
+  String &operator+=(const char *s) { str_ += s ? s : ""; return *this; }
+  String &operator+=(char c) { str_ += c; return *this; }
+  bool operator==(const String &s) const { return str_ == s.str_; }
+  bool operator==(const char *s) const { return str_ == (s ? s : ""); }
+  bool operator!=(const String &s) const { return str_ != s.str_; }
+
+  friend String operator+(const String &a, const String &b) { return String(a.str_ + b.str_); }
+  friend String operator+(const String &a, const char *b) { return String(a.str_ + (b ? b : "")); }
+  friend String operator+(const char *a, const String &b) { return String((a ? a : "") + b.str_); }
+
+private:
+  std::string str_;
+};
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Host stand-in for WiFi.h. The firmware only uses Ethernet; the header is
+// included for the shared network types.
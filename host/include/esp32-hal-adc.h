@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Host stand-in for the Arduino 3.x continuous ADC API. A thread plays the
+// DMA engine: it produces frames at the configured sampling rate, averages
+// conversions_per_pin conversions per pin into each one and calls userFunc
+// per frame. Pins read a slow, pin dependent sine wave.
+
+typedef struct {
+  uint8_t pin;
+  uint8_t channel;
+  int avg_read_raw;
+  int avg_read_mvolts;
+} adc_continuous_data_t;
+
+bool analogContinuous(const uint8_t pins[], size_t pins_count, uint32_t conversions_per_pin, uint32_t sampling_freq_hz,
+                      void (*userFunc)(void));
+bool analogContinuousRead(adc_continuous_data_t **buffer, uint32_t timeout_ms);
+bool analogContinuousStart();
+bool analogContinuousStop();
+bool analogContinuousDeinit();
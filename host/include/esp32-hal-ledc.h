@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in for the Arduino 3.x LEDC (PWM) API. Pins are attached with
+// ledcAttach() and addressed by pin number afterwards; the duty is only
+// recorded.
+
+bool ledcAttach(uint8_t pin, uint32_t freq, uint8_t resolution);
+bool ledcAttachChannel(uint8_t pin, uint32_t freq, uint8_t resolution, uint8_t channel);
+bool ledcWrite(uint8_t pin, uint32_t duty);
+uint32_t ledcRead(uint8_t pin);
+uint32_t ledcReadFreq(uint8_t pin);
+uint32_t ledcChangeFrequency(uint8_t pin, uint32_t freq, uint8_t resolution);
+bool ledcDetach(uint8_t pin);
+bool ledcFade(uint8_t pin, uint32_t start_duty, uint32_t target_duty, int max_fade_time_ms);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in for esp_timer: microseconds since the process started
+
+int64_t esp_timer_get_time();
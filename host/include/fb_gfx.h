@@ -0,0 +1,4 @@
+#pragma once
+
+// Host stand-in for fb_gfx. Only the face detection code draws into frame
+// buffers and it is not built on the host.
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Host stand-in for FreeRTOS on top of POSIX threads. Tasks are threads,
+// one tick is one millisecond, and a critical section is a recursive mutex
+// per portMUX_TYPE. Priorities and core affinity are accepted but ignored.
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint32_t StackType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+#define errQUEUE_EMPTY 0
+#define errQUEUE_FULL 0
+
+#define configTICK_RATE_HZ 1000
+#define configMAX_PRIORITIES 25
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define pdTICKS_TO_MS(ticks) ((uint32_t)(((uint64_t)(ticks) * 1000) / configTICK_RATE_HZ))
+
+#define tskIDLE_PRIORITY ((UBaseType_t)0)
+#define tskNO_AFFINITY ((BaseType_t)0x7FFFFFFF)
+
+typedef struct {
+  pthread_mutex_t mutex;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP}
+#define portMUX_INITIALIZE(mux)                                                 \
+  do {                                                                          \
+    pthread_mutexattr_t attr;                                                   \
+    pthread_mutexattr_init(&attr);                                              \
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);                  \
+    pthread_mutex_init(&(mux)->mutex, &attr);                                   \
+    pthread_mutexattr_destroy(&attr);                                           \
+  } while (0)
+
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(&(mux)->mutex)
+#define portEXIT_CRITICAL(mux) pthread_mutex_unlock(&(mux)->mutex)
+#define portENTER_CRITICAL_ISR(mux) portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux) portEXIT_CRITICAL(mux)
+#define portENTER_CRITICAL_SAFE(mux) portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_SAFE(mux) portEXIT_CRITICAL(mux)
+#define portYIELD() sched_yield()
+#define portYIELD_FROM_ISR(...) ((void)0)
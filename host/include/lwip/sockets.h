@@ -0,0 +1,41 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Host stand-in for the lwIP socket API: the lwip_ names map onto the POSIX
+// calls. Writes never raise SIGPIPE, matching lwIP.
+
+static inline ssize_t lwip_send(int s, const void *data, size_t size, int flags) {
+  return send(s, data, size, flags | MSG_NOSIGNAL);
+}
+
+static inline ssize_t lwip_sendmsg(int s, const struct msghdr *msg, int flags) {
+  return sendmsg(s, msg, flags | MSG_NOSIGNAL);
+}
+
+static inline ssize_t lwip_writev(int s, const struct iovec *iov, int iovcnt) {
+  struct msghdr msg = {};
+  msg.msg_iov = (struct iovec *)iov;
+  msg.msg_iovlen = iovcnt;
+  return sendmsg(s, &msg, MSG_NOSIGNAL);
+}
+
+static inline ssize_t lwip_recv(int s, void *mem, size_t len, int flags) {
+  return recv(s, mem, len, flags);
+}
+
+static inline int lwip_select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset,
+                              struct timeval *timeout) {
+  return select(maxfdp1, readset, writeset, exceptset, timeout);
+}
+
+static inline int lwip_close(int s) {
+  return close(s);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// Host build configuration. Only options the firmware sources test are
+// listed; CONFIG_HTTPD_WS_SUPPORT stays undefined.
+
+#define CONFIG_IDF_TARGET_ESP32S3 1
+#define CONFIG_HTTPD_MAX_REQ_HDR_LEN 1024
+#define CONFIG_HTTPD_MAX_URI_LEN 512
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in for the GPIO register block. Only the output set/clear and
+// input registers are modelled; each store or load is applied to all pins
+// of its bank at once, like the hardware does.
+
+struct host_gpio_w1x {
+  int bank;
+  bool set;
+  host_gpio_w1x &operator=(uint32_t bits);
+};
+
+struct host_gpio_in {
+  int bank;
+  operator uint32_t() const;
+};
+
+// GPIO 32-48 registers are unions with a .val member in the SoC headers
+struct host_gpio_w1x_union {
+  host_gpio_w1x val;
+};
+
+struct host_gpio_in_union {
+  host_gpio_in val;
+};
+
+typedef struct {
+  host_gpio_w1x out_w1ts{0, true};
+  host_gpio_w1x out_w1tc{0, false};
+  host_gpio_w1x_union out1_w1ts{{1, true}};
+  host_gpio_w1x_union out1_w1tc{{1, false}};
+  host_gpio_in in{0};
+  host_gpio_in_union in1{{1}};
+} gpio_dev_t;
+
+extern gpio_dev_t GPIO;
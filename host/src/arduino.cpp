@@ -0,0 +1,597 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "soc/gpio_struct.h"
+#include <ETH.h>
+#include "host.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+// Arduino core, ESP-IDF basics and board peripherals for the host build
+
+HardwareSerial Serial;
+EspClass ESP;
+EEPROMClass EEPROM;
+ETHClass ETH;
+const IPAddress INADDR_NONE(0, 0, 0, 0);
+
+static const auto start_time = std::chrono::steady_clock::now();
+
+int64_t esp_timer_get_time() {
+  auto elapsed = std::chrono::steady_clock::now() - start_time;
+  return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+  switch (code) {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_FAIL:
+    return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:
+    return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:
+    return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:
+    return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_INVALID_SIZE:
+    return "ESP_ERR_INVALID_SIZE";
+  case ESP_ERR_NOT_FOUND:
+    return "ESP_ERR_NOT_FOUND";
+  case ESP_ERR_NOT_SUPPORTED:
+    return "ESP_ERR_NOT_SUPPORTED";
+  case ESP_ERR_TIMEOUT:
+    return "ESP_ERR_TIMEOUT";
+  default:
+    return "UNKNOWN ERROR";
+  }
+}
+
+// Heap
+
+#define HOST_INTERNAL_HEAP_FREE (280 * 1024)
+#define HOST_PSRAM_FREE (8 * 1024 * 1024 - 512 * 1024)
+
+void *heap_caps_malloc(size_t size, uint32_t caps) {
+  return malloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+  return calloc(n, size);
+}
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps) {
+  return realloc(ptr, size);
+}
+
+void heap_caps_free(void *ptr) {
+  free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+  return (caps & MALLOC_CAP_SPIRAM) ? HOST_PSRAM_FREE : HOST_INTERNAL_HEAP_FREE;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+  return heap_caps_get_free_size(caps);
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+  return heap_caps_get_free_size(caps);
+}
+
+// Serial console
+
+void HardwareSerial::flush() {
+  fflush(stdout);
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t len) {
+  return fwrite(buf, 1, len, stdout);
+}
+
+size_t HardwareSerial::print(const char *s) {
+  return fputs(s, stdout) < 0 ? 0 : strlen(s);
+}
+
+size_t HardwareSerial::print(char c) {
+  return write((uint8_t)c);
+}
+
+size_t HardwareSerial::print(int value) {
+  return ::printf("%d", value);
+}
+
+size_t HardwareSerial::print(unsigned int value) {
+  return ::printf("%u", value);
+}
+
+size_t HardwareSerial::print(long value) {
+  return ::printf("%ld", value);
+}
+
+size_t HardwareSerial::print(unsigned long value) {
+  return ::printf("%lu", value);
+}
+
+size_t HardwareSerial::print(double value, int digits) {
+  return ::printf("%.*f", digits, value);
+}
+
+size_t HardwareSerial::println() {
+  size_t n = fwrite("\r\n", 1, 2, stdout);
+  fflush(stdout);
+  return n;
+}
+
+size_t HardwareSerial::printf(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int n = vprintf(fmt, args);
+  va_end(args);
+  fflush(stdout);
+  return n < 0 ? 0 : n;
+}
+
+// Chip
+
+void EspClass::restart() {
+  Serial.println("Restart requested, exiting");
+  fflush(stdout);
+  _exit(0);
+}
+
+uint32_t EspClass::getHeapSize() {
+  return 320 * 1024;
+}
+
+uint32_t EspClass::getFreeHeap() {
+  return heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+  return heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+}
+
+uint32_t EspClass::getPsramSize() {
+  return 8 * 1024 * 1024;
+}
+
+uint32_t EspClass::getFreePsram() {
+  return heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+}
+
+// Timing
+
+unsigned long millis() {
+  return esp_timer_get_time() / 1000;
+}
+
+unsigned long micros() {
+  return esp_timer_get_time();
+}
+
+void delay(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us) {
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+bool psramFound() {
+  return true;
+}
+
+// GPIO
+
+typedef struct {
+  uint8_t mode;
+  uint8_t level;
+  int interrupt_mode;
+  voidFuncPtrArg handler;
+  void *arg;
+  bool plain_handler;
+} host_pin_t;
+
+static host_pin_t host_pins[HOST_GPIO_COUNT];
+static std::mutex gpio_mutex;
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin >= HOST_GPIO_COUNT) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(gpio_mutex);
+  host_pins[pin].mode = mode;
+  if (mode & PULLUP) {
+    host_pins[pin].level = HIGH;
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  if (pin >= HOST_GPIO_COUNT) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(gpio_mutex);
+  host_pins[pin].level = val ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin) {
+  if (pin >= HOST_GPIO_COUNT) {
+    return LOW;
+  }
+  std::lock_guard<std::mutex> lock(gpio_mutex);
+  return host_pins[pin].level;
+}
+
+// A fixed, pin dependent reading keeps runs reproducible
+uint16_t analogRead(uint8_t pin) {
+  return (pin * 409 + 512) % 4096;
+}
+
+uint32_t analogReadMilliVolts(uint8_t pin) {
+  return analogRead(pin) * 3100 / 4095;
+}
+
+void analogReadResolution(uint8_t bits) {
+}
+
+// Continuous ADC
+
+#define HOST_ADC_MAX_PINS 10
+#define HOST_ADC_POOL_FRAMES 16   // Frames the DMA pool holds before dropping
+
+typedef struct {
+  adc_continuous_data_t values[HOST_ADC_MAX_PINS];
+} host_adc_frame_t;
+
+static std::mutex adc_mutex;
+static std::condition_variable adc_cond;
+static std::thread adc_thread;
+static bool adc_configured = false;
+static bool adc_running = false;
+static uint8_t adc_pins[HOST_ADC_MAX_PINS];
+static size_t adc_pin_count;
+static uint32_t adc_conversions;
+static uint32_t adc_freq;
+static void (*adc_user_func)(void);
+static std::deque<host_adc_frame_t> adc_pool;
+static host_adc_frame_t adc_result;
+
+static void host_adc_thread() {
+  auto period = std::chrono::nanoseconds(1000000000ULL * adc_conversions * adc_pin_count / adc_freq);
+  auto next = std::chrono::steady_clock::now() + period;
+  std::unique_lock<std::mutex> lock(adc_mutex);
+  while (adc_running) {
+    if (adc_cond.wait_until(lock, next, [] { return !adc_running; })) {
+      break;
+    }
+    next += period;
+
+    double t = esp_timer_get_time() / 1e6;
+    host_adc_frame_t frame;
+    for (size_t i = 0; i < adc_pin_count; i++) {
+      int raw = 2048 + (int)(1800 * sin(2 * M_PI * (adc_pins[i] + 1) * t));
+      frame.values[i] = {adc_pins[i], adc_pins[i], raw, (int)(raw * 3100 / 4095)};
+    }
+    if (adc_pool.size() < HOST_ADC_POOL_FRAMES) {
+      adc_pool.push_back(frame);
+    }
+    adc_cond.notify_all();
+
+    void (*user_func)(void) = adc_user_func;
+    lock.unlock();
+    if (user_func) {
+      user_func();
+    }
+    lock.lock();
+  }
+}
+
+bool analogContinuous(const uint8_t pins[], size_t pins_count, uint32_t conversions_per_pin, uint32_t sampling_freq_hz,
+                      void (*userFunc)(void)) {
+  std::lock_guard<std::mutex> lock(adc_mutex);
+  if (adc_configured || pins_count == 0 || pins_count > HOST_ADC_MAX_PINS || conversions_per_pin == 0 ||
+      sampling_freq_hz < 611 || sampling_freq_hz > 83333) {
+    return false;
+  }
+  memcpy(adc_pins, pins, pins_count);
+  adc_pin_count = pins_count;
+  adc_conversions = conversions_per_pin;
+  adc_freq = sampling_freq_hz;
+  adc_user_func = userFunc;
+  adc_configured = true;
+  return true;
+}
+
+bool analogContinuousStart() {
+  std::lock_guard<std::mutex> lock(adc_mutex);
+  if (!adc_configured || adc_running) {
+    return false;
+  }
+  adc_running = true;
+  adc_thread = std::thread(host_adc_thread);
+  return true;
+}
+
+bool analogContinuousStop() {
+  {
+    std::lock_guard<std::mutex> lock(adc_mutex);
+    if (!adc_running) {
+      return false;
+    }
+    adc_running = false;
+    adc_cond.notify_all();
+  }
+  adc_thread.join();
+  return true;
+}
+
+bool analogContinuousDeinit() {
+  analogContinuousStop();
+  std::lock_guard<std::mutex> lock(adc_mutex);
+  adc_configured = false;
+  adc_pool.clear();
+  return true;
+}
+
+bool analogContinuousRead(adc_continuous_data_t **buffer, uint32_t timeout_ms) {
+  std::unique_lock<std::mutex> lock(adc_mutex);
+  if (!adc_configured) {
+    return false;
+  }
+  if (!adc_cond.wait_for(lock, std::chrono::milliseconds(timeout_ms), [] { return !adc_pool.empty(); })) {
+    return false;
+  }
+  adc_result = adc_pool.front();
+  adc_pool.pop_front();
+  *buffer = adc_result.values;
+  return true;
+}
+
+void attachInterruptArg(uint8_t pin, voidFuncPtrArg handler, void *arg, int mode) {
+  if (pin >= HOST_GPIO_COUNT) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(gpio_mutex);
+  host_pins[pin].handler = handler;
+  host_pins[pin].arg = arg;
+  host_pins[pin].plain_handler = false;
+  host_pins[pin].interrupt_mode = mode;
+}
+
+void attachInterrupt(uint8_t pin, voidFuncPtr handler, int mode) {
+  attachInterruptArg(pin, (voidFuncPtrArg)handler, NULL, mode);
+  if (pin < HOST_GPIO_COUNT) {
+    std::lock_guard<std::mutex> lock(gpio_mutex);
+    host_pins[pin].plain_handler = true;
+  }
+}
+
+void detachInterrupt(uint8_t pin) {
+  attachInterruptArg(pin, NULL, NULL, 0);
+}
+
+void host_gpio_set_input(uint8_t pin, int level) {
+  if (pin >= HOST_GPIO_COUNT) {
+    return;
+  }
+  voidFuncPtrArg handler = NULL;
+  void *arg = NULL;
+  bool plain = false;
+  {
+    std::lock_guard<std::mutex> lock(gpio_mutex);
+    host_pin_t *p = &host_pins[pin];
+    int old = p->level;
+    p->level = level ? HIGH : LOW;
+    bool fire = (p->interrupt_mode == CHANGE && old != p->level) ||
+                (p->interrupt_mode == RISING && !old && p->level) ||
+                (p->interrupt_mode == FALLING && old && !p->level) ||
+                (p->interrupt_mode == ONHIGH && p->level) ||
+                (p->interrupt_mode == ONLOW && !p->level);
+    if (fire) {
+      handler = p->handler;
+      arg = p->arg;
+      plain = p->plain_handler;
+    }
+  }
+  if (handler) {
+    if (plain) {
+      ((voidFuncPtr)handler)();
+    } else {
+      handler(arg);
+    }
+  }
+}
+
+// GPIO register block
+
+gpio_dev_t GPIO;
+
+host_gpio_w1x &host_gpio_w1x::operator=(uint32_t bits) {
+  std::lock_guard<std::mutex> lock(gpio_mutex);
+  for (int i = 0; i < 32; i++) {
+    int pin = bank * 32 + i;
+    if ((bits & (1u << i)) && pin < HOST_GPIO_COUNT) {
+      host_pins[pin].level = set ? HIGH : LOW;
+    }
+  }
+  return *this;
+}
+
+host_gpio_in::operator uint32_t() const {
+  std::lock_guard<std::mutex> lock(gpio_mutex);
+  uint32_t bits = 0;
+  for (int i = 0; i < 32; i++) {
+    int pin = bank * 32 + i;
+    if (pin < HOST_GPIO_COUNT && host_pins[pin].level) {
+      bits |= 1u << i;
+    }
+  }
+  return bits;
+}
+
+// LEDC
+
+typedef struct {
+  bool attached;
+  uint32_t freq;
+  uint8_t resolution;
+  uint32_t duty;
+} host_ledc_t;
+
+static host_ledc_t host_ledc[HOST_GPIO_COUNT];
+
+bool ledcAttach(uint8_t pin, uint32_t freq, uint8_t resolution) {
+  if (pin >= HOST_GPIO_COUNT || resolution == 0 || resolution > 14) {
+    return false;
+  }
+  if (host_ledc[pin].attached) {
+    // The Arduino core refuses to attach a pin twice
+    fprintf(stderr, "[E] ledcAttachChannel(): Pin %u is already attached to LEDC\n", pin);
+    return false;
+  }
+  host_ledc[pin] = {true, freq, resolution, 0};
+  return true;
+}
+
+bool ledcAttachChannel(uint8_t pin, uint32_t freq, uint8_t resolution, uint8_t channel) {
+  return ledcAttach(pin, freq, resolution);
+}
+
+bool ledcWrite(uint8_t pin, uint32_t duty) {
+  if (pin >= HOST_GPIO_COUNT || !host_ledc[pin].attached) {
+    // Same complaint as the Arduino core
+    fprintf(stderr, "[E] ledcWrite(): Pin %u is not attached to LEDC\n", pin);
+    return false;
+  }
+  uint32_t max_duty = (1u << host_ledc[pin].resolution);
+  host_ledc[pin].duty = duty > max_duty ? max_duty : duty;
+  return true;
+}
+
+uint32_t ledcRead(uint8_t pin) {
+  return pin < HOST_GPIO_COUNT && host_ledc[pin].attached ? host_ledc[pin].duty : 0;
+}
+
+uint32_t ledcReadFreq(uint8_t pin) {
+  return pin < HOST_GPIO_COUNT && host_ledc[pin].attached ? host_ledc[pin].freq : 0;
+}
+
+uint32_t ledcChangeFrequency(uint8_t pin, uint32_t freq, uint8_t resolution) {
+  if (pin >= HOST_GPIO_COUNT || !host_ledc[pin].attached) {
+    return 0;
+  }
+  host_ledc[pin].freq = freq;
+  host_ledc[pin].resolution = resolution;
+  return freq;
+}
+
+bool ledcDetach(uint8_t pin) {
+  if (pin >= HOST_GPIO_COUNT || !host_ledc[pin].attached) {
+    return false;
+  }
+  host_ledc[pin].attached = false;
+  return true;
+}
+
+// Fades complete instantly on the host
+bool ledcFade(uint8_t pin, uint32_t start_duty, uint32_t target_duty, int max_fade_time_ms) {
+  return ledcWrite(pin, target_duty);
+}
+
+// EEPROM
+
+bool EEPROMClass::begin(size_t size) {
+  if (data_) {
+    return true;
+  }
+  data_ = (uint8_t *)malloc(size);
+  if (!data_) {
+    return false;
+  }
+  memset(data_, 0xFF, size);
+  size_ = size;
+  return true;
+}
+
+void EEPROMClass::end() {
+  free(data_);
+  data_ = NULL;
+  size_ = 0;
+}
+
+uint8_t EEPROMClass::read(int address) {
+  return address >= 0 && (size_t)address < size_ ? data_[address] : 0;
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+  if (address >= 0 && (size_t)address < size_) {
+    data_[address] = value;
+  }
+}
+
+bool EEPROMClass::commit() {
+  return data_ != NULL;
+}
+
+// Ethernet
+
+static IPAddress eth_ip(127, 0, 0, 1);
+static IPAddress eth_gateway(127, 0, 0, 1);
+static IPAddress eth_subnet(255, 0, 0, 0);
+static IPAddress eth_dns(127, 0, 0, 1);
+static char eth_hostname[32] = "esp32-ethernet";
+
+bool ETHClass::config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2) {
+  if (local_ip == INADDR_NONE) {
+    // DHCP: the host keeps answering on loopback
+    eth_ip = IPAddress(127, 0, 0, 1);
+    eth_gateway = IPAddress(127, 0, 0, 1);
+    eth_subnet = IPAddress(255, 0, 0, 0);
+    eth_dns = IPAddress(127, 0, 0, 1);
+  } else {
+    eth_ip = local_ip;
+    eth_gateway = gateway;
+    eth_subnet = subnet;
+    eth_dns = dns1;
+  }
+  return true;
+}
+
+bool ETHClass::setHostname(const char *hostname) {
+  strncpy(eth_hostname, hostname, sizeof(eth_hostname) - 1);
+  return true;
+}
+
+const char *ETHClass::getHostname() {
+  return eth_hostname;
+}
+
+IPAddress ETHClass::localIP() {
+  return eth_ip;
+}
+
+IPAddress ETHClass::gatewayIP() {
+  return eth_gateway;
+}
+
+IPAddress ETHClass::subnetMask() {
+  return eth_subnet;
+}
+
+IPAddress ETHClass::dnsIP(uint8_t index) {
+  return eth_dns;
+}
+
+String ETHClass::macAddress() {
+  return String("02:00:00:00:00:01");
+}
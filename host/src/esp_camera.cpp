@@ -0,0 +1,483 @@
+#include "esp_camera.h"
+#include "esp_timer.h"
+#include "host.h"
+#include "jpeg_encoder.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Camera driver stand-in. The sensor thread produces frames at a fixed
+// rate into a pool of fb_count buffers. With CAMERA_GRAB_LATEST only the
+// newest frame is kept ready, with CAMERA_GRAB_WHEN_EMPTY frames queue up
+// and new ones are dropped while every buffer is full, as in the driver.
+
+#define HOST_CAMERA_FB_TIMEOUT_MS 4000
+
+const resolution_info_t resolution[FRAMESIZE_INVALID] = {
+  {96, 96, ASPECT_RATIO_1X1},      {160, 120, ASPECT_RATIO_4X3},   {176, 144, ASPECT_RATIO_5X4},
+  {240, 176, ASPECT_RATIO_4X3},    {240, 240, ASPECT_RATIO_1X1},   {320, 240, ASPECT_RATIO_4X3},
+  {400, 296, ASPECT_RATIO_4X3},    {480, 320, ASPECT_RATIO_3X2},   {640, 480, ASPECT_RATIO_4X3},
+  {800, 600, ASPECT_RATIO_4X3},    {1024, 768, ASPECT_RATIO_4X3},  {1280, 720, ASPECT_RATIO_16X9},
+  {1280, 1024, ASPECT_RATIO_5X4},  {1600, 1200, ASPECT_RATIO_4X3}, {1920, 1080, ASPECT_RATIO_16X9},
+  {720, 1280, ASPECT_RATIO_9X16},  {864, 1536, ASPECT_RATIO_9X16}, {2048, 1536, ASPECT_RATIO_4X3},
+  {2560, 1440, ASPECT_RATIO_16X9}, {2560, 1600, ASPECT_RATIO_16X10}, {1080, 1920, ASPECT_RATIO_9X16},
+  {2560, 1920, ASPECT_RATIO_4X3},
+};
+
+enum fb_state { FB_FREE, FB_READY, FB_TAKEN };
+
+struct host_fb {
+  camera_fb_t fb;
+  std::vector<uint8_t> data;
+  fb_state state = FB_FREE;
+};
+
+static struct {
+  std::mutex lock;
+  std::condition_variable ready_cv;
+  std::vector<host_fb> pool;
+  std::deque<int> ready;
+  camera_grab_mode_t grab_mode;
+  std::thread thread;
+  std::atomic<bool> running{false};
+
+  std::string source_dir;
+  float fps = 25.0f;
+  std::vector<std::vector<uint8_t>> files;
+  std::map<int, int> regs;
+  // Output size of a raw window set with set_res_raw, 0 while the
+  // frame size comes from status.framesize
+  std::atomic<int> raw_width{0};
+  std::atomic<int> raw_height{0};
+} cam;
+
+static sensor_t host_sensor;
+
+// Sensor controls only record their value, the frame source reads them
+static int sensor_set_pixformat(sensor_t *s, pixformat_t pixformat) {
+  if (pixformat != PIXFORMAT_JPEG && pixformat != PIXFORMAT_RGB565 && pixformat != PIXFORMAT_GRAYSCALE) {
+    return -1;
+  }
+  s->pixformat = pixformat;
+  return 0;
+}
+
+static int sensor_set_framesize(sensor_t *s, framesize_t framesize) {
+  if (framesize > FRAMESIZE_UXGA) {
+    return -1;
+  }
+  s->status.framesize = framesize;
+  cam.raw_width = 0;
+  cam.raw_height = 0;
+  return 0;
+}
+
+#define SENSOR_SETTER(name, field)                 \
+  static int sensor_set_##name(sensor_t *s, int v) { \
+    s->status.field = v;                           \
+    return 0;                                      \
+  }
+
+SENSOR_SETTER(contrast, contrast)
+SENSOR_SETTER(brightness, brightness)
+SENSOR_SETTER(saturation, saturation)
+SENSOR_SETTER(denoise, denoise)
+SENSOR_SETTER(colorbar, colorbar)
+SENSOR_SETTER(whitebal, awb)
+SENSOR_SETTER(gain_ctrl, agc)
+SENSOR_SETTER(exposure_ctrl, aec)
+SENSOR_SETTER(hmirror, hmirror)
+SENSOR_SETTER(vflip, vflip)
+SENSOR_SETTER(aec2, aec2)
+SENSOR_SETTER(awb_gain, awb_gain)
+SENSOR_SETTER(agc_gain, agc_gain)
+SENSOR_SETTER(aec_value, aec_value)
+SENSOR_SETTER(special_effect, special_effect)
+SENSOR_SETTER(wb_mode, wb_mode)
+SENSOR_SETTER(ae_level, ae_level)
+SENSOR_SETTER(dcw, dcw)
+SENSOR_SETTER(bpc, bpc)
+SENSOR_SETTER(wpc, wpc)
+SENSOR_SETTER(raw_gma, raw_gma)
+SENSOR_SETTER(lenc, lenc)
+
+// The OV2640 driver has no sharpness control and fails the call
+static int sensor_set_sharpness(sensor_t *s, int level) {
+  return -1;
+}
+
+static int sensor_set_quality(sensor_t *s, int quality) {
+  if (quality < 0 || quality > 63) {
+    return -1;
+  }
+  s->status.quality = quality;
+  return 0;
+}
+
+static int sensor_set_gainceiling(sensor_t *s, gainceiling_t gainceiling) {
+  s->status.gainceiling = gainceiling;
+  return 0;
+}
+
+static int sensor_get_reg(sensor_t *s, int reg, int mask) {
+  std::lock_guard<std::mutex> guard(cam.lock);
+  auto it = cam.regs.find(reg);
+  return (it == cam.regs.end() ? 0 : it->second) & mask;
+}
+
+static int sensor_set_reg(sensor_t *s, int reg, int mask, int value) {
+  std::lock_guard<std::mutex> guard(cam.lock);
+  int &current = cam.regs[reg];
+  current = (current & ~mask) | (value & mask);
+  return 0;
+}
+
+static int sensor_set_res_raw(sensor_t *s, int startX, int startY, int endX, int endY, int offsetX, int offsetY,
+                              int totalX, int totalY, int outputX, int outputY, bool scale, bool binning) {
+  if (outputX <= 0 || outputY <= 0 || outputX > 1600 || outputY > 1200) {
+    return -1;
+  }
+  cam.raw_width = outputX;
+  cam.raw_height = outputY;
+  return 0;
+}
+
+static int sensor_set_pll(sensor_t *s, int bypass, int mul, int sys, int root, int pre, int seld5, int pclken,
+                          int pclk) {
+  return 0;
+}
+
+static int sensor_set_xclk(sensor_t *s, int timer, int xclk) {
+  s->xclk_freq_hz = xclk * 1000000;
+  return 0;
+}
+
+static void sensor_setup(const camera_config_t *config) {
+  sensor_t *s = &host_sensor;
+  memset(s, 0, sizeof(*s));
+  s->id.PID = OV2640_PID;
+  s->id.MIDH = 0x7F;
+  s->id.MIDL = 0xA2;
+  s->slv_addr = 0x30;
+  s->xclk_freq_hz = config->xclk_freq_hz;
+  s->pixformat = config->pixel_format;
+  s->status.framesize = config->frame_size;
+  s->status.quality = config->jpeg_quality;
+  s->status.awb = 1;
+  s->status.awb_gain = 1;
+  s->status.aec = 1;
+  s->status.agc = 1;
+  s->status.bpc = 0;
+  s->status.wpc = 1;
+  s->status.raw_gma = 1;
+  s->status.lenc = 1;
+  s->status.dcw = 1;
+  s->status.aec_value = 300;
+
+  s->set_pixformat = sensor_set_pixformat;
+  s->set_framesize = sensor_set_framesize;
+  s->set_contrast = sensor_set_contrast;
+  s->set_brightness = sensor_set_brightness;
+  s->set_saturation = sensor_set_saturation;
+  s->set_sharpness = sensor_set_sharpness;
+  s->set_denoise = sensor_set_denoise;
+  s->set_gainceiling = sensor_set_gainceiling;
+  s->set_quality = sensor_set_quality;
+  s->set_colorbar = sensor_set_colorbar;
+  s->set_whitebal = sensor_set_whitebal;
+  s->set_gain_ctrl = sensor_set_gain_ctrl;
+  s->set_exposure_ctrl = sensor_set_exposure_ctrl;
+  s->set_hmirror = sensor_set_hmirror;
+  s->set_vflip = sensor_set_vflip;
+  s->set_aec2 = sensor_set_aec2;
+  s->set_awb_gain = sensor_set_awb_gain;
+  s->set_agc_gain = sensor_set_agc_gain;
+  s->set_aec_value = sensor_set_aec_value;
+  s->set_special_effect = sensor_set_special_effect;
+  s->set_wb_mode = sensor_set_wb_mode;
+  s->set_ae_level = sensor_set_ae_level;
+  s->set_dcw = sensor_set_dcw;
+  s->set_bpc = sensor_set_bpc;
+  s->set_wpc = sensor_set_wpc;
+  s->set_raw_gma = sensor_set_raw_gma;
+  s->set_lenc = sensor_set_lenc;
+  s->get_reg = sensor_get_reg;
+  s->set_reg = sensor_set_reg;
+  s->set_res_raw = sensor_set_res_raw;
+  s->set_pll = sensor_set_pll;
+  s->set_xclk = sensor_set_xclk;
+}
+
+// Width and height from the SOF marker of a JPEG file
+static bool jpeg_size(const std::vector<uint8_t> &jpeg, size_t *width, size_t *height) {
+  size_t i = 2;
+  while (i + 9 < jpeg.size()) {
+    if (jpeg[i] != 0xFF) {
+      return false;
+    }
+    uint8_t marker = jpeg[i + 1];
+    size_t len = (jpeg[i + 2] << 8) | jpeg[i + 3];
+    if (marker >= 0xC0 && marker <= 0xC3) {
+      *height = (jpeg[i + 5] << 8) | jpeg[i + 6];
+      *width = (jpeg[i + 7] << 8) | jpeg[i + 8];
+      return true;
+    }
+    i += 2 + len;
+  }
+  return false;
+}
+
+static void load_frames(const std::string &dir) {
+  DIR *d = opendir(dir.c_str());
+  if (!d) {
+    fprintf(stderr, "camera: cannot open %s, using the test pattern\n", dir.c_str());
+    return;
+  }
+  std::vector<std::string> names;
+  while (struct dirent *entry = readdir(d)) {
+    std::string name = entry->d_name;
+    std::string lower = name;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    if (lower.size() > 4 && (lower.rfind(".jpg") == lower.size() - 4 || lower.rfind(".jpeg") == lower.size() - 5)) {
+      names.push_back(name);
+    }
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+
+  for (auto &name : names) {
+    FILE *f = fopen((dir + "/" + name).c_str(), "rb");
+    if (!f) {
+      continue;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+      data.insert(data.end(), buf, buf + n);
+    }
+    fclose(f);
+    size_t w, h;
+    if (data.size() > 4 && data[0] == 0xFF && data[1] == 0xD8 && jpeg_size(data, &w, &h)) {
+      cam.files.push_back(std::move(data));
+    }
+  }
+  fprintf(stderr, "camera: replaying %u frames from %s\n", (unsigned)cam.files.size(), dir.c_str());
+}
+
+// Colour bars, or a gradient with a bar that moves one step per frame
+static void render_pattern(const camera_status_t &st, uint32_t frame, int width, int height,
+                           std::vector<uint8_t> &rgb) {
+  static const uint8_t bars[8][3] = {
+    {255, 255, 255}, {255, 255, 0}, {0, 255, 255}, {0, 255, 0},
+    {255, 0, 255},   {255, 0, 0},   {0, 0, 255},   {0, 0, 0},
+  };
+  rgb.resize((size_t)width * height * 3);
+  int bar_x = (frame * 4) % width;
+  int bar_w = width / 16 + 1;
+  int offset = st.brightness * 24;
+
+  for (int y = 0; y < height; y++) {
+    int sy = st.vflip ? height - 1 - y : y;
+    uint8_t *p = &rgb[(size_t)y * width * 3];
+    for (int x = 0; x < width; x++, p += 3) {
+      int sx = st.hmirror ? width - 1 - x : x;
+      int c[3];
+      if (st.colorbar) {
+        const uint8_t *bar = bars[sx * 8 / width];
+        c[0] = bar[0];
+        c[1] = bar[1];
+        c[2] = bar[2];
+      } else if (sx >= bar_x && sx < bar_x + bar_w) {
+        c[0] = c[1] = c[2] = 240;
+      } else {
+        c[0] = sx * 255 / width;
+        c[1] = sy * 255 / height;
+        c[2] = 128 + (sy < height / 8 ? 64 : 0);
+      }
+      for (int k = 0; k < 3; k++) {
+        int v = c[k] + offset;
+        p[k] = v < 0 ? 0 : (v > 255 ? 255 : v);
+      }
+    }
+  }
+}
+
+// Fill one buffer with the next frame. Runs without the pool lock.
+static void produce(host_fb &slot, uint32_t frame) {
+  sensor_t *s = &host_sensor;
+  camera_status_t st = s->status;
+  pixformat_t format = s->pixformat;
+
+  if (!cam.files.empty()) {
+    const std::vector<uint8_t> &file = cam.files[frame % cam.files.size()];
+    slot.data = file;
+    jpeg_size(file, &slot.fb.width, &slot.fb.height);
+    slot.fb.format = PIXFORMAT_JPEG;
+  } else {
+    int width = cam.raw_width ? cam.raw_width.load() : resolution[st.framesize].width;
+    int height = cam.raw_height ? cam.raw_height.load() : resolution[st.framesize].height;
+    std::vector<uint8_t> rgb;
+    render_pattern(st, frame, width, height, rgb);
+    slot.fb.width = width;
+    slot.fb.height = height;
+    slot.fb.format = format;
+
+    if (format == PIXFORMAT_JPEG) {
+      // OV2640 quality 0-63, lower is better; map onto the IJG scale
+      int quality = 100 - (int)(st.quality * 1.4f);
+      jpeg_encode_rgb888(rgb.data(), width, height, quality < 1 ? 1 : quality, 2, 1, slot.data);
+    } else if (format == PIXFORMAT_GRAYSCALE) {
+      slot.data.resize((size_t)width * height);
+      for (size_t i = 0; i < slot.data.size(); i++) {
+        slot.data[i] = (rgb[i * 3] * 77 + rgb[i * 3 + 1] * 150 + rgb[i * 3 + 2] * 29) >> 8;
+      }
+    } else {
+      slot.data.resize((size_t)width * height * 2);
+      for (size_t i = 0; i < (size_t)width * height; i++) {
+        uint16_t p = ((rgb[i * 3] >> 3) << 11) | ((rgb[i * 3 + 1] >> 2) << 5) | (rgb[i * 3 + 2] >> 3);
+        slot.data[i * 2] = p >> 8;
+        slot.data[i * 2 + 1] = p & 0xFF;
+      }
+    }
+  }
+  slot.fb.buf = slot.data.data();
+  slot.fb.len = slot.data.size();
+  // The driver stamps frames with esp_timer time, not the wall clock
+  int64_t now = esp_timer_get_time();
+  slot.fb.timestamp.tv_sec = now / 1000000;
+  slot.fb.timestamp.tv_usec = now % 1000000;
+}
+
+static void sensor_thread() {
+  auto period = std::chrono::microseconds((int64_t)(1000000 / cam.fps));
+  auto next = std::chrono::steady_clock::now();
+  uint32_t frame = 0;
+
+  while (cam.running) {
+    next += period;
+    std::this_thread::sleep_until(next);
+
+    // Pick a free buffer; in GRAB_LATEST mode an unclaimed frame is recycled
+    int index = -1;
+    {
+      std::lock_guard<std::mutex> guard(cam.lock);
+      for (size_t i = 0; i < cam.pool.size(); i++) {
+        if (cam.pool[i].state == FB_FREE) {
+          index = i;
+          break;
+        }
+      }
+      if (index < 0 && cam.grab_mode == CAMERA_GRAB_LATEST && !cam.ready.empty()) {
+        index = cam.ready.front();
+        cam.ready.pop_front();
+      }
+      if (index < 0) {
+        // Every buffer is queued or held, this frame is dropped
+        frame++;
+        continue;
+      }
+      cam.pool[index].state = FB_TAKEN;
+    }
+
+    produce(cam.pool[index], frame++);
+
+    {
+      std::lock_guard<std::mutex> guard(cam.lock);
+      if (cam.grab_mode == CAMERA_GRAB_LATEST) {
+        while (!cam.ready.empty()) {
+          cam.pool[cam.ready.front()].state = FB_FREE;
+          cam.ready.pop_front();
+        }
+      }
+      cam.pool[index].state = FB_READY;
+      cam.ready.push_back(index);
+    }
+    cam.ready_cv.notify_one();
+  }
+}
+
+void host_camera_source(const char *dir, float fps) {
+  cam.source_dir = dir ? dir : "";
+  if (fps > 0) {
+    cam.fps = fps;
+  }
+}
+
+esp_err_t esp_camera_init(const camera_config_t *config) {
+  if (cam.running) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  sensor_setup(config);
+  cam.grab_mode = config->grab_mode;
+  cam.pool = std::vector<host_fb>(config->fb_count ? config->fb_count : 1);
+  cam.ready.clear();
+  cam.files.clear();
+  if (!cam.source_dir.empty()) {
+    load_frames(cam.source_dir);
+  }
+  cam.running = true;
+  cam.thread = std::thread(sensor_thread);
+  return ESP_OK;
+}
+
+esp_err_t esp_camera_deinit() {
+  if (!cam.running) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  cam.running = false;
+  cam.thread.join();
+  std::lock_guard<std::mutex> guard(cam.lock);
+  cam.pool.clear();
+  cam.ready.clear();
+  return ESP_OK;
+}
+
+camera_fb_t *esp_camera_fb_get() {
+  std::unique_lock<std::mutex> guard(cam.lock);
+  if (!cam.ready_cv.wait_for(guard, std::chrono::milliseconds(HOST_CAMERA_FB_TIMEOUT_MS),
+                             [] { return !cam.ready.empty() || !cam.running; }) ||
+      cam.ready.empty()) {
+    fprintf(stderr, "[E] esp_camera_fb_get(): Failed to get the frame on time!\n");
+    return NULL;
+  }
+  int index = cam.ready.front();
+  cam.ready.pop_front();
+  cam.pool[index].state = FB_TAKEN;
+  return &cam.pool[index].fb;
+}
+
+void esp_camera_fb_return(camera_fb_t *fb) {
+  std::lock_guard<std::mutex> guard(cam.lock);
+  for (auto &slot : cam.pool) {
+    if (&slot.fb == fb) {
+      slot.state = FB_FREE;
+      return;
+    }
+  }
+}
+
+sensor_t *esp_camera_sensor_get() {
+  return cam.running ? &host_sensor : NULL;
+}
+
+void esp_camera_return_all() {
+  std::lock_guard<std::mutex> guard(cam.lock);
+  for (auto &slot : cam.pool) {
+    if (slot.state == FB_TAKEN) {
+      slot.state = FB_FREE;
+    }
+  }
+}
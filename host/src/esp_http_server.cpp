@@ -0,0 +1,787 @@
+#include "esp_http_server.h"
+#include "host.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// esp_http_server on POSIX sockets. One thread per server owns the listen
+// socket and every session; handlers run on it one at a time like on the
+// device. Async requests take their session out of the select set until
+// they complete, and other threads only touch the server through the
+// mutex-protected close and work queues.
+
+typedef std::vector<std::pair<std::string, std::string>> host_headers_t;
+
+struct host_session {
+  int fd;
+  bool async = false;
+  bool closing = false;
+  std::string inbuf;
+};
+
+struct host_server {
+  httpd_config_t config;
+  std::vector<httpd_uri_t> handlers;
+  int listen_fd = -1;
+  int wake[2] = {-1, -1};
+  std::thread thread;
+  std::mutex lock;
+  std::map<int, host_session *> sessions;
+  std::deque<std::pair<httpd_work_fn_t, void *>> work;
+  bool stop = false;
+};
+
+// Request state behind req->aux
+struct host_req_aux {
+  host_server *server;
+  host_session *session;  // NULL for detached async copies
+  int fd;
+  std::string query;
+  host_headers_t headers;
+  size_t body_left;
+
+  std::string status = "200 OK";
+  std::string type = "text/html";
+  host_headers_t resp_headers;
+  bool chunked = false;
+};
+
+static const struct {
+  const char *status;
+  const char *msg;
+} httpd_errors[HTTPD_ERR_CODE_MAX] = {
+  {"500 Internal Server Error", "Server has encountered an unexpected error"},
+  {"501 Method Not Implemented", "Request method is not supported by server"},
+  {"505 Version Not Supported", "HTTP version not supported by server"},
+  {"400 Bad Request", "Bad request syntax"},
+  {"401 Unauthorized", "No permission -- see authorization schemes"},
+  {"403 Forbidden", "Request forbidden -- authorization will not help"},
+  {"404 Not Found", "Nothing matches the given URI"},
+  {"405 Method Not Allowed", "Specified method is invalid for this resource"},
+  {"408 Request Timeout", "Server closed this connection"},
+  {"411 Length Required", "Client must specify Content-Length"},
+  {"414 URI Too Long", "URI is too long"},
+  {"431 Request Header Fields Too Large", "Header fields are too long"},
+};
+
+static void server_wake(host_server *server) {
+  char c = 0;
+  if (write(server->wake[1], &c, 1) < 0) {
+    // Pipe full, the loop is awake anyway
+  }
+}
+
+static int send_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t sent = send(fd, buf, len, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+    }
+    buf += sent;
+    len -= sent;
+  }
+  return 0;
+}
+
+static host_req_aux *req_aux(httpd_req_t *r) {
+  return r ? (host_req_aux *)r->aux : NULL;
+}
+
+static esp_err_t send_head(host_req_aux *aux, const char *length_hdr) {
+  std::string head = "HTTP/1.1 " + aux->status + "\r\nContent-Type: " + aux->type + "\r\n" + length_hdr;
+  for (auto &h : aux->resp_headers) {
+    head += h.first + ": " + h.second + "\r\n";
+  }
+  head += "\r\n";
+  return send_all(aux->fd, head.data(), head.size()) == 0 ? ESP_OK : ESP_ERR_HTTPD_RESP_SEND;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status) {
+  host_req_aux *aux = req_aux(r);
+  if (!aux || !status) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  aux->status = status;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type) {
+  host_req_aux *aux = req_aux(r);
+  if (!aux || !type) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  aux->type = type;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value) {
+  host_req_aux *aux = req_aux(r);
+  if (!aux || !field || !value) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (aux->resp_headers.size() >= aux->server->config.max_resp_headers) {
+    return ESP_ERR_HTTPD_RESP_HDR;
+  }
+  aux->resp_headers.emplace_back(field, value);
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len) {
+  host_req_aux *aux = req_aux(r);
+  if (!aux) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (buf_len == HTTPD_RESP_USE_STRLEN) {
+    buf_len = buf ? strlen(buf) : 0;
+  }
+  char length_hdr[48];
+  snprintf(length_hdr, sizeof(length_hdr), "Content-Length: %d\r\n", (int)buf_len);
+  if (send_head(aux, length_hdr) != ESP_OK) {
+    return ESP_ERR_HTTPD_RESP_SEND;
+  }
+  if (buf_len > 0 && send_all(aux->fd, buf, buf_len) != 0) {
+    return ESP_ERR_HTTPD_RESP_SEND;
+  }
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len) {
+  host_req_aux *aux = req_aux(r);
+  if (!aux) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (buf_len == HTTPD_RESP_USE_STRLEN) {
+    buf_len = buf ? strlen(buf) : 0;
+  }
+  if (!aux->chunked) {
+    if (send_head(aux, "Transfer-Encoding: chunked\r\n") != ESP_OK) {
+      return ESP_ERR_HTTPD_RESP_SEND;
+    }
+    aux->chunked = true;
+  }
+  char size[16];
+  int size_len = snprintf(size, sizeof(size), "%x\r\n", (unsigned)buf_len);
+  if (send_all(aux->fd, size, size_len) != 0 ||
+      (buf_len > 0 && send_all(aux->fd, buf, buf_len) != 0) ||
+      send_all(aux->fd, "\r\n", 2) != 0) {
+    return ESP_ERR_HTTPD_RESP_SEND;
+  }
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_sendstr(httpd_req_t *r, const char *str) {
+  return httpd_resp_send(r, str, str ? HTTPD_RESP_USE_STRLEN : 0);
+}
+
+esp_err_t httpd_resp_sendstr_chunk(httpd_req_t *r, const char *str) {
+  return httpd_resp_send_chunk(r, str, str ? HTTPD_RESP_USE_STRLEN : 0);
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *r, httpd_err_code_t error, const char *msg) {
+  host_req_aux *aux = req_aux(r);
+  if (!aux || error < 0 || error >= HTTPD_ERR_CODE_MAX) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  aux->status = httpd_errors[error].status;
+  aux->type = "text/html";
+  return httpd_resp_send(r, msg ? msg : httpd_errors[error].msg, HTTPD_RESP_USE_STRLEN);
+}
+
+esp_err_t httpd_resp_send_404(httpd_req_t *r) {
+  return httpd_resp_send_err(r, HTTPD_404_NOT_FOUND, NULL);
+}
+
+esp_err_t httpd_resp_send_408(httpd_req_t *r) {
+  return httpd_resp_send_err(r, HTTPD_408_REQ_TIMEOUT, NULL);
+}
+
+esp_err_t httpd_resp_send_500(httpd_req_t *r) {
+  return httpd_resp_send_err(r, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len) {
+  host_req_aux *aux = req_aux(r);
+  if (!aux || !aux->session) {
+    return HTTPD_SOCK_ERR_INVALID;
+  }
+  if (buf_len > aux->body_left) {
+    buf_len = aux->body_left;
+  }
+  if (buf_len == 0) {
+    return 0;
+  }
+
+  // Bytes that arrived with the header first
+  std::string &inbuf = aux->session->inbuf;
+  if (!inbuf.empty()) {
+    size_t n = inbuf.size() < buf_len ? inbuf.size() : buf_len;
+    memcpy(buf, inbuf.data(), n);
+    inbuf.erase(0, n);
+    aux->body_left -= n;
+    return n;
+  }
+
+  ssize_t n;
+  do {
+    n = recv(aux->fd, buf, buf_len, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+  }
+  if (n == 0) {
+    return HTTPD_SOCK_ERR_FAIL;
+  }
+  aux->body_left -= n;
+  return n;
+}
+
+size_t httpd_req_get_url_query_len(httpd_req_t *r) {
+  host_req_aux *aux = req_aux(r);
+  return aux ? aux->query.size() : 0;
+}
+
+static esp_err_t copy_trunc(const std::string &src, char *buf, size_t buf_len) {
+  if (!buf || buf_len == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  size_t n = src.size() < buf_len - 1 ? src.size() : buf_len - 1;
+  memcpy(buf, src.data(), n);
+  buf[n] = '\0';
+  return n < src.size() ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len) {
+  host_req_aux *aux = req_aux(r);
+  if (!aux) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (aux->query.empty()) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  return copy_trunc(aux->query, buf, buf_len);
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size) {
+  if (!qry || !key || !val) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  size_t key_len = strlen(key);
+  const char *p = qry;
+  while (*p) {
+    const char *end = strchr(p, '&');
+    if (!end) {
+      end = p + strlen(p);
+    }
+    const char *eq = (const char *)memchr(p, '=', end - p);
+    if (eq && (size_t)(eq - p) == key_len && strncmp(p, key, key_len) == 0) {
+      return copy_trunc(std::string(eq + 1, end), val, val_size);
+    }
+    p = *end ? end + 1 : end;
+  }
+  return ESP_ERR_NOT_FOUND;
+}
+
+static const std::string *find_header(host_req_aux *aux, const char *field) {
+  for (auto &h : aux->headers) {
+    if (strcasecmp(h.first.c_str(), field) == 0) {
+      return &h.second;
+    }
+  }
+  return NULL;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field) {
+  host_req_aux *aux = req_aux(r);
+  const std::string *value = aux && field ? find_header(aux, field) : NULL;
+  return value ? value->size() : 0;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size) {
+  host_req_aux *aux = req_aux(r);
+  if (!aux || !field) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  const std::string *value = find_header(aux, field);
+  if (!value) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  return copy_trunc(*value, val, val_size);
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r) {
+  host_req_aux *aux = req_aux(r);
+  return aux ? aux->fd : -1;
+}
+
+static httpd_req_t *req_new(host_req_aux *aux) {
+  // uri is a const array, so the request is allocated as raw memory
+  httpd_req_t *r = (httpd_req_t *)calloc(1, sizeof(httpd_req_t));
+  r->aux = aux;
+  return r;
+}
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *r, httpd_req_t **out) {
+  host_req_aux *aux = req_aux(r);
+  if (!aux || !aux->session || !out) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  host_req_aux *copy = new host_req_aux(*aux);
+  copy->session = NULL;
+  // Copy-construct in place, the const uri rules out assignment
+  httpd_req_t *async = new (req_new(copy)) httpd_req_t(*r);
+  async->aux = copy;
+
+  std::lock_guard<std::mutex> guard(aux->server->lock);
+  aux->session->async = true;
+  *out = async;
+  return ESP_OK;
+}
+
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *r) {
+  host_req_aux *aux = req_aux(r);
+  if (!aux) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  host_server *server = aux->server;
+  {
+    std::lock_guard<std::mutex> guard(server->lock);
+    auto it = server->sessions.find(aux->fd);
+    if (it != server->sessions.end()) {
+      it->second->async = false;
+    }
+  }
+  server_wake(server);
+  delete aux;
+  free(r);
+  return ESP_OK;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd) {
+  host_server *server = (host_server *)handle;
+  {
+    std::lock_guard<std::mutex> guard(server->lock);
+    auto it = server->sessions.find(sockfd);
+    if (it == server->sessions.end()) {
+      return ESP_ERR_NOT_FOUND;
+    }
+    it->second->closing = true;
+  }
+  server_wake(server);
+  return ESP_OK;
+}
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void *arg) {
+  host_server *server = (host_server *)handle;
+  if (!server || !work) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  {
+    std::lock_guard<std::mutex> guard(server->lock);
+    server->work.emplace_back(work, arg);
+  }
+  server_wake(server);
+  return ESP_OK;
+}
+
+bool httpd_uri_match_wildcard(const char *tpl, const char *uri, size_t len) {
+  size_t tpl_len = strlen(tpl);
+  size_t exact = tpl_len;
+  bool question = false, asterisk = false;
+
+  if (tpl_len && tpl[tpl_len - 1] == '?') {
+    question = true;
+    exact--;
+  } else if (tpl_len && tpl[tpl_len - 1] == '*') {
+    asterisk = true;
+    exact--;
+    if (exact && tpl[exact - 1] == '?') {
+      question = true;
+      exact--;
+    }
+  }
+  if (len == exact) {
+    return strncmp(tpl, uri, len) == 0;
+  }
+  if (asterisk && len >= exact) {
+    // "/path/*" matches "/path/anything", "/path?*" also "/path"
+    return strncmp(tpl, uri, exact) == 0;
+  }
+  if (question && len + 1 == exact) {
+    return strncmp(tpl, uri, len) == 0;
+  }
+  return false;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler) {
+  host_server *server = (host_server *)handle;
+  if (!server || !uri_handler || !uri_handler->uri) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  for (auto &h : server->handlers) {
+    if (h.method == uri_handler->method && strcmp(h.uri, uri_handler->uri) == 0) {
+      return ESP_ERR_HTTPD_HANDLER_EXISTS;
+    }
+  }
+  if (server->handlers.size() >= server->config.max_uri_handlers) {
+    return ESP_ERR_HTTPD_HANDLERS_FULL;
+  }
+  httpd_uri_t h = *uri_handler;
+  h.uri = strdup(uri_handler->uri);
+  server->handlers.push_back(h);
+  return ESP_OK;
+}
+
+esp_err_t httpd_unregister_uri_handler(httpd_handle_t handle, const char *uri, httpd_method_t method) {
+  host_server *server = (host_server *)handle;
+  if (!server || !uri) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  for (auto it = server->handlers.begin(); it != server->handlers.end(); ++it) {
+    if (it->method == method && strcmp(it->uri, uri) == 0) {
+      free((void *)it->uri);
+      server->handlers.erase(it);
+      return ESP_OK;
+    }
+  }
+  return ESP_ERR_NOT_FOUND;
+}
+
+static int parse_method(const std::string &m) {
+  static const struct {
+    const char *name;
+    int method;
+  } methods[] = {
+    {"DELETE", HTTP_DELETE}, {"GET", HTTP_GET}, {"HEAD", HTTP_HEAD}, {"POST", HTTP_POST},
+    {"PUT", HTTP_PUT}, {"CONNECT", HTTP_CONNECT}, {"OPTIONS", HTTP_OPTIONS}, {"TRACE", HTTP_TRACE},
+    {"PATCH", HTTP_PATCH},
+  };
+  for (auto &entry : methods) {
+    if (m == entry.name) {
+      return entry.method;
+    }
+  }
+  return -1;
+}
+
+// Whether the session was handed to an async request or is being closed
+static bool session_detached(host_server *server, host_session *session) {
+  std::lock_guard<std::mutex> guard(server->lock);
+  return session->async || session->closing;
+}
+
+// Send an error straight to a session that has no parsed request
+static void session_send_err(host_server *server, host_session *session, httpd_err_code_t error) {
+  host_req_aux aux;
+  aux.server = server;
+  aux.session = session;
+  aux.fd = session->fd;
+  aux.body_left = 0;
+  httpd_req_t *r = req_new(&aux);
+  httpd_resp_send_err(r, error, NULL);
+  free(r);
+}
+
+// Parse and dispatch one complete request from the front of inbuf.
+// Returns false when the session has to be closed.
+static bool session_handle(host_server *server, host_session *session, size_t header_end) {
+  std::string header = session->inbuf.substr(0, header_end);
+  session->inbuf.erase(0, header_end + 4);
+
+  size_t line_end = header.find("\r\n");
+  std::string request_line = header.substr(0, line_end);
+  size_t sp1 = request_line.find(' ');
+  size_t sp2 = request_line.rfind(' ');
+  if (sp1 == std::string::npos || sp2 == sp1) {
+    session_send_err(server, session, HTTPD_400_BAD_REQUEST);
+    return false;
+  }
+  int method = parse_method(request_line.substr(0, sp1));
+  std::string uri = request_line.substr(sp1 + 1, sp2 - sp1 - 1);
+  if (method < 0) {
+    session_send_err(server, session, HTTPD_501_METHOD_NOT_IMPLEMENTED);
+    return false;
+  }
+  if (uri.size() > HTTPD_MAX_URI_LEN) {
+    session_send_err(server, session, HTTPD_414_URI_TOO_LONG);
+    return false;
+  }
+
+  host_req_aux *aux = new host_req_aux();
+  aux->server = server;
+  aux->session = session;
+  aux->fd = session->fd;
+  size_t pos = line_end == std::string::npos ? header.size() : line_end + 2;
+  while (pos < header.size()) {
+    size_t end = header.find("\r\n", pos);
+    if (end == std::string::npos) {
+      end = header.size();
+    }
+    size_t colon = header.find(':', pos);
+    if (colon != std::string::npos && colon < end) {
+      size_t value = header.find_first_not_of(" \t", colon + 1);
+      if (value == std::string::npos || value > end) {
+        value = end;
+      }
+      aux->headers.emplace_back(header.substr(pos, colon - pos), header.substr(value, end - value));
+    }
+    pos = end + 2;
+  }
+
+  size_t path_len = uri.find('?');
+  if (path_len != std::string::npos) {
+    aux->query = uri.substr(path_len + 1);
+  } else {
+    path_len = uri.size();
+  }
+  const std::string *length = find_header(aux, "Content-Length");
+  aux->body_left = length ? strtoul(length->c_str(), NULL, 10) : 0;
+
+  httpd_req_t *r = req_new(aux);
+  r->handle = server;
+  r->method = method;
+  memcpy((char *)r->uri, uri.c_str(), uri.size() + 1);
+  r->content_len = aux->body_left;
+
+  const httpd_uri_t *handler = NULL;
+  bool path_found = false;
+  for (auto &h : server->handlers) {
+    bool match = server->config.uri_match_fn
+                     ? server->config.uri_match_fn(h.uri, r->uri, path_len)
+                     : strlen(h.uri) == path_len && strncmp(h.uri, r->uri, path_len) == 0;
+    if (match) {
+      path_found = true;
+      if (h.method == method || (int)h.method == HTTP_ANY) {
+        handler = &h;
+        break;
+      }
+    }
+  }
+
+  bool keep = true;
+  if (!handler) {
+    if (path_found) {
+      httpd_resp_send_err(r, HTTPD_405_METHOD_NOT_ALLOWED, "Request method for this URI is not handled by server");
+    } else {
+      httpd_resp_send_err(r, HTTPD_404_NOT_FOUND, "This URI does not exist");
+    }
+    keep = false;
+  } else {
+    r->user_ctx = handler->user_ctx;
+    if (handler->handler(r) != ESP_OK) {
+      keep = false;
+    }
+  }
+
+  if (keep && !session_detached(server, session)) {
+    // Drop whatever part of the body the handler did not read
+    char discard[512];
+    while (aux->body_left > 0 && httpd_req_recv(r, discard, sizeof(discard)) > 0) {
+    }
+    keep = aux->body_left == 0;
+  }
+  delete aux;
+  free(r);
+  return keep;
+}
+
+static void session_close(host_server *server, host_session *session) {
+  {
+    std::lock_guard<std::mutex> guard(server->lock);
+    server->sessions.erase(session->fd);
+  }
+  close(session->fd);
+  delete session;
+}
+
+// Read from a session and serve every complete request in its buffer
+static void session_read(host_server *server, host_session *session) {
+  char buf[1460];
+  ssize_t n = recv(session->fd, buf, sizeof(buf), 0);
+  if (n <= 0) {
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+      return;
+    }
+    session_close(server, session);
+    return;
+  }
+  session->inbuf.append(buf, n);
+
+  while (!session_detached(server, session)) {
+    size_t header_end = session->inbuf.find("\r\n\r\n");
+    if (header_end == std::string::npos) {
+      if (session->inbuf.size() > HTTPD_MAX_REQ_HDR_LEN) {
+        session_send_err(server, session, HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE);
+        session_close(server, session);
+      }
+      return;
+    }
+    if (header_end > HTTPD_MAX_REQ_HDR_LEN) {
+      session_send_err(server, session, HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE);
+      session_close(server, session);
+      return;
+    }
+    if (!session_handle(server, session, header_end)) {
+      session_close(server, session);
+      return;
+    }
+  }
+}
+
+static void server_loop(host_server *server) {
+  while (true) {
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(server->listen_fd, &readable);
+    FD_SET(server->wake[0], &readable);
+    int max_fd = server->listen_fd > server->wake[0] ? server->listen_fd : server->wake[0];
+
+    std::vector<host_session *> closing;
+    std::deque<std::pair<httpd_work_fn_t, void *>> work;
+    {
+      std::lock_guard<std::mutex> guard(server->lock);
+      if (server->stop) {
+        break;
+      }
+      work.swap(server->work);
+      for (auto &entry : server->sessions) {
+        host_session *session = entry.second;
+        if (session->closing && !session->async) {
+          closing.push_back(session);
+        } else if (!session->async) {
+          FD_SET(session->fd, &readable);
+          if (session->fd > max_fd) {
+            max_fd = session->fd;
+          }
+        }
+      }
+    }
+    for (auto &w : work) {
+      w.first(w.second);
+    }
+    for (host_session *session : closing) {
+      session_close(server, session);
+    }
+    if (!closing.empty() || !work.empty()) {
+      continue;
+    }
+
+    if (select(max_fd + 1, &readable, NULL, NULL, NULL) < 0) {
+      continue;
+    }
+
+    if (FD_ISSET(server->wake[0], &readable)) {
+      char drain[64];
+      while (read(server->wake[0], drain, sizeof(drain)) == (ssize_t)sizeof(drain)) {
+      }
+    }
+
+    if (FD_ISSET(server->listen_fd, &readable)) {
+      int fd = accept(server->listen_fd, NULL, NULL);
+      if (fd >= 0) {
+        std::lock_guard<std::mutex> guard(server->lock);
+        if (server->sessions.size() >= server->config.max_open_sockets) {
+          close(fd);
+        } else {
+          struct timeval rcv = {server->config.recv_wait_timeout, 0};
+          struct timeval snd = {server->config.send_wait_timeout, 0};
+          setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &rcv, sizeof(rcv));
+          setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &snd, sizeof(snd));
+          host_session *session = new host_session();
+          session->fd = fd;
+          server->sessions[fd] = session;
+        }
+      }
+    }
+
+    std::vector<host_session *> ready;
+    {
+      std::lock_guard<std::mutex> guard(server->lock);
+      for (auto &entry : server->sessions) {
+        if (FD_ISSET(entry.first, &readable) && !entry.second->async && !entry.second->closing) {
+          ready.push_back(entry.second);
+        }
+      }
+    }
+    for (host_session *session : ready) {
+      session_read(server, session);
+    }
+  }
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config) {
+  if (!handle || !config) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  host_server *server = new host_server();
+  server->config = *config;
+
+  int port = config->server_port + host_port_offset;
+  server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (server->listen_fd < 0 || bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(server->listen_fd, config->backlog_conn) != 0 || pipe(server->wake) != 0) {
+    fprintf(stderr, "httpd_start: cannot listen on port %d: %s\n", port, strerror(errno));
+    if (server->listen_fd >= 0) {
+      close(server->listen_fd);
+    }
+    delete server;
+    return ESP_ERR_HTTPD_TASK;
+  }
+  fcntl(server->wake[0], F_SETFL, O_NONBLOCK);
+  fcntl(server->wake[1], F_SETFL, O_NONBLOCK);
+
+  server->thread = std::thread(server_loop, server);
+  *handle = server;
+  return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle) {
+  host_server *server = (host_server *)handle;
+  if (!server) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  {
+    std::lock_guard<std::mutex> guard(server->lock);
+    server->stop = true;
+  }
+  server_wake(server);
+  server->thread.join();
+  for (auto &entry : server->sessions) {
+    close(entry.first);
+    delete entry.second;
+  }
+  for (auto &h : server->handlers) {
+    free((void *)h.uri);
+  }
+  close(server->listen_fd);
+  close(server->wake[0]);
+  close(server->wake[1]);
+  delete server;
+  return ESP_OK;
+}
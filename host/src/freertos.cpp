@@ -0,0 +1,359 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <string.h>
+
+// FreeRTOS on POSIX threads. Every task, including threads that were not
+// created through xTaskCreate (main, httpd servers), gets a host_task the
+// first time it asks for its handle, so notifications work everywhere.
+
+struct host_task {
+  std::string name;
+  TaskFunction_t fn;
+  void *arg;
+  uint32_t stack_depth;
+  std::mutex mutex;
+  std::condition_variable cv;
+  uint32_t notify_value;
+  bool notify_pending;
+};
+
+static thread_local host_task *current_task = NULL;
+static const auto start_time = std::chrono::steady_clock::now();
+
+// Deadline for a wait of 'ticks', or none for portMAX_DELAY
+static bool wait_deadline(TickType_t ticks, std::chrono::steady_clock::time_point *deadline) {
+  if (ticks == portMAX_DELAY) {
+    return false;
+  }
+  *deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(pdTICKS_TO_MS(ticks));
+  return true;
+}
+
+// Wait on cv until pred holds or the timeout passes. Returns pred().
+template <typename Pred>
+static bool wait_for(std::condition_variable &cv, std::unique_lock<std::mutex> &lock, TickType_t ticks, Pred pred) {
+  std::chrono::steady_clock::time_point deadline;
+  if (!wait_deadline(ticks, &deadline)) {
+    cv.wait(lock, pred);
+    return true;
+  }
+  return cv.wait_until(lock, deadline, pred);
+}
+
+static void task_entry(host_task *task) {
+  current_task = task;
+  pthread_setname_np(pthread_self(), task->name.substr(0, 15).c_str());
+  task->fn(task->arg);
+  // A FreeRTOS task must never return; treat it like vTaskDelete(NULL)
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id) {
+  host_task *task = new host_task();
+  task->name = name ? name : "";
+  task->fn = fn;
+  task->arg = arg;
+  task->stack_depth = stack_depth;
+  task->notify_value = 0;
+  task->notify_pending = false;
+  if (handle) {
+    *handle = task;
+  }
+  std::thread(task_entry, task).detach();
+  return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle) {
+  return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  // Only self deletion is supported; the handle stays valid for late notifiers
+  if (task == NULL || task == current_task) {
+    pthread_exit(NULL);
+  }
+}
+
+void vTaskDelay(TickType_t ticks) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(pdTICKS_TO_MS(ticks)));
+}
+
+TickType_t xTaskGetTickCount() {
+  auto elapsed = std::chrono::steady_clock::now() - start_time;
+  return (TickType_t)(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() *
+                      configTICK_RATE_HZ / 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  if (!current_task) {
+    host_task *task = new host_task();
+    char name[16] = {0};
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    task->name = name;
+    task->fn = NULL;
+    task->arg = NULL;
+    task->stack_depth = 0;
+    task->notify_value = 0;
+    task->notify_pending = false;
+    current_task = task;
+  }
+  return current_task;
+}
+
+const char *pcTaskGetName(TaskHandle_t task) {
+  if (!task) {
+    task = xTaskGetCurrentTaskHandle();
+  }
+  return task->name.c_str();
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+  if (!task) {
+    task = xTaskGetCurrentTaskHandle();
+  }
+  return task->stack_depth;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+  BaseType_t res = pdPASS;
+  {
+    std::lock_guard<std::mutex> lock(task->mutex);
+    switch (action) {
+    case eSetBits:
+      task->notify_value |= value;
+      break;
+    case eIncrement:
+      task->notify_value++;
+      break;
+    case eSetValueWithOverwrite:
+      task->notify_value = value;
+      break;
+    case eSetValueWithoutOverwrite:
+      if (task->notify_pending) {
+        res = pdFAIL;
+      } else {
+        task->notify_value = value;
+      }
+      break;
+    case eNoAction:
+      break;
+    }
+    task->notify_pending = true;
+  }
+  task->cv.notify_all();
+  return res;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action,
+                              BaseType_t *higher_priority_woken) {
+  if (higher_priority_woken) {
+    *higher_priority_woken = pdFALSE;
+  }
+  return xTaskNotify(task, value, action);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  return xTaskNotify(task, 0, eIncrement);
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_woken) {
+  xTaskNotifyFromISR(task, 0, eIncrement, higher_priority_woken);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t timeout) {
+  host_task *task = xTaskGetCurrentTaskHandle();
+  std::unique_lock<std::mutex> lock(task->mutex);
+  wait_for(task->cv, lock, timeout, [task] { return task->notify_value != 0; });
+  uint32_t value = task->notify_value;
+  if (value) {
+    task->notify_value = clear_on_exit ? 0 : value - 1;
+  }
+  task->notify_pending = false;
+  return value;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t timeout) {
+  host_task *task = xTaskGetCurrentTaskHandle();
+  std::unique_lock<std::mutex> lock(task->mutex);
+  if (!task->notify_pending) {
+    task->notify_value &= ~clear_on_entry;
+  }
+  bool notified = wait_for(task->cv, lock, timeout, [task] { return task->notify_pending; });
+  if (value) {
+    *value = task->notify_value;
+  }
+  if (notified) {
+    task->notify_value &= ~clear_on_exit;
+    task->notify_pending = false;
+  }
+  return notified ? pdTRUE : pdFALSE;
+}
+
+// Queues
+
+struct host_queue {
+  UBaseType_t length;
+  UBaseType_t item_size;
+  std::deque<std::vector<uint8_t>> items;
+  std::mutex mutex;
+  std::condition_variable cv;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  host_queue *queue = new host_queue();
+  queue->length = length;
+  queue->item_size = item_size;
+  return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+  delete queue;
+}
+
+static BaseType_t queue_put(QueueHandle_t queue, const void *item, TickType_t timeout, bool front) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!wait_for(queue->cv, lock, timeout, [queue] { return queue->items.size() < queue->length; })) {
+    return errQUEUE_FULL;
+  }
+  const uint8_t *bytes = (const uint8_t *)item;
+  std::vector<uint8_t> copy(bytes, bytes + queue->item_size);
+  if (front) {
+    queue->items.push_front(std::move(copy));
+  } else {
+    queue->items.push_back(std::move(copy));
+  }
+  queue->cv.notify_all();
+  return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t timeout) {
+  return queue_put(queue, item, timeout, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t timeout) {
+  return queue_put(queue, item, timeout, true);
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higher_priority_woken) {
+  if (higher_priority_woken) {
+    *higher_priority_woken = pdFALSE;
+  }
+  return queue_put(queue, item, 0, false);
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void *item) {
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  const uint8_t *bytes = (const uint8_t *)item;
+  queue->items.clear();
+  queue->items.emplace_back(bytes, bytes + queue->item_size);
+  queue->cv.notify_all();
+  return pdPASS;
+}
+
+static BaseType_t queue_get(QueueHandle_t queue, void *item, TickType_t timeout, bool remove) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!wait_for(queue->cv, lock, timeout, [queue] { return !queue->items.empty(); })) {
+    return errQUEUE_EMPTY;
+  }
+  memcpy(item, queue->items.front().data(), queue->item_size);
+  if (remove) {
+    queue->items.pop_front();
+    queue->cv.notify_all();
+  }
+  return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t timeout) {
+  return queue_get(queue, item, timeout, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t timeout) {
+  return queue_get(queue, item, timeout, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  return queue->items.size();
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  return queue->length - queue->items.size();
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  queue->items.clear();
+  queue->cv.notify_all();
+  return pdPASS;
+}
+
+// Semaphores
+
+struct host_semaphore {
+  UBaseType_t count;
+  UBaseType_t max_count;
+  std::mutex mutex;
+  std::condition_variable cv;
+};
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count) {
+  host_semaphore *sem = new host_semaphore();
+  sem->count = initial_count;
+  sem->max_count = max_count;
+  return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return xSemaphoreCreateCounting(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return xSemaphoreCreateCounting(1, 0);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+  delete sem;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t timeout) {
+  std::unique_lock<std::mutex> lock(sem->mutex);
+  if (!wait_for(sem->cv, lock, timeout, [sem] { return sem->count > 0; })) {
+    return pdFALSE;
+  }
+  sem->count--;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  std::lock_guard<std::mutex> lock(sem->mutex);
+  if (sem->count >= sem->max_count) {
+    return pdFALSE;
+  }
+  sem->count++;
+  sem->cv.notify_one();
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *higher_priority_woken) {
+  if (higher_priority_woken) {
+    *higher_priority_woken = pdFALSE;
+  }
+  return xSemaphoreGive(sem);
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t sem) {
+  std::lock_guard<std::mutex> lock(sem->mutex);
+  return sem->count;
+}
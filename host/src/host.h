@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+// Settings and hooks of the host build that have no firmware counterpart
+
+// Added to every httpd server_port, so port 80/81 become e.g. 8080/8081
+extern int host_port_offset;
+
+// Frame source for the camera stand-in: a directory of JPEG files replayed
+// in name order, or the generated test pattern when dir is NULL
+void host_camera_source(const char *dir, float fps);
+
+// Drive a GPIO input from outside, firing its interrupt on a matching edge
+void host_gpio_set_input(uint8_t pin, int level);
@@ -0,0 +1,135 @@
+#include "img_converters.h"
+#include "jpeg_encoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// Image converters of esp32-camera on top of the host JPEG encoder
+
+static uint8_t clamp8(int v) {
+  return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+bool fmt2rgb888(const uint8_t *src, size_t src_len, pixformat_t format, uint8_t *rgb) {
+  switch (format) {
+  case PIXFORMAT_RGB888:
+    memcpy(rgb, src, src_len);
+    return true;
+  case PIXFORMAT_RGB565:
+    // Big endian pixels, as the sensor sends them
+    for (size_t i = 0; i + 1 < src_len; i += 2) {
+      uint16_t p = (src[i] << 8) | src[i + 1];
+      *rgb++ = ((p >> 11) & 0x1F) << 3;
+      *rgb++ = ((p >> 5) & 0x3F) << 2;
+      *rgb++ = (p & 0x1F) << 3;
+    }
+    return true;
+  case PIXFORMAT_GRAYSCALE:
+    for (size_t i = 0; i < src_len; i++) {
+      *rgb++ = src[i];
+      *rgb++ = src[i];
+      *rgb++ = src[i];
+    }
+    return true;
+  case PIXFORMAT_YUV422:
+    // YUYV: two pixels share one U and one V sample
+    for (size_t i = 0; i + 3 < src_len; i += 4) {
+      int u = src[i + 1] - 128, v = src[i + 3] - 128;
+      for (int k = 0; k < 2; k++) {
+        int y = src[i + k * 2];
+        *rgb++ = clamp8(y + (int)(1.402f * v));
+        *rgb++ = clamp8(y - (int)(0.344136f * u + 0.714136f * v));
+        *rgb++ = clamp8(y + (int)(1.772f * u));
+      }
+    }
+    return true;
+  default:
+    // No JPEG decoder on the host
+    return false;
+  }
+}
+
+bool fmt2jpg(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format,
+             uint8_t quality, uint8_t **out, size_t *out_len) {
+  if (format == PIXFORMAT_JPEG) {
+    return false;
+  }
+  std::vector<uint8_t> rgb((size_t)width * height * 3);
+  if (!fmt2rgb888(src, src_len, format, rgb.data())) {
+    return false;
+  }
+  std::vector<uint8_t> jpeg;
+  if (!jpeg_encode_rgb888(rgb.data(), width, height, quality, 2, 2, jpeg)) {
+    return false;
+  }
+  *out = (uint8_t *)malloc(jpeg.size());
+  if (!*out) {
+    return false;
+  }
+  memcpy(*out, jpeg.data(), jpeg.size());
+  *out_len = jpeg.size();
+  return true;
+}
+
+bool frame2jpg(camera_fb_t *fb, uint8_t quality, uint8_t **out, size_t *out_len) {
+  return fmt2jpg(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, out, out_len);
+}
+
+bool fmt2jpg_cb(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format,
+                uint8_t quality, jpg_out_cb cb, void *arg) {
+  uint8_t *jpeg = NULL;
+  size_t jpeg_len = 0;
+  if (!fmt2jpg(src, src_len, width, height, format, quality, &jpeg, &jpeg_len)) {
+    return false;
+  }
+  // Hand the image over in chunks like the streaming encoder does
+  const size_t chunk = 1024;
+  bool ok = true;
+  for (size_t index = 0; index < jpeg_len && ok; index += chunk) {
+    size_t len = jpeg_len - index < chunk ? jpeg_len - index : chunk;
+    ok = cb(arg, index, jpeg + index, len) == len;
+  }
+  free(jpeg);
+  return ok;
+}
+
+bool frame2jpg_cb(camera_fb_t *fb, uint8_t quality, jpg_out_cb cb, void *arg) {
+  return fmt2jpg_cb(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, cb, arg);
+}
+
+bool fmt2bmp(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format,
+             uint8_t **out, size_t *out_len) {
+  std::vector<uint8_t> rgb((size_t)width * height * 3);
+  if (!fmt2rgb888(src, src_len, format, rgb.data())) {
+    return false;
+  }
+
+  size_t row = ((size_t)width * 3 + 3) & ~(size_t)3;
+  size_t size = 54 + row * height;
+  uint8_t *bmp = (uint8_t *)calloc(1, size);
+  if (!bmp) {
+    return false;
+  }
+  uint32_t header[] = {(uint32_t)size, 0, 54, 40, width, (uint32_t)-(int32_t)height, 1 | (24 << 16), 0,
+                       (uint32_t)(row * height), 2835, 2835, 0, 0};
+  bmp[0] = 'B';
+  bmp[1] = 'M';
+  memcpy(bmp + 2, header, sizeof(header));
+  for (size_t y = 0; y < height; y++) {
+    uint8_t *dst = bmp + 54 + y * row;
+    const uint8_t *p = rgb.data() + y * width * 3;
+    for (size_t x = 0; x < width; x++, p += 3) {
+      *dst++ = p[2];
+      *dst++ = p[1];
+      *dst++ = p[0];
+    }
+  }
+  *out = bmp;
+  *out_len = size;
+  return true;
+}
+
+bool frame2bmp(camera_fb_t *fb, uint8_t **out, size_t *out_len) {
+  return fmt2bmp(fb->buf, fb->len, fb->width, fb->height, fb->format, out, out_len);
+}
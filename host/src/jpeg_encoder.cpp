@@ -0,0 +1,363 @@
+#include "jpeg_encoder.h"
+
+#include <math.h>
+#include <string.h>
+
+// Baseline sequential JPEG with the standard quantisation and Huffman
+// tables of ITU T.81 Annex K, a float AAN forward DCT and no restart
+// markers. Good enough to stand in for the sensor's hardware encoder.
+
+static const uint8_t zigzag[64] = {
+  0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+static const uint8_t luma_quant[64] = {
+  16, 11, 10, 16, 24, 40, 51, 61,
+  12, 12, 14, 19, 26, 58, 60, 55,
+  14, 13, 16, 24, 40, 57, 69, 56,
+  14, 17, 22, 29, 51, 87, 80, 62,
+  18, 22, 37, 56, 68, 109, 103, 77,
+  24, 35, 55, 64, 81, 104, 113, 92,
+  49, 64, 78, 87, 103, 121, 120, 101,
+  72, 92, 95, 98, 112, 100, 103, 99,
+};
+
+static const uint8_t chroma_quant[64] = {
+  17, 18, 24, 47, 99, 99, 99, 99,
+  18, 21, 26, 66, 99, 99, 99, 99,
+  24, 26, 56, 99, 99, 99, 99, 99,
+  47, 66, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,
+};
+
+static const uint8_t dc_luma_bits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t dc_chroma_bits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t dc_vals[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const uint8_t ac_luma_bits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const uint8_t ac_luma_vals[162] = {
+  0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+  0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+  0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+  0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+  0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+  0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+  0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+  0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+  0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+  0xf9, 0xfa,
+};
+
+static const uint8_t ac_chroma_bits[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t ac_chroma_vals[162] = {
+  0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+  0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+  0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+  0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+  0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+  0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+  0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+  0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+  0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+  0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+  0xf9, 0xfa,
+};
+
+// AAN output scale factors, folded into the quantiser
+static const float aan_scale[8] = {
+  1.0f, 1.387039845f, 1.306562965f, 1.175875602f, 1.0f, 0.785694958f, 0.541196100f, 0.275899379f,
+};
+
+typedef struct {
+  uint16_t code[256];
+  uint8_t size[256];
+} huff_table_t;
+
+typedef struct {
+  std::vector<uint8_t> *out;
+  uint32_t bits;
+  int nbits;
+} bit_writer_t;
+
+static void build_huffman(const uint8_t *bits, const uint8_t *vals, huff_table_t *table) {
+  uint16_t code = 0;
+  int k = 0;
+  memset(table, 0, sizeof(*table));
+  for (int len = 1; len <= 16; len++) {
+    for (int i = 0; i < bits[len - 1]; i++) {
+      table->code[vals[k]] = code++;
+      table->size[vals[k]] = len;
+      k++;
+    }
+    code <<= 1;
+  }
+}
+
+static void put_bits(bit_writer_t *w, uint32_t value, int count) {
+  w->bits = (w->bits << count) | (value & ((1u << count) - 1));
+  w->nbits += count;
+  while (w->nbits >= 8) {
+    uint8_t byte = (w->bits >> (w->nbits - 8)) & 0xFF;
+    w->out->push_back(byte);
+    if (byte == 0xFF) {
+      w->out->push_back(0x00);
+    }
+    w->nbits -= 8;
+  }
+}
+
+static void flush_bits(bit_writer_t *w) {
+  if (w->nbits > 0) {
+    put_bits(w, 0x7F, 8 - w->nbits);
+  }
+}
+
+static void put_u16(std::vector<uint8_t> &out, uint16_t v) {
+  out.push_back(v >> 8);
+  out.push_back(v & 0xFF);
+}
+
+static void scale_quant(const uint8_t *base, int quality, uint8_t *table) {
+  int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+  for (int i = 0; i < 64; i++) {
+    int q = (base[i] * scale + 50) / 100;
+    table[i] = q < 1 ? 1 : (q > 255 ? 255 : q);
+  }
+}
+
+static void write_dht(std::vector<uint8_t> &out, int cls_id, const uint8_t *bits, const uint8_t *vals) {
+  int count = 0;
+  for (int i = 0; i < 16; i++) {
+    count += bits[i];
+  }
+  out.push_back(0xFF);
+  out.push_back(0xC4);
+  put_u16(out, 2 + 1 + 16 + count);
+  out.push_back(cls_id);
+  out.insert(out.end(), bits, bits + 16);
+  out.insert(out.end(), vals, vals + count);
+}
+
+static void fdct(float *d) {
+  for (int pass = 0; pass < 2; pass++) {
+    // Rows first, then columns
+    int step = pass ? 8 : 1;
+    int next = pass ? 1 : 8;
+    for (int i = 0; i < 8; i++) {
+      float *p = d + i * next;
+      float t0 = p[0 * step] + p[7 * step];
+      float t7 = p[0 * step] - p[7 * step];
+      float t1 = p[1 * step] + p[6 * step];
+      float t6 = p[1 * step] - p[6 * step];
+      float t2 = p[2 * step] + p[5 * step];
+      float t5 = p[2 * step] - p[5 * step];
+      float t3 = p[3 * step] + p[4 * step];
+      float t4 = p[3 * step] - p[4 * step];
+
+      float t10 = t0 + t3;
+      float t13 = t0 - t3;
+      float t11 = t1 + t2;
+      float t12 = t1 - t2;
+      p[0 * step] = t10 + t11;
+      p[4 * step] = t10 - t11;
+      float z1 = (t12 + t13) * 0.707106781f;
+      p[2 * step] = t13 + z1;
+      p[6 * step] = t13 - z1;
+
+      t10 = t4 + t5;
+      t11 = t5 + t6;
+      t12 = t6 + t7;
+      float z5 = (t10 - t12) * 0.382683433f;
+      float z2 = 0.541196100f * t10 + z5;
+      float z4 = 1.306562965f * t12 + z5;
+      float z3 = t11 * 0.707106781f;
+      float z11 = t7 + z3;
+      float z13 = t7 - z3;
+      p[5 * step] = z13 + z2;
+      p[3 * step] = z13 - z2;
+      p[1 * step] = z11 + z4;
+      p[7 * step] = z11 - z4;
+    }
+  }
+}
+
+static int bit_length(int v) {
+  int n = 0;
+  for (v = v < 0 ? -v : v; v; v >>= 1) {
+    n++;
+  }
+  return n;
+}
+
+// Transform, quantise and entropy code one 8x8 block of level shifted samples
+static void encode_block(bit_writer_t *w, float *block, const float *divisors, int *prev_dc,
+                         const huff_table_t *dc, const huff_table_t *ac) {
+  int q[64];
+  fdct(block);
+  for (int i = 0; i < 64; i++) {
+    int n = zigzag[i];
+    q[i] = (int)lroundf(block[n] / divisors[n]);
+  }
+
+  int diff = q[0] - *prev_dc;
+  *prev_dc = q[0];
+  int size = bit_length(diff);
+  put_bits(w, dc->code[size], dc->size[size]);
+  if (size) {
+    put_bits(w, diff < 0 ? diff - 1 : diff, size);
+  }
+
+  int run = 0;
+  for (int i = 1; i < 64; i++) {
+    if (!q[i]) {
+      run++;
+      continue;
+    }
+    while (run > 15) {
+      put_bits(w, ac->code[0xF0], ac->size[0xF0]);
+      run -= 16;
+    }
+    size = bit_length(q[i]);
+    int symbol = (run << 4) | size;
+    put_bits(w, ac->code[symbol], ac->size[symbol]);
+    put_bits(w, q[i] < 0 ? q[i] - 1 : q[i], size);
+    run = 0;
+  }
+  if (run) {
+    put_bits(w, ac->code[0x00], ac->size[0x00]);
+  }
+}
+
+bool jpeg_encode_rgb888(const uint8_t *rgb, int width, int height, int quality, int h_samp, int v_samp,
+                        std::vector<uint8_t> &out) {
+  if (!rgb || width <= 0 || height <= 0 || width > 65535 || height > 65535 ||
+      h_samp < 1 || h_samp > 2 || v_samp < 1 || v_samp > 2) {
+    return false;
+  }
+  quality = quality < 1 ? 1 : (quality > 100 ? 100 : quality);
+
+  uint8_t qt_luma[64], qt_chroma[64];
+  scale_quant(luma_quant, quality, qt_luma);
+  scale_quant(chroma_quant, quality, qt_chroma);
+  float div_luma[64], div_chroma[64];
+  for (int i = 0; i < 64; i++) {
+    float s = aan_scale[i / 8] * aan_scale[i % 8] * 8.0f;
+    div_luma[i] = qt_luma[i] * s;
+    div_chroma[i] = qt_chroma[i] * s;
+  }
+
+  static huff_table_t dc_luma, dc_chroma, ac_luma, ac_chroma;
+  // Built once, thread safe through static initialisation
+  static const bool tables_built = [] {
+    build_huffman(dc_luma_bits, dc_vals, &dc_luma);
+    build_huffman(dc_chroma_bits, dc_vals, &dc_chroma);
+    build_huffman(ac_luma_bits, ac_luma_vals, &ac_luma);
+    build_huffman(ac_chroma_bits, ac_chroma_vals, &ac_chroma);
+    return true;
+  }();
+  (void)tables_built;
+
+  out.clear();
+  out.reserve(width * height / 4 + 1024);
+
+  // SOI and JFIF header
+  const uint8_t jfif[] = {0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00,
+                          0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00};
+  out.insert(out.end(), jfif, jfif + sizeof(jfif));
+
+  // DQT, tables in zigzag order
+  out.push_back(0xFF);
+  out.push_back(0xDB);
+  put_u16(out, 2 + 2 * 65);
+  out.push_back(0x00);
+  for (int i = 0; i < 64; i++) {
+    out.push_back(qt_luma[zigzag[i]]);
+  }
+  out.push_back(0x01);
+  for (int i = 0; i < 64; i++) {
+    out.push_back(qt_chroma[zigzag[i]]);
+  }
+
+  // SOF0
+  out.push_back(0xFF);
+  out.push_back(0xC0);
+  put_u16(out, 17);
+  out.push_back(8);
+  put_u16(out, height);
+  put_u16(out, width);
+  out.push_back(3);
+  const uint8_t components[9] = {1, (uint8_t)((h_samp << 4) | v_samp), 0, 2, 0x11, 1, 3, 0x11, 1};
+  out.insert(out.end(), components, components + 9);
+
+  write_dht(out, 0x00, dc_luma_bits, dc_vals);
+  write_dht(out, 0x10, ac_luma_bits, ac_luma_vals);
+  write_dht(out, 0x01, dc_chroma_bits, dc_vals);
+  write_dht(out, 0x11, ac_chroma_bits, ac_chroma_vals);
+
+  // SOS
+  const uint8_t sos[] = {0xFF, 0xDA, 0x00, 0x0C, 3, 1, 0x00, 2, 0x11, 3, 0x11, 0x00, 0x3F, 0x00};
+  out.insert(out.end(), sos, sos + sizeof(sos));
+
+  // Colour convert once, then walk the MCUs
+  std::vector<float> y(width * height), cb(width * height), cr(width * height);
+  for (int i = 0; i < width * height; i++) {
+    float r = rgb[i * 3], g = rgb[i * 3 + 1], b = rgb[i * 3 + 2];
+    y[i] = 0.299f * r + 0.587f * g + 0.114f * b - 128.0f;
+    cb[i] = -0.168736f * r - 0.331264f * g + 0.5f * b;
+    cr[i] = 0.5f * r - 0.418688f * g - 0.081312f * b;
+  }
+
+  bit_writer_t w = {&out, 0, 0};
+  int dc_y = 0, dc_cb = 0, dc_cr = 0;
+  int mcu_w = 8 * h_samp, mcu_h = 8 * v_samp;
+  float block[64];
+
+  for (int my = 0; my < height; my += mcu_h) {
+    for (int mx = 0; mx < width; mx += mcu_w) {
+      for (int by = 0; by < v_samp; by++) {
+        for (int bx = 0; bx < h_samp; bx++) {
+          for (int j = 0; j < 64; j++) {
+            int px = mx + bx * 8 + j % 8;
+            int py = my + by * 8 + j / 8;
+            px = px < width ? px : width - 1;
+            py = py < height ? py : height - 1;
+            block[j] = y[py * width + px];
+          }
+          encode_block(&w, block, div_luma, &dc_y, &dc_luma, &ac_luma);
+        }
+      }
+
+      // Chroma is averaged over the h_samp x v_samp pixels of each sample
+      float block_cr[64];
+      for (int j = 0; j < 64; j++) {
+        float sum_cb = 0, sum_cr = 0;
+        for (int sy = 0; sy < v_samp; sy++) {
+          for (int sx = 0; sx < h_samp; sx++) {
+            int px = mx + (j % 8) * h_samp + sx;
+            int py = my + (j / 8) * v_samp + sy;
+            px = px < width ? px : width - 1;
+            py = py < height ? py : height - 1;
+            sum_cb += cb[py * width + px];
+            sum_cr += cr[py * width + px];
+          }
+        }
+        block[j] = sum_cb / (h_samp * v_samp);
+        block_cr[j] = sum_cr / (h_samp * v_samp);
+      }
+      encode_block(&w, block, div_chroma, &dc_cb, &dc_chroma, &ac_chroma);
+      encode_block(&w, block_cr, div_chroma, &dc_cr, &dc_chroma, &ac_chroma);
+    }
+  }
+
+  flush_bits(&w);
+  out.push_back(0xFF);
+  out.push_back(0xD9);
+  return true;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Baseline JPEG encoder for the camera stand-in and the image converters.
+// quality is the IJG 1-100 scale. h_samp/v_samp are the luma sampling
+// factors: 2,1 gives 4:2:2 like the OV2640, 2,2 gives 4:2:0.
+bool jpeg_encode_rgb888(const uint8_t *rgb, int width, int height, int quality, int h_samp, int v_samp,
+                        std::vector<uint8_t> &out);
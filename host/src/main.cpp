@@ -0,0 +1,74 @@
+#include "Arduino.h"
+#include "esp_camera.h"
+#include "host.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Host entry point: the camera part of the sketch's setup() and loop()
+
+void startCameraServer();
+
+int host_port_offset = 8000;
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [--frames DIR] [--fps N] [--port-offset N]\n"
+          "  --frames DIR       replay the JPEG files in DIR instead of the test pattern\n"
+          "  --fps N            sensor frame rate (default 25)\n"
+          "  --port-offset N    added to the firmware ports (default 8000: 80 -> 8080)\n",
+          argv0);
+}
+
+int main(int argc, char **argv) {
+  const char *frames = NULL;
+  float fps = 25.0f;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+      frames = argv[++i];
+    } else if (!strcmp(argv[i], "--fps") && i + 1 < argc) {
+      fps = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--port-offset") && i + 1 < argc) {
+      host_port_offset = atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  // Writes to closed sockets fail with EPIPE like on lwIP
+  signal(SIGPIPE, SIG_IGN);
+  host_camera_source(frames, fps);
+
+  // Same camera setup as the sketch with PSRAM present
+  camera_config_t config = {};
+  config.ledc_channel = LEDC_CHANNEL_0;
+  config.ledc_timer = LEDC_TIMER_0;
+  config.xclk_freq_hz = 20000000;
+  config.frame_size = FRAMESIZE_UXGA;
+  config.pixel_format = PIXFORMAT_JPEG;
+  config.grab_mode = CAMERA_GRAB_LATEST;
+  config.fb_location = CAMERA_FB_IN_PSRAM;
+  config.jpeg_quality = 10;
+  config.fb_count = 2;
+
+  esp_err_t err = esp_camera_init(&config);
+  if (err != ESP_OK) {
+    Serial.printf("Camera init failed with error 0x%x", err);
+    return 1;
+  }
+
+  Serial.println("Camera Start!!!");
+  sensor_t *s = esp_camera_sensor_get();
+  s->set_vflip(s, 0);
+  s->set_framesize(s, FRAMESIZE_QVGA);
+
+  startCameraServer();
+
+  while (true) {
+    delay(10000);
+  }
+}
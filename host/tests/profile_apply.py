@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Camera profiles on a sensor with an unimplemented control.
+
+The host sensor fails set_sharpness like the OV2640 driver does. A profile
+stores every control, sharpness included, so applying one must still
+succeed and restore the saved settings.
+
+usage: profile_apply.py <camera_host binary>
+"""
+import json
+import socket
+import subprocess
+import sys
+import time
+import urllib.error
+import urllib.request
+
+PORT_OFFSET = 18000
+BASE = "http://127.0.0.1:%d" % (PORT_OFFSET + 80)
+
+
+def get(path):
+    """Status code and decoded JSON body of a GET, None for an empty body"""
+    try:
+        with urllib.request.urlopen(BASE + path, timeout=5) as resp:
+            body = resp.read()
+            return resp.status, json.loads(body) if body else None
+    except urllib.error.HTTPError as err:
+        body = err.read()
+        return err.code, json.loads(body) if body else None
+
+
+def wait_for_server(proc):
+    deadline = time.time() + 10
+    while time.time() < deadline:
+        if proc.poll() is not None:
+            raise RuntimeError("camera_host exited with %d" % proc.returncode)
+        try:
+            socket.create_connection(("127.0.0.1", PORT_OFFSET + 80), timeout=0.2).close()
+            return
+        except OSError:
+            time.sleep(0.1)
+    raise RuntimeError("camera_host did not start listening")
+
+
+def expect(what, actual, wanted):
+    if actual != wanted:
+        raise AssertionError("%s: got %r, wanted %r" % (what, actual, wanted))
+
+
+def run():
+    status, body = get("/control?sharpness=1")
+    expect("sharpness is unsupported", status, 500)
+    expect("failed control", body["control"], "sharpness")
+
+    expect("set brightness", get("/control?brightness=2&saturation=-1")[0], 200)
+    status, body = get("/profile/save?name=day")
+    expect("save", status, 200)
+
+    expect("change settings", get("/control?brightness=-2&saturation=3")[0], 200)
+    status, body = get("/profile/apply?name=day")
+    expect("apply status", status, 200)
+    expect("apply success", body["success"], True)
+
+    status, body = get("/status")
+    expect("status", status, 200)
+    expect("restored brightness", body["brightness"], 2)
+    expect("restored saturation", body["saturation"], -1)
+
+    # Nothing differs now, so applying again changes nothing and still succeeds
+    status, body = get("/profile/apply?name=day")
+    expect("reapply status", status, 200)
+    expect("reapply count", body.get("applied"), 0)
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        return 2
+    proc = subprocess.Popen([sys.argv[1], "--port-offset", str(PORT_OFFSET)], stdout=subprocess.DEVNULL,
+                            stderr=subprocess.DEVNULL)
+    try:
+        wait_for_server(proc)
+        run()
+    finally:
+        proc.terminate()
+        proc.wait(timeout=5)
+    print("profile_apply: ok")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,926 @@
+#pragma once
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "log_ring.h"
+
+// DCT-domain JPEG transcoder for cropped and downscaled substreams.
+// The sensor's baseline JPEG is entropy decoded but never turned into RGB.
+// A crop keeps the MCUs inside the region and re-encodes their quantized
+// coefficients unchanged, so it is lossless. A downscale keeps only the low
+// (8/scale)x(8/scale) coefficients of each block; an inverse DCT of that
+// size yields the block's downscaled samples, and scale x scale such tiles
+// form one output block that is transformed back and requantized with the
+// source's own tables. Chroma stays subsampled and there is no colour
+// conversion or upsampling, so the cost is dominated by the Huffman decode
+// of the source.
+
+#define JPEG_TC_MAX_COMPONENTS 3
+#define JPEG_TC_MAX_BLOCKS 10   // Blocks per MCU allowed by T.81
+
+// Natural (row-major) index of each zigzag position, padded so a corrupt
+// run length cannot index past the table
+static const uint8_t jpeg_tc_natural[64 + 16] = {
+  0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+  63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63,
+};
+
+// Output uses the standard Huffman tables of T.81 Annex K, which cover
+// every symbol whatever tables the source was coded with
+static const uint8_t jpeg_tc_dc_luma_bits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t jpeg_tc_dc_chroma_bits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t jpeg_tc_dc_vals[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const uint8_t jpeg_tc_ac_luma_bits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const uint8_t jpeg_tc_ac_luma_vals[162] = {
+  0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+  0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+  0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+  0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+  0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+  0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+  0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+  0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+  0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+  0xf9, 0xfa,
+};
+
+static const uint8_t jpeg_tc_ac_chroma_bits[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t jpeg_tc_ac_chroma_vals[162] = {
+  0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+  0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+  0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+  0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+  0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+  0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+  0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+  0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+  0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+  0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+  0xf9, 0xfa,
+};
+
+// Canonical Huffman decoder with an 8-bit first-level lookup
+typedef struct {
+  uint8_t fast_len[256];     // Code length for an 8-bit prefix, 0 if longer
+  uint8_t fast_val[256];
+  int32_t maxcode[18];       // Largest code of each length, -1 if none
+  int32_t valoffset[17];
+  uint8_t values[256];
+  bool defined;
+} jpeg_huff_decode_t;
+
+typedef struct {
+  uint16_t code[256];
+  uint8_t size[256];
+} jpeg_huff_encode_t;
+
+typedef struct {
+  uint8_t id;
+  uint8_t h;
+  uint8_t v;
+  uint8_t tq;
+  uint8_t td;
+  uint8_t ta;
+  int dc_pred;               // Source DC predictor
+  int enc_pred;              // Output DC predictor
+  int16_t *strip;            // Downscaled samples of one output MCU row
+  int stride;
+  int filled_width;          // Columns decoded from the source
+} jpeg_tc_component_t;
+
+typedef struct {
+  // Source
+  const uint8_t *data;
+  size_t len;
+  size_t pos;
+  uint32_t bits;
+  int count;
+  bool at_marker;
+  uint16_t quant[4][64];     // Natural order
+  uint8_t quant_precision[4];
+  bool quant_defined[4];
+  jpeg_huff_decode_t dc[4];
+  jpeg_huff_decode_t ac[4];
+  int width;
+  int height;
+  int ncomp;
+  int hmax;
+  int vmax;
+  int restart_interval;
+  jpeg_tc_component_t comp[JPEG_TC_MAX_COMPONENTS];
+
+  // Region kept, in source MCUs
+  int mcu_x0;
+  int mcu_y0;
+  int mcu_x1;
+  int mcu_y1;
+
+  // Transform
+  int scale;
+  int k;                     // Coefficients kept per direction, 8 / scale
+  float idct[8][8];          // [x][u] basis of the k-point inverse DCT
+  float inv_quant[4][64];    // Quantizer reciprocals with the AAN scale folded in
+
+  // Output
+  jpeg_huff_encode_t enc_dc[2];
+  jpeg_huff_encode_t enc_ac[2];
+  uint8_t *out;
+  size_t out_len;
+  size_t out_cap;
+  uint32_t out_bits;
+  int out_count;
+  bool out_failed;
+} jpeg_tc_ctx_t;
+
+static bool jpeg_tc_build_decoder(jpeg_huff_decode_t *table, const uint8_t *counts, const uint8_t *values,
+                                     int num_values) {
+  memset(table, 0, sizeof(*table));
+  memcpy(table->values, values, num_values);
+
+  int code = 0;
+  int k = 0;
+  for (int len = 1; len <= 16; len++) {
+    int n = counts[len - 1];
+    if (n) {
+      table->valoffset[len] = k - code;
+      for (int i = 0; i < n; i++, k++, code++) {
+        if (len <= 8) {
+          int first = code << (8 - len);
+          for (int j = 0; j < (1 << (8 - len)); j++) {
+            table->fast_len[first + j] = len;
+            table->fast_val[first + j] = values[k];
+          }
+        }
+      }
+      table->maxcode[len] = code - 1;
+    } else {
+      table->maxcode[len] = -1;
+    }
+    if (code > (1 << len)) {
+      return false;
+    }
+    code <<= 1;
+  }
+  table->maxcode[17] = 0x7fffffff;
+  table->defined = true;
+  return true;
+}
+
+static void jpeg_tc_build_encoder(jpeg_huff_encode_t *table, const uint8_t *counts, const uint8_t *values) {
+  int code = 0;
+  int k = 0;
+  memset(table, 0, sizeof(*table));
+  for (int len = 1; len <= 16; len++) {
+    for (int i = 0; i < counts[len - 1]; i++, k++, code++) {
+      table->code[values[k]] = code;
+      table->size[values[k]] = len;
+    }
+    code <<= 1;
+  }
+}
+
+// Keep at least 25 bits in the reader. Past a marker or the end of the
+// buffer it feeds zeros, which the MCU count bounds.
+static inline void jpeg_tc_fill(jpeg_tc_ctx_t *ctx) {
+  while (ctx->count <= 24) {
+    uint32_t byte = 0;
+    if (!ctx->at_marker && ctx->pos < ctx->len) {
+      byte = ctx->data[ctx->pos];
+      if (byte == 0xFF) {
+        uint8_t next = ctx->pos + 1 < ctx->len ? ctx->data[ctx->pos + 1] : 0xD9;
+        if (next == 0x00) {
+          ctx->pos += 2;
+        } else {
+          ctx->at_marker = true;
+          byte = 0;
+        }
+      } else {
+        ctx->pos++;
+      }
+    }
+    ctx->bits |= byte << (24 - ctx->count);
+    ctx->count += 8;
+  }
+}
+
+static inline void jpeg_tc_skip(jpeg_tc_ctx_t *ctx, int n) {
+  ctx->bits <<= n;
+  ctx->count -= n;
+}
+
+static inline int jpeg_tc_decode_huff(jpeg_tc_ctx_t *ctx, const jpeg_huff_decode_t *table) {
+  jpeg_tc_fill(ctx);
+  int len = table->fast_len[ctx->bits >> 24];
+  if (len) {
+    int value = table->fast_val[ctx->bits >> 24];
+    jpeg_tc_skip(ctx, len);
+    return value;
+  }
+  for (len = 9; len <= 16; len++) {
+    int32_t code = ctx->bits >> (32 - len);
+    if (code <= table->maxcode[len]) {
+      jpeg_tc_skip(ctx, len);
+      return table->values[(code + table->valoffset[len]) & 0xFF];
+    }
+  }
+  return -1;
+}
+
+// Read s extra bits and sign-extend them as in T.81 F.2.2.1
+static inline int jpeg_tc_receive(jpeg_tc_ctx_t *ctx, int s) {
+  if (!s) {
+    return 0;
+  }
+  jpeg_tc_fill(ctx);
+  int v = ctx->bits >> (32 - s);
+  jpeg_tc_skip(ctx, s);
+  return v < (1 << (s - 1)) ? v - (1 << s) + 1 : v;
+}
+
+// Skip to the data after the next RSTn marker and reset the predictors
+static void jpeg_tc_restart(jpeg_tc_ctx_t *ctx) {
+  ctx->bits = 0;
+  ctx->count = 0;
+  ctx->at_marker = false;
+  while (ctx->pos + 1 < ctx->len &&
+         !(ctx->data[ctx->pos] == 0xFF && ctx->data[ctx->pos + 1] >= 0xD0 && ctx->data[ctx->pos + 1] <= 0xD7)) {
+    ctx->pos++;
+  }
+  ctx->pos += 2;
+  for (int c = 0; c < ctx->ncomp; c++) {
+    ctx->comp[c].dc_pred = 0;
+  }
+}
+
+// Decode the quantized coefficients of one source block in natural order
+static bool jpeg_tc_decode_block(jpeg_tc_ctx_t *ctx, jpeg_tc_component_t *comp, int16_t *coef) {
+  memset(coef, 0, 64 * sizeof(int16_t));
+
+  int s = jpeg_tc_decode_huff(ctx, &ctx->dc[comp->td]);
+  if (s < 0 || s > 11) {
+    return false;
+  }
+  comp->dc_pred += jpeg_tc_receive(ctx, s);
+  coef[0] = comp->dc_pred;
+
+  const jpeg_huff_decode_t *ac = &ctx->ac[comp->ta];
+  for (int i = 1; i < 64; i++) {
+    int rs = jpeg_tc_decode_huff(ctx, ac);
+    if (rs < 0) {
+      return false;
+    }
+    int run = rs >> 4;
+    s = rs & 15;
+    if (!s) {
+      if (run != 15) {
+        break;              // EOB
+      }
+      i += 15;              // ZRL
+      continue;
+    }
+    i += run;
+    coef[jpeg_tc_natural[i]] = jpeg_tc_receive(ctx, s);
+  }
+  return true;
+}
+
+// Turn a block's low-frequency corner into its k x k downscaled samples
+static void jpeg_tc_reduce_block(jpeg_tc_ctx_t *ctx, jpeg_tc_component_t *comp, const int16_t *coef,
+                                 int16_t *out, int stride) {
+  const int k = ctx->k;
+  const uint16_t *quant = ctx->quant[comp->tq];
+
+  if (k == 1) {
+    int v = (int)lroundf(coef[0] * quant[0] * 0.125f);
+    *out = v < -128 ? -128 : (v > 127 ? 127 : v);
+    return;
+  }
+
+  // Separable k-point inverse DCT of the dequantized k x k corner
+  float tmp[8][8];
+  for (int v = 0; v < k; v++) {
+    for (int x = 0; x < k; x++) {
+      float sum = 0;
+      for (int u = 0; u < k; u++) {
+        sum += ctx->idct[x][u] * (coef[v * 8 + u] * quant[v * 8 + u]);
+      }
+      tmp[v][x] = sum;
+    }
+  }
+  for (int y = 0; y < k; y++) {
+    for (int x = 0; x < k; x++) {
+      float sum = 0;
+      for (int v = 0; v < k; v++) {
+        sum += ctx->idct[y][v] * tmp[v][x];
+      }
+      int value = (int)lroundf(sum);
+      out[y * stride + x] = value < -128 ? -128 : (value > 127 ? 127 : value);
+    }
+  }
+}
+
+static inline void jpeg_tc_put_byte(jpeg_tc_ctx_t *ctx, uint8_t byte) {
+  if (ctx->out_len == ctx->out_cap) {
+    size_t cap = ctx->out_cap + ctx->out_cap / 2 + 1024;
+    uint8_t *grown = (uint8_t *)heap_caps_realloc(ctx->out, cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!grown) {
+      grown = (uint8_t *)realloc(ctx->out, cap);
+    }
+    if (!grown) {
+      ctx->out_failed = true;
+      return;
+    }
+    ctx->out = grown;
+    ctx->out_cap = cap;
+  }
+  ctx->out[ctx->out_len++] = byte;
+}
+
+static void jpeg_tc_put_bytes(jpeg_tc_ctx_t *ctx, const uint8_t *bytes, size_t len) {
+  for (size_t i = 0; i < len && !ctx->out_failed; i++) {
+    jpeg_tc_put_byte(ctx, bytes[i]);
+  }
+}
+
+static void jpeg_tc_put_u16(jpeg_tc_ctx_t *ctx, int value) {
+  jpeg_tc_put_byte(ctx, value >> 8);
+  jpeg_tc_put_byte(ctx, value & 0xFF);
+}
+
+static inline void jpeg_tc_put_bits(jpeg_tc_ctx_t *ctx, uint32_t code, int size) {
+  ctx->out_bits = (ctx->out_bits << size) | (code & ((1u << size) - 1));
+  ctx->out_count += size;
+  while (ctx->out_count >= 8) {
+    uint8_t byte = ctx->out_bits >> (ctx->out_count - 8);
+    jpeg_tc_put_byte(ctx, byte);
+    if (byte == 0xFF) {
+      jpeg_tc_put_byte(ctx, 0x00);
+    }
+    ctx->out_count -= 8;
+  }
+}
+
+static inline int jpeg_tc_category(int value) {
+  if (value < 0) {
+    value = -value;
+  }
+  return value ? 32 - __builtin_clz(value) : 0;
+}
+
+// AAN output scale factors, folded into the quantizer reciprocals
+static const float jpeg_tc_aan[8] = {
+  1.0f, 1.387039845f, 1.306562965f, 1.175875602f, 1.0f, 0.785694958f, 0.541196100f, 0.275899379f,
+};
+
+// One 8-point pass of the float AAN forward DCT over d[0], d[step], ...
+static inline void jpeg_tc_fdct_1d(float *d, int step) {
+  float tmp0 = d[0] + d[7 * step];
+  float tmp7 = d[0] - d[7 * step];
+  float tmp1 = d[step] + d[6 * step];
+  float tmp6 = d[step] - d[6 * step];
+  float tmp2 = d[2 * step] + d[5 * step];
+  float tmp5 = d[2 * step] - d[5 * step];
+  float tmp3 = d[3 * step] + d[4 * step];
+  float tmp4 = d[3 * step] - d[4 * step];
+
+  float tmp10 = tmp0 + tmp3;
+  float tmp13 = tmp0 - tmp3;
+  float tmp11 = tmp1 + tmp2;
+  float tmp12 = tmp1 - tmp2;
+  d[0] = tmp10 + tmp11;
+  d[4 * step] = tmp10 - tmp11;
+  float z1 = (tmp12 + tmp13) * 0.707106781f;
+  d[2 * step] = tmp13 + z1;
+  d[6 * step] = tmp13 - z1;
+
+  tmp10 = tmp4 + tmp5;
+  tmp11 = tmp5 + tmp6;
+  tmp12 = tmp6 + tmp7;
+  float z5 = (tmp10 - tmp12) * 0.382683433f;
+  float z2 = 0.541196100f * tmp10 + z5;
+  float z4 = 1.306562965f * tmp12 + z5;
+  float z3 = tmp11 * 0.707106781f;
+  float z11 = tmp7 + z3;
+  float z13 = tmp7 - z3;
+  d[5 * step] = z13 + z2;
+  d[3 * step] = z13 - z2;
+  d[step] = z11 + z4;
+  d[7 * step] = z11 - z4;
+}
+
+// Entropy code the quantized coefficients of one block
+static void jpeg_tc_encode_coefs(jpeg_tc_ctx_t *ctx, jpeg_tc_component_t *comp, int index, const int16_t *coef) {
+  const jpeg_huff_encode_t *dc = &ctx->enc_dc[index];
+  const jpeg_huff_encode_t *ac = &ctx->enc_ac[index];
+  int diff = coef[0] - comp->enc_pred;
+  comp->enc_pred = coef[0];
+  int s = jpeg_tc_category(diff);
+  jpeg_tc_put_bits(ctx, dc->code[s], dc->size[s]);
+  if (s) {
+    jpeg_tc_put_bits(ctx, diff < 0 ? diff - 1 : diff, s);
+  }
+
+  int run = 0;
+  for (int i = 1; i < 64; i++) {
+    int value = coef[jpeg_tc_natural[i]];
+    if (!value) {
+      run++;
+      continue;
+    }
+    while (run > 15) {
+      jpeg_tc_put_bits(ctx, ac->code[0xF0], ac->size[0xF0]);
+      run -= 16;
+    }
+    s = jpeg_tc_category(value);
+    int symbol = (run << 4) | s;
+    jpeg_tc_put_bits(ctx, ac->code[symbol], ac->size[symbol]);
+    jpeg_tc_put_bits(ctx, value < 0 ? value - 1 : value, s);
+    run = 0;
+  }
+  if (run) {
+    jpeg_tc_put_bits(ctx, ac->code[0x00], ac->size[0x00]);
+  }
+}
+
+// Forward DCT, quantize and entropy code one 8x8 block of the strip
+static void jpeg_tc_encode_block(jpeg_tc_ctx_t *ctx, jpeg_tc_component_t *comp, int index,
+                                 const int16_t *in, int stride) {
+  float block[64];
+  int16_t coef[64];
+  const float *inv_quant = ctx->inv_quant[comp->tq];
+
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 8; x++) {
+      block[y * 8 + x] = in[y * stride + x];
+    }
+    jpeg_tc_fdct_1d(block + y * 8, 1);
+  }
+  for (int x = 0; x < 8; x++) {
+    jpeg_tc_fdct_1d(block + x, 8);
+  }
+  for (int i = 0; i < 64; i++) {
+    coef[i] = (int16_t)lroundf(block[i] * inv_quant[i]);
+  }
+  jpeg_tc_encode_coefs(ctx, comp, index, coef);
+}
+
+// Parse the markers up to the scan. Only single-scan baseline (or 8-bit
+// extended Huffman) JPEGs, as the sensor produces them, are accepted.
+static bool jpeg_tc_parse(jpeg_tc_ctx_t *ctx) {
+  const uint8_t *d = ctx->data;
+  size_t len = ctx->len;
+  if (len < 4 || d[0] != 0xFF || d[1] != 0xD8) {
+    return false;
+  }
+
+  size_t pos = 2;
+  bool have_frame = false;
+  while (pos + 4 <= len) {
+    if (d[pos] != 0xFF) {
+      return false;
+    }
+    uint8_t marker = d[pos + 1];
+    if (marker == 0xFF) {
+      pos++;
+      continue;
+    }
+    size_t seg_len = (d[pos + 2] << 8) | d[pos + 3];
+    const uint8_t *seg = d + pos + 4;
+    size_t seg_end = pos + 2 + seg_len;
+    if (seg_len < 2 || seg_end > len) {
+      return false;
+    }
+    size_t n = seg_len - 2;
+
+    switch (marker) {
+      case 0xDB:  // DQT
+        for (size_t i = 0; i < n;) {
+          int precision = seg[i] >> 4;
+          int id = seg[i] & 3;
+          size_t size = precision ? 128 : 64;
+          if (precision > 1 || i + 1 + size > n) {
+            return false;
+          }
+          for (int j = 0; j < 64; j++) {
+            ctx->quant[id][jpeg_tc_natural[j]] =
+              precision ? (seg[i + 1 + 2 * j] << 8) | seg[i + 2 + 2 * j] : seg[i + 1 + j];
+          }
+          ctx->quant_precision[id] = precision;
+          ctx->quant_defined[id] = true;
+          i += 1 + size;
+        }
+        break;
+
+      case 0xC4:  // DHT
+        for (size_t i = 0; i < n;) {
+          if (i + 17 > n) {
+            return false;
+          }
+          int cls = seg[i] >> 4;
+          int id = seg[i] & 3;
+          int total = 0;
+          for (int j = 0; j < 16; j++) {
+            total += seg[i + 1 + j];
+          }
+          if (cls > 1 || total > 256 || i + 17 + total > n) {
+            return false;
+          }
+          jpeg_huff_decode_t *table = cls ? &ctx->ac[id] : &ctx->dc[id];
+          if (!jpeg_tc_build_decoder(table, seg + i + 1, seg + i + 17, total)) {
+            return false;
+          }
+          i += 17 + total;
+        }
+        break;
+
+      case 0xC0:  // SOF0 baseline
+      case 0xC1:  // SOF1 extended sequential, Huffman
+        if (n < 6 || seg[0] != 8) {
+          return false;
+        }
+        ctx->height = (seg[1] << 8) | seg[2];
+        ctx->width = (seg[3] << 8) | seg[4];
+        ctx->ncomp = seg[5];
+        if (!ctx->width || !ctx->height || (ctx->ncomp != 1 && ctx->ncomp != 3) || n < 6 + 3 * (size_t)ctx->ncomp) {
+          return false;
+        }
+        for (int c = 0; c < ctx->ncomp; c++) {
+          jpeg_tc_component_t *comp = &ctx->comp[c];
+          comp->id = seg[6 + 3 * c];
+          comp->h = seg[7 + 3 * c] >> 4;
+          comp->v = seg[7 + 3 * c] & 15;
+          comp->tq = seg[8 + 3 * c] & 3;
+          if (comp->h < 1 || comp->h > 4 || comp->v < 1 || comp->v > 4) {
+            return false;
+          }
+        }
+        have_frame = true;
+        break;
+
+      case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+      case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+        return false;       // Progressive, lossless, hierarchical or arithmetic
+
+      case 0xDD:  // DRI
+        if (n < 2) {
+          return false;
+        }
+        ctx->restart_interval = (seg[0] << 8) | seg[1];
+        break;
+
+      case 0xDA:  // SOS
+        if (!have_frame || n < 1 || seg[0] != ctx->ncomp || n < 4 + 2 * (size_t)ctx->ncomp) {
+          return false;     // Multi-scan files are not supported
+        }
+        for (int i = 0; i < ctx->ncomp; i++) {
+          jpeg_tc_component_t *comp = NULL;
+          for (int c = 0; c < ctx->ncomp; c++) {
+            if (ctx->comp[c].id == seg[1 + 2 * i]) {
+              comp = &ctx->comp[c];
+            }
+          }
+          if (!comp) {
+            return false;
+          }
+          comp->td = seg[2 + 2 * i] >> 4 & 3;
+          comp->ta = seg[2 + 2 * i] & 3;
+          if (!ctx->dc[comp->td].defined || !ctx->ac[comp->ta].defined || !ctx->quant_defined[comp->tq]) {
+            return false;
+          }
+        }
+        ctx->pos = seg_end;
+        return true;
+
+      default:    // APPn, COM and anything else we do not need
+        break;
+    }
+    pos = seg_end;
+  }
+  return false;
+}
+
+static void jpeg_tc_put_dht(jpeg_tc_ctx_t *ctx, int cls_id, const uint8_t *bits, const uint8_t *vals,
+                               int num_vals) {
+  jpeg_tc_put_byte(ctx, cls_id);
+  jpeg_tc_put_bytes(ctx, bits, 16);
+  jpeg_tc_put_bytes(ctx, vals, num_vals);
+}
+
+static void jpeg_tc_write_headers(jpeg_tc_ctx_t *ctx, int width, int height) {
+  static const uint8_t soi[] = {0xFF, 0xD8};
+  jpeg_tc_put_bytes(ctx, soi, sizeof(soi));
+
+  bool extended = false;
+  for (int t = 0; t < 4; t++) {
+    if (!ctx->quant_defined[t]) {
+      continue;
+    }
+    int precision = ctx->quant_precision[t];
+    extended |= precision;
+    jpeg_tc_put_u16(ctx, 0xFFDB);
+    jpeg_tc_put_u16(ctx, 3 + 64 * (precision + 1));
+    jpeg_tc_put_byte(ctx, (precision << 4) | t);
+    for (int j = 0; j < 64; j++) {
+      uint16_t q = ctx->quant[t][jpeg_tc_natural[j]];
+      if (precision) {
+        jpeg_tc_put_byte(ctx, q >> 8);
+      }
+      jpeg_tc_put_byte(ctx, q & 0xFF);
+    }
+  }
+
+  jpeg_tc_put_u16(ctx, extended ? 0xFFC1 : 0xFFC0);
+  jpeg_tc_put_u16(ctx, 8 + 3 * ctx->ncomp);
+  jpeg_tc_put_byte(ctx, 8);
+  jpeg_tc_put_u16(ctx, height);
+  jpeg_tc_put_u16(ctx, width);
+  jpeg_tc_put_byte(ctx, ctx->ncomp);
+  for (int c = 0; c < ctx->ncomp; c++) {
+    jpeg_tc_put_byte(ctx, ctx->comp[c].id);
+    jpeg_tc_put_byte(ctx, (ctx->comp[c].h << 4) | ctx->comp[c].v);
+    jpeg_tc_put_byte(ctx, ctx->comp[c].tq);
+  }
+
+  int tables = ctx->ncomp > 1 ? 2 : 1;
+  jpeg_tc_put_u16(ctx, 0xFFC4);
+  jpeg_tc_put_u16(ctx, 2 + tables * (17 + 12 + 17 + 162));
+  jpeg_tc_put_dht(ctx, 0x00, jpeg_tc_dc_luma_bits, jpeg_tc_dc_vals, 12);
+  jpeg_tc_put_dht(ctx, 0x10, jpeg_tc_ac_luma_bits, jpeg_tc_ac_luma_vals, 162);
+  if (ctx->ncomp > 1) {
+    jpeg_tc_put_dht(ctx, 0x01, jpeg_tc_dc_chroma_bits, jpeg_tc_dc_vals, 12);
+    jpeg_tc_put_dht(ctx, 0x11, jpeg_tc_ac_chroma_bits, jpeg_tc_ac_chroma_vals, 162);
+  }
+
+  jpeg_tc_put_u16(ctx, 0xFFDA);
+  jpeg_tc_put_u16(ctx, 6 + 2 * ctx->ncomp);
+  jpeg_tc_put_byte(ctx, ctx->ncomp);
+  for (int c = 0; c < ctx->ncomp; c++) {
+    jpeg_tc_put_byte(ctx, ctx->comp[c].id);
+    jpeg_tc_put_byte(ctx, c ? 0x11 : 0x00);
+  }
+  jpeg_tc_put_byte(ctx, 0);
+  jpeg_tc_put_byte(ctx, 63);
+  jpeg_tc_put_byte(ctx, 0);
+}
+
+// Copy the last decoded column and row into the padding an output MCU
+// row needs beyond the source's own blocks
+static void jpeg_tc_pad_strip(jpeg_tc_component_t *comp, int filled_rows, int rows) {
+  for (int y = 0; y < filled_rows; y++) {
+    int16_t *row = comp->strip + y * comp->stride;
+    for (int x = comp->filled_width; x < comp->stride; x++) {
+      row[x] = row[comp->filled_width - 1];
+    }
+  }
+  for (int y = filled_rows; y < rows; y++) {
+    memcpy(comp->strip + y * comp->stride, comp->strip + (filled_rows - 1) * comp->stride,
+           comp->stride * sizeof(int16_t));
+  }
+}
+
+// Region of a frame in pixels
+typedef struct {
+  int x;
+  int y;
+  int w;
+  int h;
+} jpeg_roi_t;
+
+static bool jpeg_tc_run(jpeg_tc_ctx_t *ctx, const jpeg_roi_t *roi, jpeg_roi_t *applied) {
+  const int s = ctx->scale;
+  const int k = ctx->k;
+  if (ctx->ncomp == 1) {
+    // A single-component scan is not interleaved, its MCU is one block
+    ctx->comp[0].h = ctx->comp[0].v = 1;
+  }
+  ctx->hmax = ctx->vmax = 1;
+  int blocks_per_mcu = 0;
+  for (int c = 0; c < ctx->ncomp; c++) {
+    ctx->hmax = ctx->comp[c].h > ctx->hmax ? ctx->comp[c].h : ctx->hmax;
+    ctx->vmax = ctx->comp[c].v > ctx->vmax ? ctx->comp[c].v : ctx->vmax;
+    blocks_per_mcu += ctx->comp[c].h * ctx->comp[c].v;
+  }
+  if (blocks_per_mcu > JPEG_TC_MAX_BLOCKS) {
+    return false;
+  }
+
+  int mcu_w = 8 * ctx->hmax;
+  int mcu_h = 8 * ctx->vmax;
+  int mcus_x = (ctx->width + mcu_w - 1) / mcu_w;
+  int mcus_y = (ctx->height + mcu_h - 1) / mcu_h;
+
+  // The region grows outward to whole MCUs, which can be cut without decoding
+  ctx->mcu_x0 = ctx->mcu_y0 = 0;
+  ctx->mcu_x1 = mcus_x;
+  ctx->mcu_y1 = mcus_y;
+  if (roi) {
+    int x0 = roi->x < 0 ? 0 : (roi->x >= ctx->width ? ctx->width - 1 : roi->x);
+    int y0 = roi->y < 0 ? 0 : (roi->y >= ctx->height ? ctx->height - 1 : roi->y);
+    int x1 = roi->x + roi->w > ctx->width ? ctx->width : roi->x + roi->w;
+    int y1 = roi->y + roi->h > ctx->height ? ctx->height : roi->y + roi->h;
+    ctx->mcu_x0 = x0 / mcu_w;
+    ctx->mcu_y0 = y0 / mcu_h;
+    ctx->mcu_x1 = x1 > x0 ? (x1 + mcu_w - 1) / mcu_w : ctx->mcu_x0 + 1;
+    ctx->mcu_y1 = y1 > y0 ? (y1 + mcu_h - 1) / mcu_h : ctx->mcu_y0 + 1;
+  }
+  int crop_x = ctx->mcu_x0 * mcu_w;
+  int crop_y = ctx->mcu_y0 * mcu_h;
+  int crop_w = (ctx->mcu_x1 * mcu_w < ctx->width ? ctx->mcu_x1 * mcu_w : ctx->width) - crop_x;
+  int crop_h = (ctx->mcu_y1 * mcu_h < ctx->height ? ctx->mcu_y1 * mcu_h : ctx->height) - crop_y;
+  if (applied) {
+    applied->x = crop_x;
+    applied->y = crop_y;
+    applied->w = crop_w;
+    applied->h = crop_h;
+  }
+
+  int out_width = (crop_w + s - 1) / s;
+  int out_height = (crop_h + s - 1) / s;
+  int out_mcus_x = (out_width + mcu_w - 1) / mcu_w;
+  int window_x = ctx->mcu_x1 - ctx->mcu_x0;
+
+  if (s > 1) {
+    for (int c = 0; c < ctx->ncomp; c++) {
+      jpeg_tc_component_t *comp = &ctx->comp[c];
+      comp->filled_width = window_x * comp->h * k;
+      comp->stride = out_mcus_x * comp->h * 8;
+      if (comp->stride < comp->filled_width) {
+        comp->stride = comp->filled_width;
+      }
+      comp->strip = (int16_t *)malloc(comp->stride * 8 * comp->v * sizeof(int16_t));
+      if (!comp->strip) {
+        return false;
+      }
+    }
+  }
+
+  // The output has about the source's coded data per kept pixel
+  uint64_t area = (uint64_t)ctx->width * ctx->height;
+  ctx->out_cap = (size_t)(ctx->len * ((uint64_t)out_width * out_height) / area) + 1024;
+  ctx->out = (uint8_t *)heap_caps_malloc(ctx->out_cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!ctx->out) {
+    ctx->out = (uint8_t *)malloc(ctx->out_cap);
+  }
+  if (!ctx->out) {
+    return false;
+  }
+
+  jpeg_tc_write_headers(ctx, out_width, out_height);
+
+  int16_t coef[64];
+  int restarts_left = ctx->restart_interval;
+  for (int my = 0; my < ctx->mcu_y1; my++) {
+    bool rows_in = my >= ctx->mcu_y0;
+    // scale source MCU rows make up one output MCU row
+    int r = rows_in ? (my - ctx->mcu_y0) % s : 0;
+
+    for (int mx = 0; mx < mcus_x; mx++) {
+      if (my == ctx->mcu_y1 - 1 && mx >= ctx->mcu_x1) {
+        break;              // Nothing after the region is needed
+      }
+      if (ctx->restart_interval) {
+        if (!restarts_left) {
+          jpeg_tc_restart(ctx);
+          restarts_left = ctx->restart_interval;
+        }
+        restarts_left--;
+      }
+
+      bool inside = rows_in && mx >= ctx->mcu_x0 && mx < ctx->mcu_x1;
+      for (int c = 0; c < ctx->ncomp; c++) {
+        jpeg_tc_component_t *comp = &ctx->comp[c];
+        for (int bv = 0; bv < comp->v; bv++) {
+          for (int bh = 0; bh < comp->h; bh++) {
+            // Blocks outside the region are still decoded to keep the DC
+            // predictors and the bit position right
+            if (!jpeg_tc_decode_block(ctx, comp, coef)) {
+              return false;
+            }
+            if (!inside) {
+              continue;
+            }
+            if (s == 1) {
+              jpeg_tc_encode_coefs(ctx, comp, c ? 1 : 0, coef);
+            } else {
+              int16_t *out = comp->strip + ((r * comp->v + bv) * k) * comp->stride +
+                             ((mx - ctx->mcu_x0) * comp->h + bh) * k;
+              jpeg_tc_reduce_block(ctx, comp, coef, out, comp->stride);
+            }
+          }
+        }
+      }
+    }
+
+    if (rows_in && s > 1 && (r == s - 1 || my == ctx->mcu_y1 - 1)) {
+      for (int c = 0; c < ctx->ncomp; c++) {
+        jpeg_tc_component_t *comp = &ctx->comp[c];
+        jpeg_tc_pad_strip(comp, (r + 1) * comp->v * k, 8 * comp->v);
+      }
+      for (int ox = 0; ox < out_mcus_x; ox++) {
+        for (int c = 0; c < ctx->ncomp; c++) {
+          jpeg_tc_component_t *comp = &ctx->comp[c];
+          for (int bv = 0; bv < comp->v; bv++) {
+            for (int bh = 0; bh < comp->h; bh++) {
+              const int16_t *in = comp->strip + bv * 8 * comp->stride + (ox * comp->h + bh) * 8;
+              jpeg_tc_encode_block(ctx, comp, c ? 1 : 0, in, comp->stride);
+            }
+          }
+        }
+      }
+    }
+    if (ctx->out_failed) {
+      return false;
+    }
+  }
+
+  // Pad the last byte with ones and close the image
+  if (ctx->out_count) {
+    jpeg_tc_put_bits(ctx, 0x7F, 8 - ctx->out_count);
+  }
+  jpeg_tc_put_u16(ctx, 0xFFD9);
+  return !ctx->out_failed;
+}
+
+// Parse a ?scale= divisor: 1, 2, 4 or 8, 0 for anything else
+static int jpeg_scale_param(const char *param) {
+  char *end;
+  long scale = strtol(param, &end, 10);
+  return !*end && (scale == 1 || scale == 2 || scale == 4 || scale == 8) ? (int)scale : 0;
+}
+
+// Parse ?roi=x,y,w,h: exactly four fields, a non-negative origin and a
+// positive size
+static bool jpeg_roi_param(const char *param, jpeg_roi_t *roi) {
+  int end = 0;
+  return sscanf(param, "%d,%d,%d,%d%n", &roi->x, &roi->y, &roi->w, &roi->h, &end) == 4 && !param[end] &&
+         roi->x >= 0 && roi->y >= 0 && roi->w > 0 && roi->h > 0;
+}
+
+// Crop a JPEG to roi (NULL for the whole frame) and downscale the result by
+// scale (1, 2, 4 or 8). The region is widened to whole MCUs; applied, if
+// given, receives the part of the frame actually kept. On success *out holds
+// a new JPEG that the caller frees with free().
+bool jpeg_transcode(const uint8_t *src, size_t src_len, const jpeg_roi_t *roi, int scale, uint8_t **out,
+                    size_t *out_len, jpeg_roi_t *applied) {
+  if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+    return false;
+  }
+
+  jpeg_tc_ctx_t *ctx = (jpeg_tc_ctx_t *)calloc(1, sizeof(jpeg_tc_ctx_t));
+  if (!ctx) {
+    LOGR_E("JPEG transcode context alloc failed");
+    return false;
+  }
+  ctx->data = src;
+  ctx->len = src_len;
+  ctx->scale = scale;
+  ctx->k = 8 / scale;
+
+  bool ok = jpeg_tc_parse(ctx);
+  if (ok) {
+    // Source coefficients are orthonormal 8-point DCT values; scaling the
+    // kept corner by k/8 (sqrt(k/8) per direction) makes a k-point
+    // orthonormal IDCT return the block mean at DC
+    const int k = ctx->k;
+    for (int x = 0; x < k; x++) {
+      for (int u = 0; u < k; u++) {
+        float alpha = u ? sqrtf(2.0f / k) : sqrtf(1.0f / k);
+        ctx->idct[x][u] = alpha * cosf((2 * x + 1) * u * (float)M_PI / (2 * k)) * sqrtf(k / 8.0f);
+      }
+    }
+    for (int t = 0; t < 4; t++) {
+      for (int i = 0; i < 64; i++) {
+        float q = ctx->quant[t][i] ? ctx->quant[t][i] : 1;
+        ctx->inv_quant[t][i] = 1.0f / (q * jpeg_tc_aan[i >> 3] * jpeg_tc_aan[i & 7] * 8.0f);
+      }
+    }
+    jpeg_tc_build_encoder(&ctx->enc_dc[0], jpeg_tc_dc_luma_bits, jpeg_tc_dc_vals);
+    jpeg_tc_build_encoder(&ctx->enc_ac[0], jpeg_tc_ac_luma_bits, jpeg_tc_ac_luma_vals);
+    jpeg_tc_build_encoder(&ctx->enc_dc[1], jpeg_tc_dc_chroma_bits, jpeg_tc_dc_vals);
+    jpeg_tc_build_encoder(&ctx->enc_ac[1], jpeg_tc_ac_chroma_bits, jpeg_tc_ac_chroma_vals);
+    ok = jpeg_tc_run(ctx, roi, applied);
+  } else {
+    LOGR_D("JPEG transcode: unsupported source");
+  }
+
+  for (int c = 0; c < JPEG_TC_MAX_COMPONENTS; c++) {
+    free(ctx->comp[c].strip);
+  }
+  if (ok) {
+    *out = ctx->out;
+    *out_len = ctx->out_len;
+  } else {
+    free(ctx->out);
+  }
+  free(ctx);
+  return ok;
+}
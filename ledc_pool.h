@@ -0,0 +1,151 @@
+#pragma once
+
+#include <Arduino.h>
+#include "esp32-hal-ledc.h"
+
+// LEDC channel and timer allocation for PWM outputs.
+// The ESP32-S3 has 8 LEDC channels and 4 timers, and the Arduino core
+// clocks channel n from timer n / 2, so the two channels of a pair must run
+// at the same frequency and resolution. A pin gets a free channel whose
+// partner already runs at its settings, else one from an idle pair. Each
+// timer counts the channels using it and is free again when both are
+// released. Channels 0 and 1 stay with the camera, whose XCLK runs on
+// LEDC_CHANNEL_0 and LEDC_TIMER_0.
+
+#define LEDC_POOL_CHANNELS 8
+#define LEDC_POOL_TIMERS (LEDC_POOL_CHANNELS / 2)
+#define LEDC_POOL_FIRST_CHANNEL 2
+#define LEDC_POOL_MAX_BITS 14
+#define LEDC_POOL_SOURCE_CLOCK 80000000   // APB clock; freq << bits may not exceed it
+
+typedef struct {
+  uint32_t freq;
+  uint8_t bits;
+  uint8_t refs;        // Channels clocked by this timer
+} ledc_pool_timer_t;
+
+typedef struct {
+  bool used;
+  uint8_t pin;
+} ledc_pool_channel_t;
+
+static ledc_pool_timer_t ledc_pool_timers[LEDC_POOL_TIMERS];
+static ledc_pool_channel_t ledc_pool_channels[LEDC_POOL_CHANNELS];
+
+static inline ledc_pool_timer_t *ledc_pool_timer_of(int channel) {
+  return &ledc_pool_timers[channel / 2];
+}
+
+static bool ledc_pool_settings_valid(uint32_t freq, uint8_t bits) {
+  return freq > 0 && bits >= 1 && bits <= LEDC_POOL_MAX_BITS && ((uint64_t)freq << bits) <= LEDC_POOL_SOURCE_CLOCK;
+}
+
+// Channel driving pin, -1 if none
+static int ledc_pool_channel(int pin) {
+  for (int c = LEDC_POOL_FIRST_CHANNEL; c < LEDC_POOL_CHANNELS; c++) {
+    if (ledc_pool_channels[c].used && ledc_pool_channels[c].pin == pin) {
+      return c;
+    }
+  }
+  return -1;
+}
+
+static void ledc_pool_free(int channel) {
+  ledc_pool_channels[channel].used = false;
+  ledc_pool_timer_of(channel)->refs--;
+}
+
+// Detach pin from its channel, if it has one
+static void ledc_pool_release(int pin) {
+  int channel = ledc_pool_channel(pin);
+  if (channel < 0) {
+    return;
+  }
+  ledcDetach(pin);
+  ledc_pool_free(channel);
+}
+
+static int ledc_pool_find(uint32_t freq, uint8_t bits) {
+  // Share a running timer before taking an idle pair
+  for (int pass = 0; pass < 2; pass++) {
+    for (int c = LEDC_POOL_FIRST_CHANNEL; c < LEDC_POOL_CHANNELS; c++) {
+      ledc_pool_timer_t *timer = ledc_pool_timer_of(c);
+      bool fits = pass == 0 ? timer->refs > 0 && timer->freq == freq && timer->bits == bits : timer->refs == 0;
+      if (!ledc_pool_channels[c].used && fits) {
+        return c;
+      }
+    }
+  }
+  return -1;
+}
+
+// Attach pin at freq and bits, keeping its channel when it already has
+// one. Returns the channel, -1 when no channel or timer is free for these
+// settings or the LEDC refused them; an attached pin then keeps its old
+// settings and duty, unless the LEDC refuses those too and it ends up
+// detached.
+static int ledc_pool_attach(int pin, uint32_t freq, uint8_t bits) {
+  if (!ledc_pool_settings_valid(freq, bits)) {
+    return -1;
+  }
+  int current = ledc_pool_channel(pin);
+  if (current >= 0) {
+    ledc_pool_timer_t *timer = ledc_pool_timer_of(current);
+    if (timer->freq == freq && timer->bits == bits) {
+      return current;
+    }
+    // Sole user of the timer, retune it in place
+    if (timer->refs == 1) {
+      if (!ledcChangeFrequency(pin, freq, bits)) {
+        return -1;
+      }
+      timer->freq = freq;
+      timer->bits = bits;
+      return current;
+    }
+  }
+
+  int channel = ledc_pool_find(freq, bits);
+  if (channel < 0) {
+    return -1;
+  }
+  // The core refuses to attach a pin twice, so detach it from its old
+  // channel first and go back there if the new one is refused
+  uint32_t duty = 0;
+  if (current >= 0) {
+    duty = ledcRead(pin);
+    ledcDetach(pin);
+  }
+  if (!ledcAttachChannel(pin, freq, bits, channel)) {
+    if (current >= 0) {
+      ledc_pool_timer_t *old = ledc_pool_timer_of(current);
+      if (ledcAttachChannel(pin, old->freq, old->bits, current)) {
+        ledcWrite(pin, duty);
+      } else {
+        ledc_pool_free(current);
+      }
+    }
+    return -1;
+  }
+  if (current >= 0) {
+    ledc_pool_free(current);
+  }
+  ledc_pool_timer_t *timer = ledc_pool_timer_of(channel);
+  timer->freq = freq;
+  timer->bits = bits;
+  timer->refs++;
+  ledc_pool_channels[channel].used = true;
+  ledc_pool_channels[channel].pin = pin;
+  return channel;
+}
+
+// Resolution of an attached pin, 0 if not attached
+static uint8_t ledc_pool_bits(int pin) {
+  int channel = ledc_pool_channel(pin);
+  return channel < 0 ? 0 : ledc_pool_timer_of(channel)->bits;
+}
+
+static uint32_t ledc_pool_freq(int pin) {
+  int channel = ledc_pool_channel(pin);
+  return channel < 0 ? 0 : ledc_pool_timer_of(channel)->freq;
+}
@@ -0,0 +1,375 @@
+#!/usr/bin/env python3
+"""Load generator for the camera REST API.
+
+Opens concurrent /stream clients, polls /capture, /status and /gpio/ai/read
+at fixed rates and fires bursts of /control changes, then prints one JSON
+report with per-client fps and inter-frame jitter, request latency
+percentiles and error rates. Runs against a board or the host build
+(python3 loadgen.py --port 8080 --stream-port 8081).
+
+With --latency the stream clients also read the X-Timestamp and X-Frame-Seq
+part headers. The offset to the camera clock is estimated from /clock
+before and after the run, giving capture-to-receive latency per frame and
+the sequence numbers a client never saw.
+"""
+import argparse
+import http.client
+import json
+import math
+import socket
+import statistics
+import sys
+import threading
+import time
+
+
+def percentile(values, p):
+    """Nearest-rank percentile of values, None when empty"""
+    if not values:
+        return None
+    ordered = sorted(values)
+    rank = max(1, math.ceil(p / 100.0 * len(ordered)))
+    return ordered[rank - 1]
+
+
+def summarize(values):
+    """Summary of a list of milliseconds"""
+    if not values:
+        return None
+    return {
+        "mean": round(statistics.fmean(values), 3),
+        "stdev": round(statistics.pstdev(values), 3),
+        "p50": round(percentile(values, 50), 3),
+        "p90": round(percentile(values, 90), 3),
+        "p99": round(percentile(values, 99), 3),
+        "max": round(max(values), 3),
+    }
+
+
+class EndpointStats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.latencies = []
+        self.requests = 0
+        self.errors = 0
+        self.status = {}
+
+    def record(self, latency_ms, status):
+        with self.lock:
+            self.requests += 1
+            if status is None or status >= 400:
+                self.errors += 1
+            else:
+                self.latencies.append(latency_ms)
+            key = str(status) if status is not None else "error"
+            self.status[key] = self.status.get(key, 0) + 1
+
+    def report(self):
+        with self.lock:
+            return {
+                "requests": self.requests,
+                "errors": self.errors,
+                "error_rate": round(self.errors / self.requests, 4) if self.requests else 0.0,
+                "status": dict(self.status),
+                "latency_ms": summarize(self.latencies),
+            }
+
+
+class Poller(threading.Thread):
+    """Requests one path at a fixed rate over a keep-alive connection"""
+
+    def __init__(self, args, path, rate, stats, stop):
+        super().__init__(daemon=True)
+        self.args = args
+        self.path = path
+        self.period = 1.0 / rate
+        self.stats = stats
+        self.stop = stop
+        self.conn = None
+
+    def request(self, path):
+        start = time.monotonic()
+        try:
+            if self.conn is None:
+                self.conn = http.client.HTTPConnection(self.args.host, self.args.port, timeout=self.args.timeout)
+            self.conn.request("GET", path)
+            resp = self.conn.getresponse()
+            resp.read()
+            status = resp.status
+            if resp.will_close:
+                self.conn.close()
+                self.conn = None
+        except (OSError, http.client.HTTPException):
+            status = None
+            if self.conn is not None:
+                self.conn.close()
+                self.conn = None
+        self.stats.record((time.monotonic() - start) * 1000.0, status)
+
+    def run(self):
+        next_time = time.monotonic()
+        while not self.stop.is_set():
+            self.request(self.path)
+            next_time += self.period
+            delay = next_time - time.monotonic()
+            if delay > 0:
+                self.stop.wait(delay)
+            else:
+                # Fell behind, do not try to catch up with a burst
+                next_time = time.monotonic()
+
+
+class ControlBurster(Poller):
+    """Fires count /control changes back to back every interval seconds"""
+
+    def __init__(self, args, stats, stop):
+        super().__init__(args, "/control", 1.0, stats, stop)
+        self.values = [int(v) for v in args.control_values.split(",")]
+
+    def run(self):
+        step = 0
+        while not self.stop.is_set():
+            for _ in range(self.args.control_burst):
+                value = self.values[step % len(self.values)]
+                step += 1
+                self.request("/control?var=%s&val=%d" % (self.args.control_var, value))
+            self.stop.wait(self.args.control_interval)
+
+
+class StreamClient(threading.Thread):
+    """Reads /stream and records the arrival time of every frame"""
+
+    def __init__(self, args, index, stop):
+        super().__init__(daemon=True)
+        self.args = args
+        self.index = index
+        self.stop = stop
+        self.arrivals = []
+        self.parts = []  # (arrival, capture timestamp, seq) of every frame
+        self.bytes = 0
+        self.errors = 0
+        self.connects = 0
+
+    def read_until(self, sock, buf, marker):
+        while marker not in buf:
+            data = sock.recv(65536)
+            if not data:
+                raise ConnectionError("stream closed")
+            buf += data
+        head, _, rest = buf.partition(marker)
+        return head, rest
+
+    def read_exact(self, sock, buf, length):
+        while len(buf) < length:
+            data = sock.recv(65536)
+            if not data:
+                raise ConnectionError("stream closed")
+            buf += data
+        return buf[:length], buf[length:]
+
+    def session(self):
+        sock = socket.create_connection((self.args.host, self.args.stream_port), timeout=self.args.timeout)
+        try:
+            sock.sendall(("GET /stream HTTP/1.1\r\nHost: %s\r\n\r\n" % self.args.host).encode())
+            head, buf = self.read_until(sock, b"", b"\r\n\r\n")
+            if not head.startswith(b"HTTP/1.1 200"):
+                raise ConnectionError(head.split(b"\r\n", 1)[0].decode(errors="replace"))
+            self.connects += 1
+            while not self.stop.is_set():
+                part, buf = self.read_until(sock, buf, b"\r\n\r\n")
+                headers = {}
+                for line in part.split(b"\r\n"):
+                    name, sep, value = line.partition(b":")
+                    if sep:
+                        headers[name.strip().lower()] = value.strip()
+                if b"content-length" not in headers:
+                    continue
+                length = int(headers[b"content-length"])
+                _, buf = self.read_exact(sock, buf, length)
+                arrival = time.monotonic()
+                self.arrivals.append(arrival)
+                self.bytes += length
+                if b"x-timestamp" in headers and b"x-frame-seq" in headers:
+                    self.parts.append((arrival, float(headers[b"x-timestamp"]), int(headers[b"x-frame-seq"])))
+        finally:
+            sock.close()
+
+    def run(self):
+        while not self.stop.is_set():
+            try:
+                self.session()
+            except (OSError, ValueError):
+                self.errors += 1
+                self.stop.wait(1.0)
+
+    def report(self, duration):
+        intervals = [(b - a) * 1000.0 for a, b in zip(self.arrivals, self.arrivals[1:])]
+        return {
+            "client": self.index,
+            "frames": len(self.arrivals),
+            "fps": round(len(self.arrivals) / duration, 3),
+            "kbytes_per_s": round(self.bytes / 1024.0 / duration, 1),
+            "connects": self.connects,
+            "errors": self.errors,
+            "interval_ms": summarize(intervals),
+        }
+
+
+def clock_offset(args, samples):
+    """Camera clock minus local monotonic clock in seconds, from the /clock
+    reply with the shortest round trip. Returns (offset, rtt, local time)."""
+    best = None
+    conn = http.client.HTTPConnection(args.host, args.stream_port, timeout=args.timeout)
+    try:
+        for _ in range(samples):
+            start = time.monotonic()
+            conn.request("GET", "/clock")
+            reply = json.loads(conn.getresponse().read())
+            end = time.monotonic()
+            midpoint = (start + end) / 2.0
+            sample = (reply["us"] / 1e6 - midpoint, end - start, midpoint)
+            if best is None or sample[1] < best[1]:
+                best = sample
+    finally:
+        conn.close()
+    return best
+
+
+def latency_report(streams, before, after, budget_ms):
+    """Capture-to-receive latency and sequence gaps over every stream client"""
+    # Over long runs the offset is interpolated to follow clock drift; on
+    # short ones round trip noise would dominate, so the better sample wins
+    if after[2] - before[2] >= 60.0:
+        drift = (after[0] - before[0]) / (after[2] - before[2])
+    else:
+        drift = 0.0
+        before = min(before, after, key=lambda sample: sample[1])
+    latencies = []
+    clients = []
+    for stream in streams:
+        dropped = gaps = reordered = 0
+        last_seq = None
+        for arrival, captured, seq in stream.parts:
+            offset = before[0] + drift * (arrival - before[2])
+            latencies.append((arrival - (captured - offset)) * 1000.0)
+            if last_seq is not None:
+                if seq > last_seq + 1:
+                    dropped += seq - last_seq - 1
+                    gaps += 1
+                elif seq <= last_seq:
+                    reordered += 1
+            last_seq = seq
+        clients.append({"client": stream.index, "frames": len(stream.parts), "dropped_seq": dropped,
+                        "gaps": gaps, "repeated_or_reordered": reordered})
+    within = sum(1 for v in latencies if v <= budget_ms)
+    return {
+        "clock": {
+            "offset_s": round(before[0], 6),
+            "rtt_ms": round(max(before[1], after[1]) * 1000.0, 3),
+            "drift_ppm": round(drift * 1e6, 1),
+        },
+        "frames": len(latencies),
+        "latency_ms": summarize(latencies),
+        "budget_ms": budget_ms,
+        "within_budget": round(within / len(latencies), 4) if latencies else None,
+        "clients": clients,
+    }
+
+
+def fetch_json(args, path):
+    conn = http.client.HTTPConnection(args.host, args.port, timeout=args.timeout)
+    try:
+        conn.request("GET", path)
+        return json.loads(conn.getresponse().read())
+    except (OSError, ValueError, http.client.HTTPException):
+        return None
+    finally:
+        conn.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=80, help="control server port")
+    parser.add_argument("--stream-port", type=int, default=81)
+    parser.add_argument("--duration", type=float, default=30.0, help="seconds")
+    parser.add_argument("--timeout", type=float, default=5.0, help="socket timeout in seconds")
+    parser.add_argument("--streams", type=int, default=2, help="concurrent /stream clients")
+    parser.add_argument("--capture-rate", type=float, default=1.0, help="/capture requests per second, 0 = off")
+    parser.add_argument("--status-rate", type=float, default=2.0, help="/status requests per second, 0 = off")
+    parser.add_argument("--ai-rate", type=float, default=5.0, help="/gpio/ai/read requests per second, 0 = off")
+    parser.add_argument("--ai-pin", type=int, default=4)
+    parser.add_argument("--control-burst", type=int, default=5, help="/control requests per burst, 0 = off")
+    parser.add_argument("--control-interval", type=float, default=5.0, help="seconds between bursts")
+    parser.add_argument("--control-var", default="quality")
+    parser.add_argument("--control-values", default="10,12", help="values cycled through by the bursts")
+    parser.add_argument("--latency", action="store_true",
+                        help="measure capture-to-receive latency and dropped frames from the part headers")
+    parser.add_argument("--latency-budget", type=float, default=150.0, help="ms, reports the share of frames within")
+    parser.add_argument("--clock-samples", type=int, default=20, help="/clock requests per offset estimate")
+    parser.add_argument("--label", default="", help="free text copied into the report")
+    parser.add_argument("--output", help="write the JSON report here instead of stdout")
+    args = parser.parse_args()
+
+    stop = threading.Event()
+    endpoints = {}
+    workers = []
+
+    def poll(name, path, rate):
+        if rate > 0:
+            endpoints[name] = EndpointStats()
+            workers.append(Poller(args, path, rate, endpoints[name], stop))
+
+    poll("/capture", "/capture", args.capture_rate)
+    poll("/status", "/status", args.status_rate)
+    poll("/gpio/ai/read", "/gpio/ai/read?pin=%d" % args.ai_pin, args.ai_rate)
+    if args.control_burst > 0:
+        endpoints["/control"] = EndpointStats()
+        workers.append(ControlBurster(args, endpoints["/control"], stop))
+    streams = [StreamClient(args, i, stop) for i in range(args.streams)]
+
+    if args.latency:
+        before = clock_offset(args, args.clock_samples)
+        # Start the server's per-stage histograms from zero for this run
+        fetch_json(args, "/debug/latency?reset=1")
+
+    started = time.monotonic()
+    for worker in streams + workers:
+        worker.start()
+    try:
+        stop.wait(args.duration)
+    except KeyboardInterrupt:
+        pass
+    stop.set()
+    duration = time.monotonic() - started
+    for worker in streams + workers:
+        worker.join(args.timeout + 1.0)
+
+    latency = None
+    if args.latency:
+        after = clock_offset(args, args.clock_samples)
+        latency = latency_report(streams, before, after, args.latency_budget)
+        # Where the time goes inside the camera
+        latency["server_stages"] = fetch_json(args, "/debug/latency")
+
+    report = {
+        "label": args.label,
+        "target": "%s:%d/%d" % (args.host, args.port, args.stream_port),
+        "started": time.strftime("%Y-%m-%dT%H:%M:%S", time.localtime(time.time() - duration)),
+        "duration_s": round(duration, 3),
+        "config": {k: v for k, v in vars(args).items() if k not in ("output", "label")},
+        "streams": [s.report(duration) for s in streams],
+        "endpoints": {name: stats.report() for name, stats in endpoints.items()},
+    }
+    if latency is not None:
+        report["latency"] = latency
+    text = json.dumps(report, indent=2)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+    else:
+        print(text)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
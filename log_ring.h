@@ -0,0 +1,222 @@
+#pragma once
+
+#include <stdarg.h>
+#include "esp_timer.h"
+#include "esp_http_server.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Asynchronous log ring.
+// LOGR_* macros format into a slot of an in-memory ring and return; nothing
+// on the capture or request paths waits for the UART any more. A low
+// priority task drains the ring to Serial, and /log?since= reads it over HTTP.
+
+#define LOGR_LEVEL_NONE 0
+#define LOGR_LEVEL_ERROR 1
+#define LOGR_LEVEL_WARN 2
+#define LOGR_LEVEL_INFO 3
+#define LOGR_LEVEL_DEBUG 4
+
+// Messages above this level are compiled out entirely
+#ifndef LOG_RING_COMPILE_LEVEL
+#define LOG_RING_COMPILE_LEVEL LOGR_LEVEL_INFO
+#endif
+
+#define LOG_RING_SLOTS 128       // Power of two
+#define LOG_RING_MSG_LEN 120
+#define LOG_RING_DRAIN_STACK 3072
+#define LOG_RING_DRAIN_PRIORITY (tskIDLE_PRIORITY + 1)
+#define LOG_RING_DRAIN_INTERVAL pdMS_TO_TICKS(20)
+
+typedef struct {
+  volatile uint32_t seq;     // Sequence number + 1 once complete, 0 while written
+  uint32_t time_ms;
+  uint8_t level;
+  char msg[LOG_RING_MSG_LEN];
+} log_ring_entry_t;
+
+static log_ring_entry_t log_ring[LOG_RING_SLOTS];
+static volatile uint32_t log_ring_head = 0;     // Next sequence number to hand out
+static volatile int log_ring_level = LOG_RING_COMPILE_LEVEL;
+static TaskHandle_t log_ring_task = NULL;
+
+static const char log_ring_level_chars[] = {'N', 'E', 'W', 'I', 'D'};
+
+// Claim the next slot and format into it. Producers never wait for each
+// other; when the ring wraps the oldest entries are overwritten.
+static void log_ring_write(int level, const char *fmt, ...) {
+  uint32_t seq = __atomic_fetch_add(&log_ring_head, 1, __ATOMIC_RELAXED);
+  log_ring_entry_t *entry = &log_ring[seq & (LOG_RING_SLOTS - 1)];
+
+  __atomic_store_n(&entry->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  entry->time_ms = (uint32_t)(esp_timer_get_time() / 1000);
+  entry->level = level;
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(entry->msg, sizeof(entry->msg), fmt, args);
+  va_end(args);
+  __atomic_store_n(&entry->seq, seq + 1, __ATOMIC_RELEASE);
+
+  if (log_ring_task) {
+    xTaskNotifyGive(log_ring_task);
+  }
+}
+
+#define LOGR(level, fmt, ...)                                                   \
+  do {                                                                          \
+    if ((level) <= LOG_RING_COMPILE_LEVEL && (level) <= log_ring_level) {       \
+      log_ring_write((level), fmt, ##__VA_ARGS__);                              \
+    }                                                                           \
+  } while (0)
+#define LOGR_E(fmt, ...) LOGR(LOGR_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define LOGR_W(fmt, ...) LOGR(LOGR_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define LOGR_I(fmt, ...) LOGR(LOGR_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LOGR_D(fmt, ...) LOGR(LOGR_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+// Copy entry seq out of the ring. False if it was overwritten or is still
+// being written.
+static bool log_ring_read(uint32_t seq, log_ring_entry_t *out) {
+  log_ring_entry_t *entry = &log_ring[seq & (LOG_RING_SLOTS - 1)];
+  if (__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) != seq + 1) {
+    return false;
+  }
+  memcpy(out, entry, sizeof(*out));
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  // A producer may have reused the slot while we copied
+  return __atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == seq + 1;
+}
+
+// Oldest sequence number that can still be in the ring
+static uint32_t log_ring_oldest(uint32_t head) {
+  return head > LOG_RING_SLOTS ? head - LOG_RING_SLOTS : 0;
+}
+
+static void log_ring_drain_task(void *arg) {
+  uint32_t next = 0;
+  log_ring_entry_t entry;
+
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, LOG_RING_DRAIN_INTERVAL);
+
+    uint32_t head = __atomic_load_n(&log_ring_head, __ATOMIC_ACQUIRE);
+    if (next < log_ring_oldest(head)) {
+      Serial.printf("[log] %u messages lost\n", log_ring_oldest(head) - next);
+      next = log_ring_oldest(head);
+    }
+    while (next != head) {
+      if (!log_ring_read(next, &entry)) {
+        // Not committed yet (0 or the previous lap's number): pick it up on
+        // the next pass. Otherwise it was already overwritten.
+        uint32_t committed = __atomic_load_n(&log_ring[next & (LOG_RING_SLOTS - 1)].seq, __ATOMIC_RELAXED);
+        if (committed <= next) {
+          break;
+        }
+        next++;
+        continue;
+      }
+      Serial.printf("%u.%03u %c %s\n", entry.time_ms / 1000, entry.time_ms % 1000,
+                    log_ring_level_chars[entry.level], entry.msg);
+      next++;
+    }
+  }
+}
+
+// Start the task that writes the ring to Serial
+bool log_ring_init() {
+  if (log_ring_task) {
+    return true;
+  }
+  if (xTaskCreate(log_ring_drain_task, "log", LOG_RING_DRAIN_STACK, NULL,
+                  LOG_RING_DRAIN_PRIORITY, &log_ring_task) != pdPASS) {
+    log_ring_task = NULL;
+    Serial.println("Failed to start log drain task");
+    return false;
+  }
+  return true;
+}
+
+// Append s to p as a JSON string body
+static char *log_ring_json_escape(char *p, const char *s) {
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      *p++ = '\\';
+      *p++ = *s;
+    } else if ((unsigned char)*s < 0x20) {
+      p += sprintf(p, "\\u%04x", *s);
+    } else {
+      *p++ = *s;
+    }
+  }
+  return p;
+}
+
+// Handler for reading the ring: /log?since=<seq>, optional &level=<0-4>
+// changes the runtime level
+static esp_err_t log_handler(httpd_req_t *req) {
+  char query[64];
+  char param[16];
+  uint32_t head = __atomic_load_n(&log_ring_head, __ATOMIC_ACQUIRE);
+  uint32_t since = log_ring_oldest(head);
+
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    if (httpd_query_key_value(query, "since", param, sizeof(param)) == ESP_OK) {
+      since = strtoul(param, NULL, 10);
+    }
+    if (httpd_query_key_value(query, "level", param, sizeof(param)) == ESP_OK) {
+      log_ring_level = constrain(atoi(param), LOGR_LEVEL_NONE, LOGR_LEVEL_DEBUG);
+    }
+  }
+
+  uint32_t lost = 0;
+  if (since < log_ring_oldest(head)) {
+    lost = log_ring_oldest(head) - since;
+    since = log_ring_oldest(head);
+  }
+  if (since > head) {
+    since = head;
+  }
+
+  // One escaped entry fits in 7x its message plus the fixed part
+  const size_t buf_size = 1024;
+  const size_t entry_max = LOG_RING_MSG_LEN * 6 + 64;
+  char *buf = (char *)malloc(buf_size + entry_max);
+  if (!buf) {
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  esp_err_t res = ESP_OK;
+  char *p = buf;
+  p += sprintf(p, "{\"level\":%d,\"lost\":%u,\"entries\":[", log_ring_level, lost);
+  bool first = true;
+  log_ring_entry_t entry;
+  uint32_t seq;
+  for (seq = since; seq != head && res == ESP_OK; seq++) {
+    if (!log_ring_read(seq, &entry)) {
+      continue;
+    }
+    p += sprintf(p, "%s{\"seq\":%u,\"ms\":%u,\"level\":\"%c\",\"msg\":\"", first ? "" : ",",
+                 seq, entry.time_ms, log_ring_level_chars[entry.level]);
+    p = log_ring_json_escape(p, entry.msg);
+    p += sprintf(p, "\"}");
+    first = false;
+    if ((size_t)(p - buf) >= buf_size) {
+      res = httpd_resp_send_chunk(req, buf, p - buf);
+      p = buf;
+    }
+  }
+  // Pass next back as since= to continue where this response ended
+  p += sprintf(p, "],\"next\":%u}", seq);
+  if (res == ESP_OK) {
+    res = httpd_resp_send_chunk(req, buf, p - buf);
+  }
+  if (res == ESP_OK) {
+    res = httpd_resp_send_chunk(req, NULL, 0);
+  }
+  free(buf);
+  return res;
+}
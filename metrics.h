@@ -0,0 +1,394 @@
+#pragma once
+
+#include "esp_timer.h"
+#include "esp_camera.h"
+#include "esp_heap_caps.h"
+#include "esp_http_server.h"
+
+// Lock-free counters, gauges and histograms for the streaming hot paths.
+// Writers only use 32-bit atomic read-modify-write operations, which the
+// ESP32-S3 does in hardware, so updating a metric never takes a lock and
+// never blocks. /metrics renders the registry in Prometheus text format.
+
+// 64-bit counter built from two 32-bit words. The high word is bumped by
+// whoever wraps the low word; readers retry until they see a stable high word.
+typedef struct {
+  volatile uint32_t lo;
+  volatile uint32_t hi;
+} metric_counter_t;
+
+static inline void metric_add(metric_counter_t *m, uint32_t v) {
+  uint32_t old = __atomic_fetch_add(&m->lo, v, __ATOMIC_RELAXED);
+  if ((uint32_t)(old + v) < old) {
+    __atomic_fetch_add(&m->hi, 1, __ATOMIC_RELAXED);
+  }
+}
+
+static inline void metric_inc(metric_counter_t *m) {
+  metric_add(m, 1);
+}
+
+static inline uint64_t metric_read(metric_counter_t *m) {
+  uint32_t hi, lo;
+  do {
+    hi = __atomic_load_n(&m->hi, __ATOMIC_RELAXED);
+    lo = __atomic_load_n(&m->lo, __ATOMIC_RELAXED);
+  } while (hi != __atomic_load_n(&m->hi, __ATOMIC_RELAXED));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+// Log-scale histogram of microsecond durations. Each power of two is split
+// into METRIC_HIST_SUB sub-buckets, covering 1us up to about 33s.
+#define METRIC_HIST_SUB_BITS 2
+#define METRIC_HIST_SUB (1 << METRIC_HIST_SUB_BITS)
+#define METRIC_HIST_OCTAVES 24
+#define METRIC_HIST_BUCKETS (METRIC_HIST_OCTAVES * METRIC_HIST_SUB)
+
+typedef struct {
+  volatile uint32_t buckets[METRIC_HIST_BUCKETS];
+  metric_counter_t count;
+  metric_counter_t sum;
+  volatile uint32_t max;
+} metric_histogram_t;
+
+static inline int metric_hist_bucket(uint32_t us) {
+  if (us < METRIC_HIST_SUB) {
+    return us;
+  }
+  int octave = 31 - __builtin_clz(us);
+  int sub = (us >> (octave - METRIC_HIST_SUB_BITS)) & (METRIC_HIST_SUB - 1);
+  int bucket = (octave - METRIC_HIST_SUB_BITS + 1) * METRIC_HIST_SUB + sub;
+  return bucket < METRIC_HIST_BUCKETS ? bucket : METRIC_HIST_BUCKETS - 1;
+}
+
+// Smallest value that falls into the bucket after 'bucket'
+static inline uint64_t metric_hist_upper(int bucket) {
+  int next = bucket + 1;
+  if (next < METRIC_HIST_SUB) {
+    return next;
+  }
+  int octave = next / METRIC_HIST_SUB + METRIC_HIST_SUB_BITS - 1;
+  int sub = next % METRIC_HIST_SUB;
+  return ((uint64_t)(METRIC_HIST_SUB + sub)) << (octave - METRIC_HIST_SUB_BITS);
+}
+
+static inline uint64_t metric_hist_lower(int bucket) {
+  return bucket ? metric_hist_upper(bucket - 1) : 0;
+}
+
+static inline void metric_observe(metric_histogram_t *h, int64_t us) {
+  uint32_t v = us < 0 ? 0 : (us > UINT32_MAX ? UINT32_MAX : (uint32_t)us);
+  __atomic_fetch_add(&h->buckets[metric_hist_bucket(v)], 1, __ATOMIC_RELAXED);
+  metric_inc(&h->count);
+  metric_add(&h->sum, v);
+  uint32_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+  while (v > max && !__atomic_compare_exchange_n(&h->max, &max, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+// Zero a histogram. Observations racing with the reset may survive it.
+static void metric_hist_reset(metric_histogram_t *h) {
+  for (int i = 0; i < METRIC_HIST_BUCKETS; i++) {
+    __atomic_store_n(&h->buckets[i], 0, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&h->count.hi, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->count.lo, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->sum.hi, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->sum.lo, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->max, 0, __ATOMIC_RELAXED);
+}
+
+// Estimate quantile q (0..1) in microseconds by interpolating inside the
+// bucket that holds the requested rank
+static uint32_t metric_hist_quantile(metric_histogram_t *h, float q) {
+  uint32_t counts[METRIC_HIST_BUCKETS];
+  uint64_t total = 0;
+  for (int i = 0; i < METRIC_HIST_BUCKETS; i++) {
+    counts[i] = __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+    total += counts[i];
+  }
+  if (!total) {
+    return 0;
+  }
+
+  uint64_t rank = (uint64_t)(q * total + 0.5f);
+  if (rank < 1) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < METRIC_HIST_BUCKETS; i++) {
+    if (counts[i] && seen + counts[i] >= rank) {
+      uint64_t lower = metric_hist_lower(i);
+      uint64_t width = metric_hist_upper(i) - lower;
+      uint32_t value = lower + width * (rank - seen) / counts[i];
+      uint32_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+      return value < max ? value : max;
+    }
+    seen += counts[i];
+  }
+  return __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+}
+
+// Streaming pipeline
+static metric_counter_t metric_frames_captured;
+static metric_counter_t metric_frames_sent;
+static metric_counter_t metric_stream_bytes;
+static metric_counter_t metric_frames_dropped_backlog;
+static metric_counter_t metric_frames_dropped_paced;
+static metric_counter_t metric_frames_dropped_settling;
+static metric_counter_t metric_capture_failures;
+static metric_counter_t metric_capture_snapshot;
+static metric_counter_t metric_capture_not_modified;
+static metric_counter_t metric_capture_sensor;
+static metric_counter_t metric_status_renders;
+static metric_counter_t metric_status_not_modified;
+static metric_counter_t metric_events_published;
+static metric_counter_t metric_events_resync;
+static metric_counter_t metric_adc_frames;
+static metric_counter_t metric_adc_frames_lost;
+static metric_histogram_t metric_fb_get_wait;
+static metric_histogram_t metric_jpeg_encode;
+static metric_histogram_t metric_jpeg_transcode;
+static metric_histogram_t metric_frame_age;
+static metric_histogram_t metric_stream_header_send;
+static metric_histogram_t metric_stream_payload_send;
+static metric_histogram_t metric_stream_send;
+static volatile int32_t metric_stream_clients;
+static volatile int32_t metric_event_clients;
+
+typedef struct {
+  const char *name;
+  const char *help;
+  metric_counter_t *counter;
+} metric_counter_desc_t;
+
+typedef struct {
+  const char *name;
+  const char *stage;         // Short name on /debug/latency
+  const char *help;
+  metric_histogram_t *histogram;
+} metric_histogram_desc_t;
+
+static const metric_counter_desc_t metric_counters[] = {
+  {"camera_frames_captured_total", "Frames taken from the sensor by the capture task", &metric_frames_captured},
+  {"camera_stream_frames_sent_total", "Frames completely written to stream clients", &metric_frames_sent},
+  {"camera_stream_bytes_total", "Bytes written to stream clients", &metric_stream_bytes},
+  {"camera_stream_frames_dropped_backlog_total", "Frames skipped because a client link was busy", &metric_frames_dropped_backlog},
+  {"camera_stream_frames_dropped_paced_total", "Frames skipped by a client's fps/maxkbps limit", &metric_frames_dropped_paced},
+  {"camera_frames_dropped_settling_total", "Frames discarded because they started before a /control change", &metric_frames_dropped_settling},
+  {"camera_capture_failures_total", "esp_camera_fb_get calls that returned no frame", &metric_capture_failures},
+  {"camera_capture_snapshot_hits_total", "/capture requests served from the snapshot cache", &metric_capture_snapshot},
+  {"camera_capture_not_modified_total", "/capture requests answered with 304 Not Modified", &metric_capture_not_modified},
+  {"camera_capture_sensor_total", "/capture requests that took a new frame from the sensor", &metric_capture_sensor},
+  {"camera_status_renders_total", "Times the /status document was rebuilt after a settings change", &metric_status_renders},
+  {"camera_status_not_modified_total", "/status requests answered with 304 Not Modified", &metric_status_not_modified},
+  {"camera_events_published_total", "Events published to /events clients", &metric_events_published},
+  {"camera_events_resync_total", "/events clients that fell a whole ring behind", &metric_events_resync},
+  {"camera_adc_frames_total", "Averaged frames read from the continuous ADC", &metric_adc_frames},
+  {"camera_adc_frames_lost_total", "ADC frames overwritten before a /gpio/ai/stream client sent them", &metric_adc_frames_lost},
+};
+
+// Pipeline stages in the order a frame passes them
+static const metric_histogram_desc_t metric_histograms[] = {
+  {"camera_fb_get_wait_seconds", "fb_get", "Time spent waiting in esp_camera_fb_get", &metric_fb_get_wait},
+  {"camera_jpeg_encode_seconds", "frame2jpg", "Time converting non-JPEG frames with frame2jpg", &metric_jpeg_encode},
+  {"camera_jpeg_transcode_seconds", "transcode", "Time cropping or downscaling a frame for ?roi= and ?scale=", &metric_jpeg_transcode},
+  {"camera_stream_frame_age_seconds", "queue", "Time from publishing a frame to a client starting to send it", &metric_frame_age},
+  {"camera_stream_header_send_seconds", "header_send", "Time until boundary and part header were written", &metric_stream_header_send},
+  {"camera_stream_payload_send_seconds", "payload_send", "Time from the part header to the last JPEG byte", &metric_stream_payload_send},
+  {"camera_stream_send_seconds", "send", "Time from starting a stream part to its last byte", &metric_stream_send},
+};
+
+// Per-endpoint request counters. Handlers are registered through
+// metrics_register_uri_handler, which counts each request before calling them.
+#define METRIC_MAX_ENDPOINTS 48
+
+typedef struct {
+  const char *uri;
+  esp_err_t (*handler)(httpd_req_t *req);
+  metric_counter_t requests;
+} metric_endpoint_t;
+
+static metric_endpoint_t metric_endpoints[METRIC_MAX_ENDPOINTS];
+static int metric_num_endpoints = 0;
+
+static esp_err_t metrics_uri_handler(httpd_req_t *req) {
+  metric_endpoint_t *endpoint = (metric_endpoint_t *)req->user_ctx;
+  metric_inc(&endpoint->requests);
+  return endpoint->handler(req);
+}
+
+// Register uri on server with its requests counted. Only called during
+// startup, before any request can arrive.
+esp_err_t metrics_register_uri_handler(httpd_handle_t server, const httpd_uri_t *uri) {
+  // One handler serving several methods of a URI is one endpoint
+  metric_endpoint_t *endpoint = NULL;
+  for (int i = 0; i < metric_num_endpoints; i++) {
+    if (metric_endpoints[i].handler == uri->handler && !strcmp(metric_endpoints[i].uri, uri->uri)) {
+      endpoint = &metric_endpoints[i];
+    }
+  }
+  if (!endpoint) {
+    if (metric_num_endpoints >= METRIC_MAX_ENDPOINTS) {
+      return httpd_register_uri_handler(server, uri);
+    }
+    endpoint = &metric_endpoints[metric_num_endpoints++];
+    endpoint->uri = uri->uri;
+    endpoint->handler = uri->handler;
+  }
+
+  httpd_uri_t counted = *uri;
+  counted.handler = metrics_uri_handler;
+  counted.user_ctx = endpoint;
+  return httpd_register_uri_handler(server, &counted);
+}
+
+// Buffered chunked writer for the text exposition
+typedef struct {
+  httpd_req_t *req;
+  char buf[1024];
+  size_t len;
+  esp_err_t res;
+} metrics_writer_t;
+
+static void metrics_flush(metrics_writer_t *w) {
+  if (w->len && w->res == ESP_OK) {
+    w->res = httpd_resp_send_chunk(w->req, w->buf, w->len);
+  }
+  w->len = 0;
+}
+
+static void metrics_printf(metrics_writer_t *w, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(w->buf + w->len, sizeof(w->buf) - w->len, fmt, args);
+  va_end(args);
+  if (n >= 0 && (size_t)n >= sizeof(w->buf) - w->len) {
+    // Line did not fit, send what we have and format it again
+    w->buf[w->len] = '\0';
+    metrics_flush(w);
+    va_start(args, fmt);
+    n = vsnprintf(w->buf, sizeof(w->buf), fmt, args);
+    va_end(args);
+  }
+  if (n > 0) {
+    w->len += ((size_t)n < sizeof(w->buf) - w->len) ? n : sizeof(w->buf) - w->len - 1;
+  }
+}
+
+static void metrics_write_histogram(metrics_writer_t *w, const metric_histogram_desc_t *desc) {
+  metric_histogram_t *h = desc->histogram;
+  uint64_t cumulative = 0;
+
+  metrics_printf(w, "# HELP %s %s\n# TYPE %s histogram\n", desc->name, desc->help, desc->name);
+  // Export one bucket per power of two to keep the page small
+  for (int i = 0; i < METRIC_HIST_BUCKETS; i++) {
+    cumulative += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+    if ((i + 1) % METRIC_HIST_SUB == 0) {
+      metrics_printf(w, "%s_bucket{le=\"%.6f\"} %llu\n", desc->name,
+                     metric_hist_upper(i) / 1000000.0, (unsigned long long)cumulative);
+    }
+  }
+  metrics_printf(w, "%s_bucket{le=\"+Inf\"} %llu\n", desc->name, (unsigned long long)cumulative);
+  metrics_printf(w, "%s_sum %.6f\n", desc->name, metric_read(&h->sum) / 1000000.0);
+  metrics_printf(w, "%s_count %llu\n", desc->name, (unsigned long long)metric_read(&h->count));
+}
+
+// Handler for the Prometheus text exposition
+static esp_err_t metrics_handler(httpd_req_t *req) {
+  metrics_writer_t *w = (metrics_writer_t *)malloc(sizeof(metrics_writer_t));
+  if (!w) {
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+  w->req = req;
+  w->len = 0;
+  w->res = ESP_OK;
+
+  httpd_resp_set_type(req, "text/plain; version=0.0.4");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  for (size_t i = 0; i < sizeof(metric_counters) / sizeof(metric_counters[0]); i++) {
+    const metric_counter_desc_t *desc = &metric_counters[i];
+    metrics_printf(w, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", desc->name, desc->help, desc->name,
+                   desc->name, (unsigned long long)metric_read(desc->counter));
+  }
+
+  for (size_t i = 0; i < sizeof(metric_histograms) / sizeof(metric_histograms[0]); i++) {
+    metrics_write_histogram(w, &metric_histograms[i]);
+  }
+
+  metrics_printf(w, "# HELP camera_http_requests_total Requests per endpoint\n# TYPE camera_http_requests_total counter\n");
+  for (int i = 0; i < metric_num_endpoints; i++) {
+    metrics_printf(w, "camera_http_requests_total{endpoint=\"%s\"} %llu\n", metric_endpoints[i].uri,
+                   (unsigned long long)metric_read(&metric_endpoints[i].requests));
+  }
+
+  sensor_t *s = esp_camera_sensor_get();
+  metrics_printf(w, "# HELP camera_stream_clients Connected stream clients\n# TYPE camera_stream_clients gauge\ncamera_stream_clients %d\n",
+                 (int)__atomic_load_n(&metric_stream_clients, __ATOMIC_RELAXED));
+  metrics_printf(w, "# HELP camera_event_clients Connected /events clients\n# TYPE camera_event_clients gauge\ncamera_event_clients %d\n",
+                 (int)__atomic_load_n(&metric_event_clients, __ATOMIC_RELAXED));
+  if (s) {
+    metrics_printf(w, "# HELP camera_jpeg_quality Current sensor JPEG quality\n# TYPE camera_jpeg_quality gauge\ncamera_jpeg_quality %d\n",
+                   s->status.quality);
+    metrics_printf(w, "# HELP camera_framesize Current sensor frame size\n# TYPE camera_framesize gauge\ncamera_framesize %d\n",
+                   s->status.framesize);
+  }
+  metrics_printf(w, "# HELP camera_heap_free_bytes Free internal heap\n# TYPE camera_heap_free_bytes gauge\ncamera_heap_free_bytes %u\n",
+                 (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+  metrics_printf(w, "# HELP camera_psram_free_bytes Free PSRAM\n# TYPE camera_psram_free_bytes gauge\ncamera_psram_free_bytes %u\n",
+                 (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+  metrics_printf(w, "# HELP camera_uptime_seconds Time since boot\n# TYPE camera_uptime_seconds gauge\ncamera_uptime_seconds %.3f\n",
+                 esp_timer_get_time() / 1000000.0);
+
+  metrics_flush(w);
+  esp_err_t res = w->res;
+  free(w);
+  if (res == ESP_OK) {
+    res = httpd_resp_send_chunk(req, NULL, 0);
+  }
+  return res;
+}
+
+// Handler for per-stage latency percentiles, ?reset=1 clears all stages
+static esp_err_t latency_debug_handler(httpd_req_t *req) {
+  char query[64];
+  char param[8];
+  bool reset = false;
+
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "reset", param, sizeof(param)) == ESP_OK) {
+    reset = (strcmp(param, "1") == 0 || strcmp(param, "true") == 0);
+  }
+
+  const size_t num_stages = sizeof(metric_histograms) / sizeof(metric_histograms[0]);
+  char *response = (char *)malloc(160 * num_stages + 64);
+  if (!response) {
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+
+  // Values are in microseconds
+  char *p = response;
+  p += sprintf(p, "{\"unit\":\"us\",\"stages\":{");
+  for (size_t i = 0; i < num_stages; i++) {
+    metric_histogram_t *h = metric_histograms[i].histogram;
+    uint64_t count = metric_read(&h->count);
+    p += sprintf(p, "%s\"%s\":{\"count\":%llu,\"mean\":%llu,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u}",
+                 i ? "," : "", metric_histograms[i].stage, (unsigned long long)count,
+                 (unsigned long long)(count ? metric_read(&h->sum) / count : 0),
+                 metric_hist_quantile(h, 0.50f), metric_hist_quantile(h, 0.90f),
+                 metric_hist_quantile(h, 0.99f), (unsigned)__atomic_load_n(&h->max, __ATOMIC_RELAXED));
+    if (reset) {
+      metric_hist_reset(h);
+    }
+  }
+  p += sprintf(p, "},\"reset\":%s}", reset ? "true" : "false");
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  esp_err_t res = httpd_resp_send(req, response, strlen(response));
+  free(response);
+  return res;
+}
@@ -13,12 +13,16 @@ struct NetworkConfig {
   uint8_t dns1[4];
   uint8_t dns2[4];
   char hostname[32];
+  uint16_t stream_port;
 };
 
 // EEPROM address for network configuration
 #define EEPROM_NETWORK_CONFIG_ADDR 0
 #define EEPROM_CONFIG_VALID_FLAG 0xAB
-#define EEPROM_SIZE 512
+#define EEPROM_SIZE 2048   // Network configuration, then camera profiles at 512
+
+// Port of the dedicated /stream server
+#define DEFAULT_STREAM_PORT 81
 
 // Global network configuration
 NetworkConfig networkConfig;
@@ -31,6 +35,11 @@ bool loadNetworkConfig() {
   }
   
   EEPROM.get(EEPROM_NETWORK_CONFIG_ADDR + 1, networkConfig);
+
+  // Configurations saved before stream_port existed read back as 0
+  if (networkConfig.stream_port == 0 || networkConfig.stream_port == 0xFFFF) {
+    networkConfig.stream_port = DEFAULT_STREAM_PORT;
+  }
   Serial.println("Network configuration loaded from EEPROM");
   return true;
 }
@@ -102,6 +111,9 @@ void initDefaultNetworkConfig() {
   
   // Default hostname: esp32-ethernet
   strcpy(networkConfig.hostname, "esp32-ethernet");
+
+  // Default stream port: 81
+  networkConfig.stream_port = DEFAULT_STREAM_PORT;
 }
 
 // Initialize network configuration system
@@ -147,6 +159,7 @@ static esp_err_t network_config_get_handler(httpd_req_t *req) {
   
   // Hostname
   p += sprintf(p, "  \"hostname\": \"%s\",\n", networkConfig.hostname);
+  p += sprintf(p, "  \"stream_port\": %u,\n", networkConfig.stream_port);
   
   // Current network status
   p += sprintf(p, "  \"current_ip\": \"%s\",\n", ETH.localIP().toString().c_str());
@@ -243,6 +256,14 @@ static esp_err_t network_config_set_handler(httpd_req_t *req) {
     networkConfig.hostname[sizeof(networkConfig.hostname) - 1] = '\0';
   }
   
+  // Parse stream port if provided (takes effect after restart)
+  if (httpd_query_key_value(query, "stream_port", param, sizeof(param)) == ESP_OK) {
+    int port = atoi(param);
+    if (port > 0 && port <= 65535 && port != 80) {
+      networkConfig.stream_port = port;
+    }
+  }
+  
   // Check if we should apply the configuration immediately
   bool apply_now = false;
   if (httpd_query_key_value(query, "apply", param, sizeof(param)) == ESP_OK) {
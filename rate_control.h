@@ -0,0 +1,245 @@
+#pragma once
+
+#include "esp_camera.h"
+#include "esp_timer.h"
+#include "esp_http_server.h"
+#include "status_cache.h"
+
+// Global bandwidth governor.
+// Once a second the capture task compares the bitrate the stream clients
+// ask for against a target and steps the sensor JPEG quality (and
+// optionally the frame size) to get the best image that fits the link.
+
+#define RATE_CONTROL_PERIOD_US 1000000LL
+#define RATE_CONTROL_DEFAULT_KBPS 8000
+#define RATE_CONTROL_SETTLE_PERIODS 2
+
+typedef struct {
+  // Settings
+  bool enabled;
+  uint32_t target_kbps;
+  int min_quality;           // Best quality the governor may pick
+  int max_quality;           // Worst quality the governor may pick
+  bool adjust_framesize;
+  int min_framesize;
+  int max_framesize;
+
+  // Measurements of the last period
+  uint32_t fps;
+  uint32_t avg_frame_bytes;
+  uint32_t sent_kbps;
+  uint32_t offered_kbps;
+  int settle;
+} rate_control_t;
+
+static rate_control_t rate_control = {
+  false, RATE_CONTROL_DEFAULT_KBPS, 6, 40, false, FRAMESIZE_QVGA, FRAMESIZE_UXGA,
+  0, 0, 0, 0, 0
+};
+
+// Counters of the running period
+static uint32_t rate_frames = 0;
+static uint64_t rate_frame_bytes = 0;
+static uint64_t rate_sent_bytes = 0;
+static uint32_t rate_sent_frames = 0;
+static uint32_t rate_backlog_drops = 0;
+static int64_t rate_period_start = 0;
+static portMUX_TYPE rate_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Called by the capture task for every published frame
+void rate_control_frame(size_t len) {
+  portENTER_CRITICAL(&rate_mux);
+  rate_frames++;
+  rate_frame_bytes += len;
+  portEXIT_CRITICAL(&rate_mux);
+}
+
+// Called by stream sessions for every write to a client
+void rate_control_sent(size_t bytes) {
+  portENTER_CRITICAL(&rate_mux);
+  rate_sent_bytes += bytes;
+  portEXIT_CRITICAL(&rate_mux);
+}
+
+// Called by stream sessions when a part went out completely
+void rate_control_part_sent() {
+  portENTER_CRITICAL(&rate_mux);
+  rate_sent_frames++;
+  portEXIT_CRITICAL(&rate_mux);
+}
+
+// Called by stream sessions for a frame skipped because the link was busy.
+// Frames skipped for a client's own fps/maxkbps limit are not counted.
+void rate_control_backlog_drop() {
+  portENTER_CRITICAL(&rate_mux);
+  rate_backlog_drops++;
+  portEXIT_CRITICAL(&rate_mux);
+}
+
+// Close the period and step quality/framesize towards the target
+void rate_control_update() {
+  int64_t now = esp_timer_get_time();
+  if (!rate_period_start) {
+    rate_period_start = now;
+    return;
+  }
+  int64_t elapsed = now - rate_period_start;
+  if (elapsed < RATE_CONTROL_PERIOD_US) {
+    return;
+  }
+
+  portENTER_CRITICAL(&rate_mux);
+  uint32_t frames = rate_frames;
+  uint64_t frame_bytes = rate_frame_bytes;
+  uint64_t sent_bytes = rate_sent_bytes;
+  uint32_t wanted_frames = rate_sent_frames + rate_backlog_drops;
+  rate_frames = 0;
+  rate_frame_bytes = 0;
+  rate_sent_bytes = 0;
+  rate_sent_frames = 0;
+  rate_backlog_drops = 0;
+  portEXIT_CRITICAL(&rate_mux);
+  rate_period_start = now;
+
+  rate_control.fps = frames * 1000000LL / elapsed;
+  rate_control.avg_frame_bytes = frames ? frame_bytes / frames : 0;
+  rate_control.sent_kbps = sent_bytes * 8 * 1000 / elapsed;
+  // What the clients would have received had none of them fallen behind
+  rate_control.offered_kbps = (uint64_t)rate_control.avg_frame_bytes * wanted_frames * 8 * 1000 / elapsed;
+
+  if (!rate_control.enabled || !wanted_frames || !rate_control.target_kbps) {
+    return;
+  }
+  if (rate_control.settle > 0) {
+    rate_control.settle--;
+    return;
+  }
+
+  sensor_t *s = esp_camera_sensor_get();
+  if (!s || s->pixformat != PIXFORMAT_JPEG) {
+    return;
+  }
+
+  int quality = s->status.quality;
+  int framesize = s->status.framesize;
+  uint32_t target = rate_control.target_kbps;
+  uint32_t offered = rate_control.offered_kbps;
+
+  if (offered > target + target / 20) {
+    // Over budget: lower the quality, harder the further off we are
+    int step = 1 + (offered - target) * 10 / target;
+    if (step > 8) {
+      step = 8;
+    }
+    if (quality < rate_control.max_quality) {
+      quality += step;
+      if (quality > rate_control.max_quality) {
+        quality = rate_control.max_quality;
+      }
+      s->set_quality(s, quality);
+      rate_control.settle = 1;
+      status_cache_notify();
+    } else if (rate_control.adjust_framesize && framesize > rate_control.min_framesize) {
+      s->set_framesize(s, (framesize_t)(framesize - 1));
+      rate_control.settle = RATE_CONTROL_SETTLE_PERIODS;
+      status_cache_notify();
+    }
+  } else if (offered < target - target / 5) {
+    // Headroom: improve the quality one step at a time
+    if (quality > rate_control.min_quality) {
+      s->set_quality(s, quality - 1);
+      rate_control.settle = 1;
+      status_cache_notify();
+    } else if (rate_control.adjust_framesize && framesize < rate_control.max_framesize &&
+               offered < target / 2) {
+      s->set_framesize(s, (framesize_t)(framesize + 1));
+      rate_control.settle = RATE_CONTROL_SETTLE_PERIODS;
+      status_cache_notify();
+    }
+  }
+}
+
+// Handler for reading the governor state
+static esp_err_t rate_control_get_handler(httpd_req_t *req) {
+  char response[512];
+  sensor_t *s = esp_camera_sensor_get();
+
+  snprintf(response, sizeof(response),
+           "{"
+           "\"enabled\":%s,"
+           "\"target_kbps\":%u,"
+           "\"min_quality\":%d,"
+           "\"max_quality\":%d,"
+           "\"adjust_framesize\":%s,"
+           "\"min_framesize\":%d,"
+           "\"max_framesize\":%d,"
+           "\"quality\":%d,"
+           "\"framesize\":%d,"
+           "\"fps\":%u,"
+           "\"avg_frame_bytes\":%u,"
+           "\"sent_kbps\":%u,"
+           "\"offered_kbps\":%u"
+           "}",
+           rate_control.enabled ? "true" : "false",
+           rate_control.target_kbps,
+           rate_control.min_quality,
+           rate_control.max_quality,
+           rate_control.adjust_framesize ? "true" : "false",
+           rate_control.min_framesize,
+           rate_control.max_framesize,
+           s ? s->status.quality : -1,
+           s ? s->status.framesize : -1,
+           rate_control.fps,
+           rate_control.avg_frame_bytes,
+           rate_control.sent_kbps,
+           rate_control.offered_kbps);
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, response, strlen(response));
+}
+
+// Handler for changing the governor settings
+static esp_err_t rate_control_set_handler(httpd_req_t *req) {
+  char query[256];
+  char param[32];
+
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) {
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+
+  if (httpd_query_key_value(query, "enabled", param, sizeof(param)) == ESP_OK) {
+    rate_control.enabled = (strcmp(param, "1") == 0 || strcmp(param, "true") == 0);
+  }
+  if (httpd_query_key_value(query, "target_kbps", param, sizeof(param)) == ESP_OK) {
+    int kbps = atoi(param);
+    if (kbps > 0) {
+      rate_control.target_kbps = kbps;
+    }
+  }
+  if (httpd_query_key_value(query, "min_quality", param, sizeof(param)) == ESP_OK) {
+    rate_control.min_quality = constrain(atoi(param), 0, 63);
+  }
+  if (httpd_query_key_value(query, "max_quality", param, sizeof(param)) == ESP_OK) {
+    rate_control.max_quality = constrain(atoi(param), 0, 63);
+  }
+  if (rate_control.max_quality < rate_control.min_quality) {
+    rate_control.max_quality = rate_control.min_quality;
+  }
+  if (httpd_query_key_value(query, "adjust_framesize", param, sizeof(param)) == ESP_OK) {
+    rate_control.adjust_framesize = (strcmp(param, "1") == 0 || strcmp(param, "true") == 0);
+  }
+  if (httpd_query_key_value(query, "min_framesize", param, sizeof(param)) == ESP_OK) {
+    rate_control.min_framesize = constrain(atoi(param), 0, FRAMESIZE_INVALID - 1);
+  }
+  if (httpd_query_key_value(query, "max_framesize", param, sizeof(param)) == ESP_OK) {
+    rate_control.max_framesize = constrain(atoi(param), 0, FRAMESIZE_INVALID - 1);
+  }
+  if (rate_control.max_framesize < rate_control.min_framesize) {
+    rate_control.max_framesize = rate_control.min_framesize;
+  }
+  rate_control.settle = 0;
+
+  return rate_control_get_handler(req);
+}
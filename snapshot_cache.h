@@ -0,0 +1,191 @@
+#pragma once
+
+#include <sys/time.h>
+#include <time.h>
+#include "esp_camera.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "img_converters.h"
+#include "frame_fanout.h"
+#include "jpeg_transcode.h"
+#include "log_ring.h"
+#include "metrics.h"
+
+// Snapshot cache for /capture.
+// The most recent JPEG is kept in a PSRAM copy that is refreshed at most
+// once per frame. While streams run it is copied from the fan-out's current
+// frame, so pollers never take a buffer from the driver; only when nothing
+// recent is around does a poll fall back to esp_camera_fb_get().
+// Only the control server task uses the cache, so it needs no lock.
+
+#define SNAPSHOT_MAXAGE_MS 100
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  size_t cap;
+  uint32_t seq;               // Fan-out sequence, 0 when taken from the sensor
+  int64_t time;               // esp_timer time the frame became available
+  struct timeval timestamp;   // Driver capture timestamp
+  time_t modified;            // Wall clock seconds for Last-Modified
+  bool valid;
+} snapshot_t;
+
+static snapshot_t snapshot;
+
+// Last ?roi=/?scale= variant of the snapshot, shared by pollers asking for
+// the same one
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  int scale;
+  bool cropped;
+  jpeg_roi_t roi;             // As requested
+  jpeg_roi_t applied;         // Region actually kept, in frame pixels
+  int64_t time;               // snapshot.time it was made from
+} snapshot_variant_t;
+
+static snapshot_variant_t snapshot_variant;
+
+// Copy a JPEG into the snapshot slot, growing it in PSRAM when needed
+static bool snapshot_store(const uint8_t *buf, size_t len, uint32_t seq, int64_t available,
+                           const struct timeval *timestamp) {
+  if (len > snapshot.cap) {
+    uint8_t *grown = (uint8_t *)heap_caps_realloc(snapshot.buf, len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!grown) {
+      LOGR_E("Snapshot alloc of %u bytes failed", (unsigned)len);
+      snapshot.valid = false;
+      return false;
+    }
+    snapshot.buf = grown;
+    snapshot.cap = len;
+  }
+  memcpy(snapshot.buf, buf, len);
+  snapshot.len = len;
+  snapshot.seq = seq;
+  snapshot.time = available;
+  snapshot.timestamp = *timestamp;
+  snapshot.modified = time(NULL) - (time_t)((esp_timer_get_time() - available) / 1000000);
+  snapshot.valid = true;
+  return true;
+}
+
+// Take a frame straight from the sensor into the snapshot slot
+static bool snapshot_capture() {
+  int64_t start = esp_timer_get_time();
+  camera_fb_t *fb = esp_camera_fb_get();
+  // A buffer queued before the last /control change is one frame stale
+  if (fb && frame_fanout_stale(&fb->timestamp)) {
+    metric_inc(&metric_frames_dropped_settling);
+    esp_camera_fb_return(fb);
+    fb = esp_camera_fb_get();
+  }
+  metric_observe(&metric_fb_get_wait, esp_timer_get_time() - start);
+  if (!fb) {
+    metric_inc(&metric_capture_failures);
+    LOGR_E("Camera capture failed");
+    return false;
+  }
+  metric_inc(&metric_capture_sensor);
+
+  bool stored;
+  int64_t now = esp_timer_get_time();
+  if (fb->format == PIXFORMAT_JPEG) {
+    stored = snapshot_store(fb->buf, fb->len, 0, now, &fb->timestamp);
+  } else {
+    uint8_t *jpeg = NULL;
+    size_t jpeg_len = 0;
+    int64_t encode_start = esp_timer_get_time();
+    stored = frame2jpg(fb, 80, &jpeg, &jpeg_len);
+    metric_observe(&metric_jpeg_encode, esp_timer_get_time() - encode_start);
+    if (!stored) {
+      LOGR_E("JPEG compression failed");
+    } else {
+      stored = snapshot_store(jpeg, jpeg_len, 0, now, &fb->timestamp);
+    }
+    free(jpeg);
+  }
+  esp_camera_fb_return(fb);
+  return stored;
+}
+
+// Return a snapshot no older than max_age_us, refreshing it from the
+// fan-out or the sensor when needed. NULL when no frame could be taken.
+const snapshot_t *snapshot_get(int64_t max_age_us) {
+  int64_t now = esp_timer_get_time();
+
+  shared_frame_t *frame = frame_fanout_acquire();
+  if (frame && now - frame->published <= max_age_us) {
+    bool fresh = snapshot.valid && snapshot.seq == frame->seq;
+    if (!fresh) {
+      fresh = snapshot_store(frame->buf, frame->len, frame->seq, frame->published, &frame->timestamp);
+    }
+    frame_fanout_release(frame);
+    if (fresh) {
+      metric_inc(&metric_capture_snapshot);
+      return &snapshot;
+    }
+  } else {
+    frame_fanout_release(frame);
+  }
+
+  if (snapshot.valid && now - snapshot.time <= max_age_us && !frame_fanout_stale(&snapshot.timestamp)) {
+    metric_inc(&metric_capture_snapshot);
+    return &snapshot;
+  }
+  return snapshot_capture() ? &snapshot : NULL;
+}
+
+// The snapshot cropped to roi (NULL for all of it) and downscaled by
+// scale, transcoded at most once per frame. applied receives the region kept.
+static bool snapshot_transcode(const snapshot_t *snap, const jpeg_roi_t *roi, int scale, const uint8_t **buf,
+                               size_t *len, jpeg_roi_t *applied) {
+  snapshot_variant_t *v = &snapshot_variant;
+  bool same = v->buf && v->time == snap->time && v->scale == scale && v->cropped == (roi != NULL) &&
+              (!roi || memcmp(&v->roi, roi, sizeof(*roi)) == 0);
+  if (!same) {
+    uint8_t *out = NULL;
+    size_t out_len = 0;
+    jpeg_roi_t kept;
+    int64_t start = esp_timer_get_time();
+    // The cached variant stays intact until the new one is complete
+    if (!jpeg_transcode(snap->buf, snap->len, roi, scale, &out, &out_len, &kept)) {
+      LOGR_E("JPEG transcode failed");
+      return false;
+    }
+    metric_observe(&metric_jpeg_transcode, esp_timer_get_time() - start);
+    free(v->buf);
+    v->buf = out;
+    v->len = out_len;
+    v->applied = kept;
+    v->scale = scale;
+    v->cropped = roi != NULL;
+    if (roi) {
+      v->roi = *roi;
+    }
+    v->time = snap->time;
+  }
+  *buf = v->buf;
+  *len = v->len;
+  *applied = v->applied;
+  return true;
+}
+
+// Strong validator of the cached frame; every crop and scale is its own
+// representation
+static void snapshot_etag(const snapshot_t *snap, const jpeg_roi_t *roi, int scale, char *buf, size_t len) {
+  if (roi) {
+    snprintf(buf, len, "\"%llx-%d-%d,%d,%d,%d\"", (unsigned long long)snap->time, scale, roi->x, roi->y, roi->w,
+             roi->h);
+  } else if (scale > 1) {
+    snprintf(buf, len, "\"%llx-%d\"", (unsigned long long)snap->time, scale);
+  } else {
+    snprintf(buf, len, "\"%llx\"", (unsigned long long)snap->time);
+  }
+}
+
+static void snapshot_last_modified(const snapshot_t *snap, char *buf, size_t len) {
+  struct tm tm;
+  gmtime_r(&snap->modified, &tm);
+  strftime(buf, len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
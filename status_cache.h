@@ -0,0 +1,269 @@
+#pragma once
+
+#include <Arduino.h>
+#include "esp_http_server.h"
+#include "esp_timer.h"
+#include "async_workers.h"
+#include "log_ring.h"
+#include "metrics.h"
+
+// Pre-serialized /status document.
+// The JSON is only rebuilt when a fingerprint of the settings changes, which
+// also catches changes made behind /control's back (rate control, /reg).
+// Built documents are immutable and reference counted, so requests on any
+// task share them without formatting or copying. The fingerprint doubles
+// as the ETag.
+// /status?wait=s parks the request on an async worker until the document
+// differs from the client's If-None-Match (or the one current when it
+// arrived), or answers 304 when the wait runs out. Code that changes
+// settings calls status_cache_notify(), which bumps a version; parked
+// requests only look at the settings again when it moved, and write their
+// answer without blocking the worker's other sessions.
+
+#define STATUS_JSON_MAX 1024
+#define STATUS_MAX_WAIT_S 60
+#define STATUS_STALL_TIMEOUT_US (10 * 1000000LL)
+
+typedef struct {
+  int refs;
+  uint32_t fingerprint;
+  size_t len;
+  char json[STATUS_JSON_MAX];
+} status_doc_t;
+
+// Provided by the owner of the settings
+typedef struct {
+  uint32_t (*fingerprint)();
+  size_t (*render)(char *buf, size_t len);
+} status_source_t;
+
+static status_source_t status_source;
+static status_doc_t *status_current = NULL;
+static volatile uint32_t status_version = 0;   // Bumped by status_cache_notify()
+static portMUX_TYPE status_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *_STATUS_RESPONSE =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: %u\r\n"
+    "ETag: \"%08lx\"\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "\r\n";
+static const char *_STATUS_NOT_MODIFIED =
+    "HTTP/1.1 304 Not Modified\r\n"
+    "ETag: \"%08lx\"\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "\r\n";
+
+void status_cache_init(uint32_t (*fingerprint)(), size_t (*render)(char *buf, size_t len)) {
+  status_source.fingerprint = fingerprint;
+  status_source.render = render;
+}
+
+void status_doc_release(status_doc_t *doc) {
+  if (!doc) {
+    return;
+  }
+  portENTER_CRITICAL(&status_mux);
+  bool last = --doc->refs == 0;
+  portEXIT_CRITICAL(&status_mux);
+  if (last) {
+    free(doc);
+  }
+}
+
+// The current document, rebuilt first if the settings changed. NULL when
+// out of memory; release it after use.
+status_doc_t *status_doc_acquire() {
+  uint32_t fingerprint = status_source.fingerprint();
+
+  portENTER_CRITICAL(&status_mux);
+  status_doc_t *doc = status_current;
+  if (doc && doc->fingerprint == fingerprint) {
+    doc->refs++;
+    portEXIT_CRITICAL(&status_mux);
+    return doc;
+  }
+  portEXIT_CRITICAL(&status_mux);
+
+  // A settings change racing the render only costs one more rebuild
+  doc = (status_doc_t *)malloc(sizeof(status_doc_t));
+  if (!doc) {
+    return NULL;
+  }
+  doc->refs = 2;   // The cache and the caller
+  doc->fingerprint = fingerprint;
+  doc->len = status_source.render(doc->json, sizeof(doc->json));
+  metric_inc(&metric_status_renders);
+
+  portENTER_CRITICAL(&status_mux);
+  status_doc_t *old = status_current;
+  status_current = doc;
+  portEXIT_CRITICAL(&status_mux);
+  status_doc_release(old);
+  return doc;
+}
+
+// Call after changing settings; wakes parked /status?wait= requests
+void status_cache_notify() {
+  __atomic_add_fetch(&status_version, 1, __ATOMIC_RELEASE);
+  async_workers_wake();
+}
+
+typedef struct {
+  uint32_t fingerprint;     // Document the client already has
+  uint32_t version;         // status_version when the settings were last compared
+  bool conditional;         // Sent If-None-Match, so a timeout is a 304
+  int64_t deadline;
+  status_doc_t *doc;        // Answer being sent, NULL while waiting
+  char head[256];
+  struct iovec iov[2];
+  int iovcnt;
+  int64_t last_progress;
+} status_wait_t;
+
+// Settle on the answer once the settings changed or the wait ran out.
+// False while the request should keep waiting.
+static bool status_wait_ready(status_wait_t *wait, int64_t now) {
+  uint32_t version = __atomic_load_n(&status_version, __ATOMIC_ACQUIRE);
+  bool expired = now >= wait->deadline;
+  if (version == wait->version && !expired) {
+    return false;
+  }
+  wait->version = version;
+
+  status_doc_t *doc = status_doc_acquire();
+  if (!doc) {
+    return false;
+  }
+  bool changed = doc->fingerprint != wait->fingerprint;
+  if (!changed && !expired) {
+    // Notified, but nothing /status shows moved
+    status_doc_release(doc);
+    return false;
+  }
+
+  wait->iovcnt = 1;
+  if (changed || !wait->conditional) {
+    wait->iov[0].iov_len = snprintf(wait->head, sizeof(wait->head), _STATUS_RESPONSE, (unsigned)doc->len,
+                                    (unsigned long)doc->fingerprint);
+    wait->iov[1].iov_base = doc->json;
+    wait->iov[1].iov_len = doc->len;
+    wait->iovcnt = 2;
+  } else {
+    wait->iov[0].iov_len = snprintf(wait->head, sizeof(wait->head), _STATUS_NOT_MODIFIED,
+                                    (unsigned long)doc->fingerprint);
+    metric_inc(&metric_status_not_modified);
+  }
+  wait->iov[0].iov_base = wait->head;
+  wait->doc = doc;
+  wait->last_progress = now;
+  return true;
+}
+
+static esp_err_t status_wait_service(async_session_t *session) {
+  status_wait_t *wait = (status_wait_t *)session->ctx;
+  int64_t now = esp_timer_get_time();
+  if (!wait->doc && !status_wait_ready(wait, now)) {
+    return ESP_OK;
+  }
+
+  while (wait->iovcnt > 0) {
+    ssize_t sent = async_session_try_send(session, wait->iov, wait->iovcnt);
+    if (sent < 0) {
+      return ESP_FAIL;
+    }
+    if (sent == 0) {
+      break;
+    }
+    wait->last_progress = now;
+    struct iovec *iov = wait->iov;
+    while (wait->iovcnt > 0 && (size_t)sent >= iov->iov_len) {
+      sent -= iov->iov_len;
+      memmove(iov, iov + 1, (wait->iovcnt - 1) * sizeof(*iov));
+      wait->iovcnt--;
+    }
+    if (wait->iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + sent;
+      iov->iov_len -= sent;
+    }
+  }
+
+  session->want_write = wait->iovcnt > 0;
+  if (!session->want_write) {
+    return ASYNC_SESSION_DONE;
+  }
+  return now - wait->last_progress > STATUS_STALL_TIMEOUT_US ? ESP_FAIL : ESP_OK;
+}
+
+static void status_wait_close(async_session_t *session) {
+  status_wait_t *wait = (status_wait_t *)session->ctx;
+  status_doc_release(wait->doc);
+  free(wait);
+}
+
+static const async_session_ops_t status_wait_ops = {
+  NULL,
+  status_wait_service,
+  status_wait_close,
+};
+
+// Handler for /status[?wait=seconds]
+static esp_err_t status_cache_handler(httpd_req_t *req) {
+  // Read before the document, so a change racing this request still wakes it
+  uint32_t version = __atomic_load_n(&status_version, __ATOMIC_ACQUIRE);
+  status_doc_t *doc = status_doc_acquire();
+  if (!doc) {
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+  char etag[16];
+  snprintf(etag, sizeof(etag), "\"%08lx\"", (unsigned long)doc->fingerprint);
+
+  char validator[64];
+  bool conditional = httpd_req_get_hdr_value_str(req, "If-None-Match", validator, sizeof(validator)) == ESP_OK;
+  bool not_modified = conditional && (strstr(validator, etag) != NULL || strcmp(validator, "*") == 0);
+
+  int wait_s = 0;
+  char query[32];
+  char param[8];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "wait", param, sizeof(param)) == ESP_OK) {
+    wait_s = constrain(atoi(param), 0, STATUS_MAX_WAIT_S);
+  }
+
+  // Park the request unless the client is already out of date
+  if (wait_s > 0 && (!conditional || not_modified)) {
+    status_wait_t *wait = (status_wait_t *)calloc(1, sizeof(status_wait_t));
+    if (wait) {
+      wait->fingerprint = doc->fingerprint;
+      wait->version = version;
+      wait->conditional = conditional;
+      wait->deadline = esp_timer_get_time() + wait_s * 1000000LL;
+      if (async_session_start(req, ASYNC_CLASS_WAIT, &status_wait_ops, wait) == ESP_OK) {
+        status_doc_release(doc);
+        return ESP_OK;
+      }
+      free(wait);
+    }
+    // Too many waiters, answer now and let the client poll again
+    LOGR_W("No async slot for /status?wait=, answering immediately");
+  }
+
+  httpd_resp_set_hdr(req, "ETag", etag);
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  esp_err_t res;
+  if (not_modified) {
+    metric_inc(&metric_status_not_modified);
+    httpd_resp_set_status(req, "304 Not Modified");
+    res = httpd_resp_send(req, NULL, 0);
+  } else {
+    httpd_resp_set_type(req, "application/json");
+    res = httpd_resp_send(req, doc->json, doc->len);
+  }
+  status_doc_release(doc);
+  return res;
+}